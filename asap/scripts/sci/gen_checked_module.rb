@@ -0,0 +1,91 @@
+#!/usr/bin/env ruby
+
+# Generates a large LLVM module whose functions are full of sanity checks,
+# shaped like the output of ASan, UBSan and TSan with -tsan-guard-accesses.
+# Used to benchmark the analyses that find sanity check instructions.
+#
+# Usage: gen_checked_module.rb <functions> <accesses per function> > out.ll
+#
+# Each function is a loop. Every iteration performs the given number of
+# accesses, each with an ASan check (including the slow path for partial
+# granules), a guarded TSan callback, and a UBSan overflow check on the
+# running sum.
+
+# This file is part of ASAP.
+# Please see LICENSE.txt for copyright and licensing information.
+
+if ARGV.size != 2
+  $stderr.puts "usage: #{$0} <functions> <accesses per function>"
+  exit 2
+end
+num_functions = Integer(ARGV[0])
+num_accesses = Integer(ARGV[1])
+
+puts <<HEADER
+declare void @__asan_report_load4(i64)
+declare void @__tsan_read4(i8*)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+
+HEADER
+
+num_functions.times do |f|
+  puts "define i32 @f#{f}(i32* %p, i64 %n) {"
+  puts "entry:"
+  puts "  br label %loop"
+  puts "loop:"
+  puts "  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]"
+  puts "  %sum.0 = phi i32 [ 0, %entry ], [ %sum.#{num_accesses}, %latch ]"
+  puts "  %base = mul i64 %i, #{num_accesses}"
+  prev = "loop"
+  num_accesses.times do |a|
+    s = ".#{a}"
+    puts "  %idx#{s} = add i64 %base, #{a}"
+    puts "  %ptr#{s} = getelementptr i32, i32* %p, i64 %idx#{s}"
+    puts "  %addr#{s} = ptrtoint i32* %ptr#{s} to i64"
+    puts "  %shr#{s} = lshr i64 %addr#{s}, 3"
+    puts "  %off#{s} = add i64 %shr#{s}, 2147450880"
+    puts "  %shadowp#{s} = inttoptr i64 %off#{s} to i8*"
+    puts "  %shadow#{s} = load i8, i8* %shadowp#{s}"
+    puts "  %nz#{s} = icmp ne i8 %shadow#{s}, 0"
+    puts "  br i1 %nz#{s}, label %slow#{s}, label %tsan#{s}"
+    puts "slow#{s}:"
+    puts "  %low#{s} = and i64 %addr#{s}, 7"
+    puts "  %last#{s} = add i64 %low#{s}, 3"
+    puts "  %last8#{s} = trunc i64 %last#{s} to i8"
+    puts "  %bad#{s} = icmp sge i8 %last8#{s}, %shadow#{s}"
+    puts "  br i1 %bad#{s}, label %report#{s}, label %tsan#{s}"
+    puts "report#{s}:"
+    puts "  call void @__asan_report_load4(i64 %addr#{s})"
+    puts "  unreachable"
+    puts "tsan#{s}:"
+    puts "  br i1 true, label %tsancall#{s}, label %access#{s}"
+    puts "tsancall#{s}:"
+    puts "  %raw#{s} = bitcast i32* %ptr#{s} to i8*"
+    puts "  call void @__tsan_read4(i8* %raw#{s})"
+    puts "  br label %access#{s}"
+    puts "access#{s}:"
+    puts "  %val#{s} = load i32, i32* %ptr#{s}"
+    puts "  %add#{s} = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %sum.#{a}, i32 %val#{s})"
+    puts "  %res#{s} = extractvalue { i32, i1 } %add#{s}, 0"
+    puts "  %ovf#{s} = extractvalue { i32, i1 } %add#{s}, 1"
+    puts "  %ok#{s} = xor i1 %ovf#{s}, true"
+    puts "  br i1 %ok#{s}, label %cont#{s}, label %overflow#{s}"
+    puts "overflow#{s}:"
+    puts "  %lhs#{s} = zext i32 %sum.#{a} to i64"
+    puts "  %rhs#{s} = zext i32 %val#{s} to i64"
+    puts "  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 %lhs#{s}, i64 %rhs#{s})"
+    puts "  unreachable"
+    puts "cont#{s}:"
+    puts "  %sum.#{a + 1} = add i32 %res#{s}, 0"
+  end
+  puts "  br label %latch"
+  puts "latch:"
+  puts "  %i.next = add i64 %i, 1"
+  puts "  %done = icmp eq i64 %i.next, %n"
+  puts "  br i1 %done, label %exit, label %loop"
+  puts "exit:"
+  puts "  ret i32 %sum.#{num_accesses}"
+  puts "}"
+  puts
+end
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# Measures how long -sanity-check-instructions takes on large generated
+# modules, and optionally compares against another build of the plugin.
+#
+# Usage: run_sci_benchmark.sh <SanityChecks.so> [<baseline SanityChecks.so>]
+#
+# Both plugins must find the same checks; the script fails otherwise.
+# Set OPT to use an opt binary other than the one in PATH.
+
+# This file is part of ASAP.
+# Please see LICENSE.txt for copyright and licensing information.
+
+set -e
+set -o pipefail
+
+SCRIPT_DIR="$( dirname "$( readlink -f "${BASH_SOURCE[0]}" )" )"
+OPT="${OPT:-opt}"
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+    echo "usage: $0 <SanityChecks.so> [<baseline SanityChecks.so>]" >&2
+    exit 2
+fi
+plugins="$1 $2"
+
+# Module shapes, as "<functions>x<accesses per function>". Each access
+# yields three checks and roughly 30 instructions.
+SHAPES="
+    1000x20
+    200x100
+    20x1000
+    4x5000
+"
+
+workdir="$( mktemp -d )"
+trap 'rm -rf "$workdir"' EXIT
+
+# Prints the wall time of the analysis, in seconds
+time_analysis() {
+    local plugin="$1"
+    local module="$2"
+    "$OPT" -load "$plugin" -sanity-check-instructions -disable-output \
+        -time-passes "$module" 2>&1 \
+        | grep "Finds instructions belonging to sanity checks" \
+        | awk '{ print $(NF - 8) }'
+}
+
+printf "%-12s %14s %12s" "shape" "instructions" "time (s)"
+if [ -n "$2" ]; then
+    printf " %12s" "baseline (s)"
+fi
+echo
+
+for shape in $SHAPES; do
+    functions="${shape%x*}"
+    accesses="${shape#*x}"
+    module="$workdir/$shape.bc"
+    "$SCRIPT_DIR/gen_checked_module.rb" "$functions" "$accesses" \
+        | "$OPT" -o "$module"
+    instructions="$( "$OPT" -instcount -stats -disable-output "$module" 2>&1 \
+        | awk '/Number of instructions \(of all types\)/ { print $1 }' )"
+
+    printf "%-12s %14s" "$shape" "${instructions:-?}"
+    reference=
+    for plugin in $plugins; do
+        printf " %12s" "$( time_analysis "$plugin" "$module" )"
+
+        result="$( "$OPT" -load "$plugin" -analyze \
+            -sanity-check-instructions "$module" | md5sum )"
+        if [ -n "$reference" ] && [ "$result" != "$reference" ]; then
+            echo
+            echo "$plugin finds different checks in $shape" >&2
+            exit 1
+        fi
+        reference="$result"
+    done
+    echo
+done
@@ -90,6 +90,11 @@ public:
     /// peephole optimizations similar to the instruction combiner. These passes
     /// will be inserted after each instance of the instruction combiner pass.
     EP_Peephole,
+
+    /// EP_FullLinkTimeOptimizationEarly - This extension point allows adding
+    /// passes that see the merged module of a full LTO link, before any
+    /// link-time optimization has been performed.
+    EP_FullLinkTimeOptimizationEarly,
   };
 
   /// The Optimization Level - Specify the basic optimization level.
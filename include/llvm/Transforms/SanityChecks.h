@@ -0,0 +1,64 @@
+//===- Transforms/SanityChecks.h - ASAP passes ------------------*- C++ -*-===//
+//
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines constructor functions for the ASAP passes, for tools that
+// link the SanityChecks library instead of loading it as a plugin.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_SANITYCHECKS_H
+#define LLVM_TRANSFORMS_SANITYCHECKS_H
+
+#include <cstdint>
+
+namespace llvm {
+
+class ModulePass;
+class PassManagerBuilder;
+class StringRef;
+class raw_ostream;
+
+namespace legacy {
+class PassManagerBase;
+}
+
+// Removes sanity checks that are too costly, based on profiling data.
+ModulePass *createAsapPass();
+
+// Counts how often each sanity check is executed (-asap-profiling).
+ModulePass *createAsapProfilingPass();
+
+// Computes the cost of each sanity check (-sanity-check-cost). If GCNOName
+// and GCDAName are given, they are used instead of the profile options on the
+// command line. Add this before ASAP to use per-object coverage files.
+ModulePass *createSanityCheckCostPass(StringRef GCNOName, StringRef GCDAName);
+
+// Prints the costs computed by -sanity-check-cost to OS. By default, the
+// format is the same as for opt -analyze -sanity-check-cost. If Binary is
+// set, the costs are written in the binary costs format below.
+ModulePass *createSanityCheckCostPrinterPass(raw_ostream &OS,
+                                             bool Binary = false);
+
+// The binary costs format contains only the costs of all checks in a module,
+// without their locations. All fields are 64-bit words in host byte order:
+//
+//   Magic, Version, NumCosts, NumCosts x Cost
+//
+// Costs are sorted in decreasing order, so that the costs of many modules can
+// be merged in a streaming fashion.
+const uint64_t SanityCheckCostsMagic = 0x54534f4350415341ULL;  // "ASAPCOST"
+const uint64_t SanityCheckCostsVersion = 1;
+
+// Adds ASAP to a link-time optimization pipeline if -asap-lto is given. This
+// is meant to be registered at EP_FullLinkTimeOptimizationEarly: ASAP then
+// sees the whole program, and the CFG still matches the profiling data.
+void addAsapLTOPasses(const PassManagerBuilder &Builder,
+                      legacy::PassManagerBase &PM);
+
+} // End llvm namespace
+
+#endif
@@ -51,6 +51,7 @@
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/SanityChecks.h"
 #include "llvm/Transforms/ObjCARC.h"
 #include <system_error>
 using namespace llvm;
@@ -537,6 +538,10 @@ bool LTOCodeGenerator::optimize(bool DisableInline,
   PMB.OptLevel = OptLevel;
   PMB.VerifyInput = true;
   PMB.VerifyOutput = true;
+#ifdef LLVM_ASAP_LTO
+  PMB.addExtension(PassManagerBuilder::EP_FullLinkTimeOptimizationEarly,
+                   addAsapLTOPasses);
+#endif
 
   PMB.populateLTOPassManager(passes);
 
@@ -18,15 +18,18 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DataLayout.h"
@@ -34,6 +37,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
@@ -76,6 +80,13 @@ static const uint64_t kFreeBSD_ShadowOffset32 = 1ULL << 30;
 static const uint64_t kFreeBSD_ShadowOffset64 = 1ULL << 46;
 static const uint64_t kWindowsShadowOffset32 = 3ULL << 28;
 
+// Merged checks cover at most this many bytes. Heap redzones are at least as
+// large, so checking the first and last byte of a merged region cannot miss
+// a redzone in between.
+static const uint64_t kMaxMergedCheckSize = 16;
+// Merged accesses may be at most this many basic blocks apart.
+static const unsigned kMaxBlocksBetweenMergedChecks = 32;
+
 static const size_t kMinStackMallocSize = 1 << 6;   // 64B
 static const size_t kMaxStackMallocSize = 1 << 16;  // 64K
 static const uintptr_t kCurrentStackFrameMagic = 0x41B58AB3;
@@ -85,6 +96,7 @@ static const char *const kAsanModuleCtorName = "asan.module_ctor";
 static const char *const kAsanModuleDtorName = "asan.module_dtor";
 static const uint64_t kAsanCtorAndDtorPriority = 1;
 static const char *const kAsanReportErrorTemplate = "__asan_report_";
+static const char *const kAsanCheckThunkPrefix = "__asan_check_";
 static const char *const kAsanRegisterGlobalsName = "__asan_register_globals";
 static const char *const kAsanUnregisterGlobalsName =
     "__asan_unregister_globals";
@@ -171,6 +183,16 @@ static cl::opt<int> ClInstrumentationWithCallsThreshold(
         "this number of memory accesses, use callbacks instead of "
         "inline checks (-1 means never use callbacks)."),
     cl::Hidden, cl::init(7000));
+static cl::opt<bool> ClCheckThunks(
+    "asan-check-thunks",
+    cl::desc("Check cold accesses by calling shared check thunks instead of "
+             "inlining the checks"),
+    cl::Hidden, cl::init(false));
+static cl::opt<unsigned long long> ClCheckThunksHotCount(
+    "asan-check-thunks-hot-count",
+    cl::desc("Accesses that the profile says ran more often than this keep "
+             "inline checks with -asan-check-thunks"),
+    cl::Hidden, cl::init(0));
 static cl::opt<std::string> ClMemoryAccessCallbackPrefix(
     "asan-memory-access-callback-prefix",
     cl::desc("Prefix for memory access callbacks"), cl::Hidden,
@@ -203,6 +225,10 @@ static cl::opt<bool> ClOptGlobals("asan-opt-globals",
 static cl::opt<bool> ClOptStack(
     "asan-opt-stack", cl::desc("Don't instrument scalar stack variables"),
     cl::Hidden, cl::init(false));
+static cl::opt<bool> ClOptMergeChecks(
+    "asan-opt-merge-checks",
+    cl::desc("Merge checks of adjacent accesses from the same base pointer"),
+    cl::Hidden, cl::init(false));
 
 static cl::opt<bool> ClCheckLifetime(
     "asan-check-lifetime",
@@ -237,6 +263,9 @@ STATISTIC(NumOptimizedAccessesToGlobalVar,
           "Number of optimized accesses to global vars");
 STATISTIC(NumOptimizedAccessesToStackVar,
           "Number of optimized accesses to stack vars");
+STATISTIC(NumMergedAccesses,
+          "Number of accesses checked by the check of another access");
+STATISTIC(NumThunkedAccesses, "Number of accesses checked by check thunks");
 
 namespace {
 /// Frontend-provided metadata for source location.
@@ -399,6 +428,7 @@ struct AddressSanitizer : public FunctionPass {
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<DominatorTreeWrapperPass>();
     AU.addRequired<TargetLibraryInfoWrapperPass>();
+    if (ClCheckThunks) AU.addRequired<BlockFrequencyInfo>();
   }
   uint64_t getAllocaSizeInBytes(AllocaInst *AI) const {
     Type *Ty = AI->getAllocatedType();
@@ -419,17 +449,28 @@ struct AddressSanitizer : public FunctionPass {
   Value *isInterestingMemoryAccess(Instruction *I, bool *IsWrite,
                                    uint64_t *TypeSize, unsigned *Alignment);
   void instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis, Instruction *I,
-                     bool UseCalls, const DataLayout &DL);
+                     bool UseCalls, bool UseThunks, const DataLayout &DL);
+  void instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis, Instruction *I,
+                     Value *Addr, uint64_t TypeSize, unsigned Alignment,
+                     bool IsWrite, bool UseCalls, bool UseThunks,
+                     const DataLayout &DL);
   void instrumentPointerComparisonOrSubtraction(Instruction *I);
   void instrumentAddress(Instruction *OrigIns, Instruction *InsertBefore,
                          Value *Addr, uint32_t TypeSize, bool IsWrite,
-                         Value *SizeArgument, bool UseCalls, uint32_t Exp);
+                         Value *SizeArgument, bool UseCalls, bool UseThunks,
+                         uint32_t Exp);
   void instrumentUnusualSizeOrAlignment(Instruction *I, Value *Addr,
                                         uint32_t TypeSize, bool IsWrite,
                                         Value *SizeArgument, bool UseCalls,
                                         uint32_t Exp);
+  Value *createShadowLoad(IRBuilder<> &IRB, Value *AddrLong,
+                          uint32_t TypeSize);
   Value *createSlowPathCmp(IRBuilder<> &IRB, Value *AddrLong,
                            Value *ShadowValue, uint32_t TypeSize);
+  void createCheckThunks(Module &M);
+  void createCheckThunkBody(Function *Thunk, Function *SlowPath,
+                            bool IsWrite, uint32_t TypeSize);
+  bool isHotAccess(Instruction *I, BlockFrequencyInfo &BFI);
   Instruction *generateCrashCode(Instruction *InsertBefore, Value *Addr,
                                  bool IsWrite, size_t AccessSizeIndex,
                                  Value *SizeArgument, uint32_t Exp);
@@ -450,6 +491,17 @@ struct AddressSanitizer : public FunctionPass {
   bool isSafeAccess(ObjectSizeOffsetVisitor &ObjSizeVis, Value *Addr,
                     uint64_t TypeSize) const;
 
+  /// Bytes [Begin, End) from Base, checked instead of the access itself.
+  struct MergedCheck {
+    Value *Base;
+    int64_t Begin;
+    int64_t End;
+    unsigned Alignment;
+  };
+  void mergeChecks(Function &F, SmallVectorImpl<Instruction *> &ToInstrument,
+                   DenseMap<Instruction *, MergedCheck> &MergedChecks);
+  bool isMergeable(Instruction *Leader, Instruction *I);
+
   LLVMContext *C;
   Triple TargetTriple;
   int LongSize;
@@ -467,6 +519,8 @@ struct AddressSanitizer : public FunctionPass {
   // This array is indexed by AccessIsWrite and Experiment.
   Function *AsanErrorCallbackSized[2][2];
   Function *AsanMemoryAccessCallbackSized[2][2];
+  // This array is indexed by AccessIsWrite and log2(AccessSize).
+  Function *AsanCheckThunk[2][kNumberOfAccessSizes];
   Function *AsanMemmove, *AsanMemcpy, *AsanMemset;
   InlineAsm *EmptyAsm;
   GlobalsMetadata GlobalsMD;
@@ -697,6 +751,7 @@ INITIALIZE_PASS_BEGIN(
     "AddressSanitizer: detects use-after-free and out-of-bounds bugs.", false,
     false)
 INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(BlockFrequencyInfo)
 INITIALIZE_PASS_END(
     AddressSanitizer, "asan",
     "AddressSanitizer: detects use-after-free and out-of-bounds bugs.", false,
@@ -895,13 +950,21 @@ void AddressSanitizer::instrumentPointerComparisonOrSubtraction(
 
 void AddressSanitizer::instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis,
                                      Instruction *I, bool UseCalls,
-                                     const DataLayout &DL) {
+                                     bool UseThunks, const DataLayout &DL) {
   bool IsWrite = false;
   unsigned Alignment = 0;
   uint64_t TypeSize = 0;
   Value *Addr = isInterestingMemoryAccess(I, &IsWrite, &TypeSize, &Alignment);
   assert(Addr);
+  instrumentMop(ObjSizeVis, I, Addr, TypeSize, Alignment, IsWrite, UseCalls,
+                UseThunks, DL);
+}
 
+void AddressSanitizer::instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis,
+                                     Instruction *I, Value *Addr,
+                                     uint64_t TypeSize, unsigned Alignment,
+                                     bool IsWrite, bool UseCalls,
+                                     bool UseThunks, const DataLayout &DL) {
   // Optimization experiments.
   // The experiments can be used to evaluate potential optimizations that remove
   // instrumentation (assess false negatives). Instead of completely removing
@@ -947,11 +1010,140 @@ void AddressSanitizer::instrumentMop(ObjectSizeOffsetVisitor &ObjSizeVis,
        TypeSize == 128) &&
       (Alignment >= Granularity || Alignment == 0 || Alignment >= TypeSize / 8))
     return instrumentAddress(I, I, Addr, TypeSize, IsWrite, nullptr, UseCalls,
-                             Exp);
+                             UseThunks, Exp);
   instrumentUnusualSizeOrAlignment(I, Addr, TypeSize, IsWrite, nullptr,
                                    UseCalls, Exp);
 }
 
+// Returns true if I is executed whenever Leader is, with no calls in between,
+// so that the check of Leader can also cover I. Calls could free memory or
+// not return.
+bool AddressSanitizer::isMergeable(Instruction *Leader, Instruction *I) {
+  if (!DT->dominates(Leader, I)) return false;
+  BasicBlock *LeaderBB = Leader->getParent();
+  BasicBlock *BB = I->getParent();
+  if (LeaderBB == BB) {
+    for (BasicBlock::iterator It = Leader; &*It != I; ++It)
+      if (CallSite(&*It)) return false;
+    return true;
+  }
+  for (BasicBlock::iterator It = Leader, E = LeaderBB->end(); It != E; ++It)
+    if (CallSite(&*It)) return false;
+  for (BasicBlock::iterator It = BB->begin(); &*It != I; ++It)
+    if (CallSite(&*It)) return false;
+
+  // All paths from LeaderBB must lead to BB without a cycle: a path could
+  // otherwise loop forever and never reach I, or reach LeaderBB again and
+  // check the leader against a base pointer from another iteration. A
+  // depth-first search finds cycles as edges back to a block on the current
+  // path. It gives up after kMaxBlocksBetweenMergedChecks blocks.
+  SmallPtrSet<BasicBlock *, 16> OnPath, Done;
+  SmallVector<std::pair<BasicBlock *, succ_iterator>, 16> Stack;
+  OnPath.insert(LeaderBB);
+  Stack.push_back(std::make_pair(LeaderBB, succ_begin(LeaderBB)));
+  while (!Stack.empty()) {
+    BasicBlock *Block = Stack.back().first;
+    if (Stack.back().second == succ_end(Block)) {
+      OnPath.erase(Block);
+      Done.insert(Block);
+      Stack.pop_back();
+      continue;
+    }
+    BasicBlock *Succ = *Stack.back().second++;
+    if (Succ == BB || Done.count(Succ)) continue;
+    if (OnPath.count(Succ) || succ_begin(Succ) == succ_end(Succ) ||
+        OnPath.size() + Done.size() >= kMaxBlocksBetweenMergedChecks)
+      return false;
+    for (auto &Inst : *Succ)
+      if (CallSite(&Inst)) return false;
+    OnPath.insert(Succ);
+    Stack.push_back(std::make_pair(Succ, succ_begin(Succ)));
+  }
+  return true;
+}
+
+// Merges the checks of accesses to adjacent or overlapping memory from the
+// same base pointer (e.g., fields of one struct, or consecutive array
+// elements) into a single check at the first of these accesses, which
+// dominates the others. Merged accesses are removed from ToInstrument.
+void AddressSanitizer::mergeChecks(
+    Function &F, SmallVectorImpl<Instruction *> &ToInstrument,
+    DenseMap<Instruction *, MergedCheck> &MergedChecks) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SmallPtrSet<Instruction *, 16> Candidates;
+  for (auto Inst : ToInstrument)
+    Candidates.insert(Inst);
+
+  struct Group {
+    Instruction *Leader;
+    int64_t LeaderBegin, LeaderEnd;
+    MergedCheck Check;
+    bool IsWrite;
+  };
+  SmallVector<Group, 16> Groups;
+  DenseMap<Value *, SmallVector<unsigned, 4>> GroupsByBase;
+  SmallPtrSet<Instruction *, 16> Merged;
+
+  // Visit the accesses in dominator tree order, so that the leader of a group
+  // is visited before the accesses it dominates.
+  for (auto Node : depth_first(DT->getRootNode())) {
+    for (auto &Inst : *Node->getBlock()) {
+      if (!Candidates.count(&Inst)) continue;
+      bool IsWrite;
+      uint64_t TypeSize;
+      unsigned Alignment;
+      Value *Addr =
+          isInterestingMemoryAccess(&Inst, &IsWrite, &TypeSize, &Alignment);
+      if (!Addr || TypeSize % 8 != 0 || TypeSize / 8 > kMaxMergedCheckSize)
+        continue;
+      int64_t Begin = 0;
+      Value *Base = GetPointerBaseWithConstantOffset(Addr, Begin, DL);
+      int64_t End = Begin + TypeSize / 8;
+      // Without an explicit alignment, only assume byte alignment.
+      if (Alignment == 0) Alignment = 1;
+
+      bool IsMerged = false;
+      auto &BaseGroups = GroupsByBase[Base];
+      for (auto It = BaseGroups.rbegin(); It != BaseGroups.rend(); ++It) {
+        Group &G = Groups[*It];
+        int64_t NewBegin = std::min(G.Check.Begin, Begin);
+        int64_t NewEnd = std::max(G.Check.End, End);
+        if (G.IsWrite != IsWrite || Begin > G.Check.End ||
+            End < G.Check.Begin ||
+            uint64_t(NewEnd - NewBegin) > kMaxMergedCheckSize ||
+            !isMergeable(G.Leader, &Inst))
+          continue;
+        G.Check.Alignment = std::max(
+            MinAlign(G.Check.Alignment, G.Check.Begin - NewBegin),
+            MinAlign(Alignment, Begin - NewBegin));
+        G.Check.Begin = NewBegin;
+        G.Check.End = NewEnd;
+        Merged.insert(&Inst);
+        NumMergedAccesses++;
+        IsMerged = true;
+        break;
+      }
+      if (!IsMerged) {
+        BaseGroups.push_back(Groups.size());
+        Groups.push_back(
+            {&Inst, Begin, End, {Base, Begin, End, Alignment}, IsWrite});
+      }
+    }
+  }
+
+  if (Merged.empty()) return;
+  for (auto &G : Groups)
+    if (G.Check.Begin != G.LeaderBegin || G.Check.End != G.LeaderEnd)
+      MergedChecks[G.Leader] = G.Check;
+  ToInstrument.erase(std::remove_if(ToInstrument.begin(), ToInstrument.end(),
+                                    [&Merged](Instruction *I) {
+                                      return Merged.count(I) != 0;
+                                    }),
+                     ToInstrument.end());
+  DEBUG(dbgs() << "ASAN merged the checks of " << Merged.size()
+               << " accesses\n");
+}
+
 Instruction *AddressSanitizer::generateCrashCode(Instruction *InsertBefore,
                                                  Value *Addr, bool IsWrite,
                                                  size_t AccessSizeIndex,
@@ -1001,11 +1193,117 @@ Value *AddressSanitizer::createSlowPathCmp(IRBuilder<> &IRB, Value *AddrLong,
   return IRB.CreateICmpSGE(LastAccessedByte, ShadowValue);
 }
 
+Value *AddressSanitizer::createShadowLoad(IRBuilder<> &IRB, Value *AddrLong,
+                                          uint32_t TypeSize) {
+  Type *ShadowTy =
+      IntegerType::get(*C, std::max(8U, TypeSize >> Mapping.Scale));
+  Type *ShadowPtrTy = PointerType::get(ShadowTy, 0);
+  Value *ShadowPtr = memToShadow(AddrLong, IRB);
+  return IRB.CreateLoad(IRB.CreateIntToPtr(ShadowPtr, ShadowPtrTy));
+}
+
+// Creates the check thunks for all kinds and sizes of accesses in M, since a
+// function pass must not add functions. AddressSanitizerModule removes the
+// unused ones. Thunks are internal: ASAP may remove the check of a thunk in
+// one module but not in another, and linkonce_odr copies that differ across
+// modules would break the one-definition rule.
+void AddressSanitizer::createCheckThunks(Module &M) {
+  // preserve_most makes the callee save the registers it uses, so callers
+  // need not spill anything around the call. It is only implemented for
+  // x86-64.
+  CallingConv::ID CC = TargetTriple.getArch() == Triple::x86_64
+                           ? CallingConv::PreserveMost
+                           : CallingConv::C;
+  FunctionType *FnTy = FunctionType::get(Type::getVoidTy(*C), IntptrTy, false);
+  auto CreateFunction = [&](const std::string &FnName) {
+    Function *F =
+        Function::Create(FnTy, GlobalValue::InternalLinkage, FnName, &M);
+    F->setCallingConv(CC);
+    F->addFnAttr(Attribute::NoInline);
+    F->addFnAttr(Attribute::NoUnwind);
+    return F;
+  };
+  for (size_t AccessIsWrite = 0; AccessIsWrite <= 1; AccessIsWrite++) {
+    for (size_t AccessSizeIndex = 0; AccessSizeIndex < kNumberOfAccessSizes;
+         AccessSizeIndex++) {
+      const std::string Name = kAsanCheckThunkPrefix +
+                               std::string(AccessIsWrite ? "store" : "load") +
+                               itostr(1 << AccessSizeIndex);
+      Function *SlowPath = CreateFunction(Name + "_slow");
+      Function *Thunk = CreateFunction(Name);
+      createCheckThunkBody(Thunk, SlowPath, AccessIsWrite,
+                           (1 << AccessSizeIndex) * 8);
+      AsanCheckThunk[AccessIsWrite][AccessSizeIndex] = Thunk;
+    }
+  }
+}
+
+// The thunk only tests the shadow, and calls SlowPath if it is not zero.
+// SlowPath does the rest of the check that instrumentAddress would inline, and
+// reports the error. Since the thunk itself makes no call to a function with
+// the C calling convention, it does not need to save the registers that such
+// a call would clobber.
+void AddressSanitizer::createCheckThunkBody(Function *Thunk,
+                                            Function *SlowPath, bool IsWrite,
+                                            uint32_t TypeSize) {
+  size_t Granularity = 1 << Mapping.Scale;
+  size_t AccessSizeIndex = TypeSizeToSizeIndex(TypeSize);
+
+  Value *AddrLong = &*Thunk->arg_begin();
+  AddrLong->setName("addr");
+  BasicBlock *Entry = BasicBlock::Create(*C, "", Thunk);
+  BasicBlock *CallBlock = BasicBlock::Create(*C, "", Thunk);
+  BasicBlock *RetBlock = BasicBlock::Create(*C, "", Thunk);
+  IRBuilder<> IRB(Entry);
+  Value *ShadowValue = createShadowLoad(IRB, AddrLong, TypeSize);
+  Value *Cmp = IRB.CreateICmpNE(
+      ShadowValue, Constant::getNullValue(ShadowValue->getType()));
+  IRB.CreateCondBr(Cmp, CallBlock, RetBlock,
+                   MDBuilder(*C).createBranchWeights(1, 100000));
+  IRB.SetInsertPoint(CallBlock);
+  IRB.CreateCall(SlowPath, AddrLong)->setCallingConv(
+      SlowPath->getCallingConv());
+  IRB.CreateBr(RetBlock);
+  ReturnInst::Create(*C, RetBlock);
+
+  AddrLong = &*SlowPath->arg_begin();
+  AddrLong->setName("addr");
+  Entry = BasicBlock::Create(*C, "", SlowPath);
+  BasicBlock *CrashBlock = BasicBlock::Create(*C, "", SlowPath);
+  RetBlock = BasicBlock::Create(*C, "", SlowPath);
+  IRB.SetInsertPoint(Entry);
+  if (ClAlwaysSlowPath || (TypeSize < 8 * Granularity)) {
+    ShadowValue = createShadowLoad(IRB, AddrLong, TypeSize);
+    Value *Cmp2 = createSlowPathCmp(IRB, AddrLong, ShadowValue, TypeSize);
+    IRB.CreateCondBr(Cmp2, CrashBlock, RetBlock);
+  } else {
+    IRB.CreateBr(CrashBlock);
+  }
+  generateCrashCode(new UnreachableInst(*C, CrashBlock), AddrLong, IsWrite,
+                    AccessSizeIndex, nullptr, 0);
+  ReturnInst::Create(*C, RetBlock);
+}
+
+// With -asan-check-thunks, accesses in hot blocks keep inline checks. A block
+// is hot if the profile says it ran more than -asan-check-thunks-hot-count
+// times or, without a profile, if it is expected to run more often than its
+// function is entered, i.e., if it lies in a loop. Functions marked cold have
+// no hot blocks.
+bool AddressSanitizer::isHotAccess(Instruction *I, BlockFrequencyInfo &BFI) {
+  Function *F = I->getParent()->getParent();
+  if (F->hasFnAttribute(Attribute::Cold)) return false;
+  uint64_t Freq = BFI.getBlockFreq(I->getParent()).getFrequency();
+  uint64_t EntryFreq = BFI.getEntryFreq();
+  Optional<uint64_t> EntryCount = F->getEntryCount();
+  if (!EntryCount) return Freq > EntryFreq;
+  return double(*EntryCount) * Freq / EntryFreq > ClCheckThunksHotCount;
+}
+
 void AddressSanitizer::instrumentAddress(Instruction *OrigIns,
                                          Instruction *InsertBefore, Value *Addr,
                                          uint32_t TypeSize, bool IsWrite,
                                          Value *SizeArgument, bool UseCalls,
-                                         uint32_t Exp) {
+                                         bool UseThunks, uint32_t Exp) {
   IRBuilder<> IRB(InsertBefore);
   Value *AddrLong = IRB.CreatePointerCast(Addr, IntptrTy);
   size_t AccessSizeIndex = TypeSizeToSizeIndex(TypeSize);
@@ -1020,14 +1318,18 @@ void AddressSanitizer::instrumentAddress(Instruction *OrigIns,
     return;
   }
 
-  Type *ShadowTy =
-      IntegerType::get(*C, std::max(8U, TypeSize >> Mapping.Scale));
-  Type *ShadowPtrTy = PointerType::get(ShadowTy, 0);
-  Value *ShadowPtr = memToShadow(AddrLong, IRB);
-  Value *CmpVal = Constant::getNullValue(ShadowTy);
-  Value *ShadowValue =
-      IRB.CreateLoad(IRB.CreateIntToPtr(ShadowPtr, ShadowPtrTy));
+  // Thunks report fixed access sizes, and are not used for experiments.
+  if (UseThunks && !SizeArgument && Exp == 0) {
+    Function *Thunk = AsanCheckThunk[IsWrite][AccessSizeIndex];
+    CallInst *Call = IRB.CreateCall(Thunk, AddrLong);
+    Call->setCallingConv(Thunk->getCallingConv());
+    Call->setDebugLoc(OrigIns->getDebugLoc());
+    NumThunkedAccesses++;
+    return;
+  }
 
+  Value *ShadowValue = createShadowLoad(IRB, AddrLong, TypeSize);
+  Value *CmpVal = Constant::getNullValue(ShadowValue->getType());
   Value *Cmp = IRB.CreateICmpNE(ShadowValue, CmpVal);
   size_t Granularity = 1 << Mapping.Scale;
   TerminatorInst *CrashTerm = nullptr;
@@ -1076,8 +1378,8 @@ void AddressSanitizer::instrumentUnusualSizeOrAlignment(
     Value *LastByte = IRB.CreateIntToPtr(
         IRB.CreateAdd(AddrLong, ConstantInt::get(IntptrTy, TypeSize / 8 - 1)),
         Addr->getType());
-    instrumentAddress(I, I, Addr, 8, IsWrite, Size, false, Exp);
-    instrumentAddress(I, I, LastByte, 8, IsWrite, Size, false, Exp);
+    instrumentAddress(I, I, Addr, 8, IsWrite, Size, false, false, Exp);
+    instrumentAddress(I, I, LastByte, 8, IsWrite, Size, false, false, Exp);
   }
 }
 
@@ -1353,6 +1655,28 @@ bool AddressSanitizerModule::InstrumentGlobals(IRBuilder<> &IRB, Module &M) {
   return true;
 }
 
+// Removes the check thunks that the function pass created, but no access
+// calls, together with their slow paths.
+static bool removeUnusedCheckThunks(Module &M) {
+  SmallVector<Function *, 16> Unused;
+  for (Function &F : M)
+    if (F.hasLocalLinkage() && F.getName().startswith(kAsanCheckThunkPrefix) &&
+        F.use_empty())
+      Unused.push_back(&F);
+  for (Function *Thunk : Unused) {
+    SmallVector<Function *, 1> SlowPaths;
+    for (Instruction &I : inst_range(Thunk))
+      if (CallInst *CI = dyn_cast<CallInst>(&I))
+        if (Function *Callee = CI->getCalledFunction())
+          if (Callee->hasLocalLinkage() && Callee != Thunk)
+            SlowPaths.push_back(Callee);
+    Thunk->eraseFromParent();
+    for (Function *SlowPath : SlowPaths)
+      if (SlowPath->use_empty()) SlowPath->eraseFromParent();
+  }
+  return !Unused.empty();
+}
+
 bool AddressSanitizerModule::runOnModule(Module &M) {
   C = &(M.getContext());
   int LongSize = M.getDataLayout().getPointerSizeInBits();
@@ -1371,6 +1695,8 @@ bool AddressSanitizerModule::runOnModule(Module &M) {
     Changed |= InstrumentGlobals(IRB, M);
   }
 
+  if (ClCheckThunks) Changed |= removeUnusedCheckThunks(M);
+
   return Changed;
 }
 
@@ -1454,6 +1780,11 @@ bool AddressSanitizer::doInitialization(Module &M) {
     appendToGlobalCtors(M, AsanCtorFunction, kAsanCtorAndDtorPriority);
   }
   Mapping = getShadowMapping(TargetTriple, LongSize, CompileKernel);
+
+  if (ClCheckThunks) {
+    initializeCallbacks(M);
+    createCheckThunks(M);
+  }
   return true;
 }
 
@@ -1545,13 +1876,37 @@ bool AddressSanitizer::runOnFunction(Function &F) {
   ObjectSizeOffsetVisitor ObjSizeVis(DL, TLI, F.getContext(),
                                      /*RoundToAlign=*/true);
 
+  DenseMap<Instruction *, MergedCheck> MergedChecks;
+  if (ClOpt && ClOptMergeChecks) mergeChecks(F, ToInstrument, MergedChecks);
+
+  // Hotness is decided before instrumentation splits any block.
+  SmallPtrSet<Instruction *, 16> ThunkedAccesses;
+  if (ClCheckThunks && !UseCalls) {
+    BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfo>();
+    for (auto Inst : ToInstrument)
+      if (!isHotAccess(Inst, BFI)) ThunkedAccesses.insert(Inst);
+  }
+
   // Instrument.
   int NumInstrumented = 0;
   for (auto Inst : ToInstrument) {
     if (ClDebugMin < 0 || ClDebugMax < 0 ||
         (NumInstrumented >= ClDebugMin && NumInstrumented <= ClDebugMax)) {
-      if (isInterestingMemoryAccess(Inst, &IsWrite, &TypeSize, &Alignment))
-        instrumentMop(ObjSizeVis, Inst, UseCalls,
+      auto Merged = MergedChecks.find(Inst);
+      if (Merged != MergedChecks.end()) {
+        const MergedCheck &MC = Merged->second;
+        isInterestingMemoryAccess(Inst, &IsWrite, &TypeSize, &Alignment);
+        IRBuilder<> IRB(Inst);
+        unsigned AS = MC.Base->getType()->getPointerAddressSpace();
+        Value *Addr = IRB.CreateConstGEP1_64(
+            IRB.CreatePointerCast(MC.Base, IRB.getInt8PtrTy(AS)), MC.Begin);
+        instrumentMop(ObjSizeVis, Inst, Addr, (MC.End - MC.Begin) * 8,
+                      MC.Alignment, IsWrite, UseCalls,
+                      ThunkedAccesses.count(Inst), DL);
+        RecursivelyDeleteTriviallyDeadInstructions(Addr);
+      } else if (isInterestingMemoryAccess(Inst, &IsWrite, &TypeSize,
+                                           &Alignment))
+        instrumentMop(ObjSizeVis, Inst, UseCalls, ThunkedAccesses.count(Inst),
                       F.getParent()->getDataLayout());
       else
         instrumentMemIntrinsic(cast<MemIntrinsic>(Inst));
@@ -59,6 +59,11 @@ static cl::opt<bool>  ClInstrumentAtomics(
 static cl::opt<bool>  ClInstrumentMemIntrinsics(
     "tsan-instrument-memintrinsics", cl::init(true),
     cl::desc("Instrument memintrinsics (memset/memcpy/memmove)"), cl::Hidden);
+static cl::opt<bool>  ClGuardMemoryAccesses(
+    "tsan-guard-accesses", cl::init(false),
+    cl::desc("Put each memory access callback in a block of its own, behind "
+             "a branch on true, so that ASAP can remove it like a check"),
+    cl::Hidden);
 
 STATISTIC(NumInstrumentedReads, "Number of instrumented reads");
 STATISTIC(NumInstrumentedWrites, "Number of instrumented writes");
@@ -449,6 +454,14 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     OnAccessFunc = IsWrite ? TsanWrite[Idx] : TsanRead[Idx];
   else
     OnAccessFunc = IsWrite ? TsanUnalignedWrite[Idx] : TsanUnalignedRead[Idx];
+  if (ClGuardMemoryAccesses) {
+    TerminatorInst *ThenTerm =
+        SplitBlockAndInsertIfThen(IRB.getTrue(), I, false);
+    BasicBlock *Head = ThenTerm->getParent()->getSinglePredecessor();
+    Head->getTerminator()->setDebugLoc(I->getDebugLoc());
+    ThenTerm->setDebugLoc(I->getDebugLoc());
+    IRB.SetInsertPoint(ThenTerm);
+  }
   IRB.CreateCall(OnAccessFunc, IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()));
   if (IsWrite) NumInstrumentedWrites++;
   else         NumInstrumentedReads++;
@@ -2,19 +2,46 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "AsapPass.h"
+#include "CheckHoisting.h"
+#include "CheckSampling.h"
+#include "CheckToggles.h"
+#include "CheckValue.h"
+#include "HotColdCloning.h"
+#include "Knapsack.h"
+#include "MarginalSavings.h"
 #include "SanityCheckCostPass.h"
 #include "SanityCheckInstructionsPass.h"
 #include "utils.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/SanityChecks.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <string>
+#include <vector>
 #define DEBUG_TYPE "asap"
 
 using namespace llvm;
@@ -30,11 +57,172 @@ CostThreshold("asap-cost-threshold",
         cl::desc("Remove checks costing this or more"),
         cl::init((unsigned long long)(-1)));
 
+namespace {
+    enum SelectionMode { GreedySelection, OptimalSelection, ValueSelection };
+}
+
+static cl::opt<SelectionMode>
+Selection("asap-selection",
+        cl::desc("How to select the checks that are removed"),
+        cl::values(
+            clEnumValN(GreedySelection, "greedy",
+                "Remove the most expensive checks first (default)"),
+            clEnumValN(OptimalSelection, "optimal",
+                "Keep as many checks as possible within the -cost-level budget"),
+            clEnumValN(ValueSelection, "value",
+                "Keep the checks with the highest total static value within "
+                "the -cost-level budget"),
+            clEnumValEnd),
+        cl::init(GreedySelection));
+
+static cl::opt<unsigned long long>
+KnapsackTableSize("asap-knapsack-table-size",
+        cl::desc("Maximum table size for exact check selection; larger "
+                 "problems are solved approximately"),
+        cl::init(1ULL << 28), cl::Hidden);
+
+static cl::list<std::string>
+KindBudgets("asap-kind-budget",
+        cl::desc("Give a family of checks its own budget, as "
+                 "<family>=<cost level> or <family>=unlimited. A family is a "
+                 "check kind (asan-read, asan-write, ubsan, assertion, tsan, "
+                 "msan, other) or a prefix of the name of the function that reports "
+                 "the error"),
+        cl::CommaSeparated, cl::ZeroOrMore);
+
+static cl::opt<bool>
+SharedCosts("asap-shared-costs",
+        cl::desc("Account for instructions that are shared among checks, "
+                 "and remove checks by their actual savings"),
+        cl::init(false));
+
+static cl::opt<bool>
+HoistChecks("asap-hoist-checks",
+        cl::desc("Try to hoist checks out of loops instead of removing them"),
+        cl::init(false));
+
+static cl::opt<bool>
+SampleChecks("asap-sample-checks",
+        cl::desc("Sample checks instead of removing them, as far as the "
+                 "-cost-level budget allows"),
+        cl::init(false));
+
+static cl::opt<unsigned>
+SamplingCounterCost("asap-sampling-counter-cost",
+        cl::desc("Estimated cost of updating the counter of a sampled check"),
+        cl::init(4), cl::Hidden);
+
+static cl::opt<unsigned>
+MaxSamplingPeriod("asap-max-sampling-period",
+        cl::desc("Remove checks that would run less often than once every "
+                 "this many executions"),
+        cl::init(1U << 20), cl::Hidden);
+
+static cl::opt<bool>
+ToggleableChecks("asap-toggleable-checks",
+        cl::desc("Let the program enable and disable checks at runtime; "
+                 "removed checks start disabled"),
+        cl::init(false));
+
+static cl::opt<bool>
+CloneHotFunctions("asap-clone-hot-functions",
+        cl::desc("Keep removed checks in clones of their functions, which "
+                 "cold call sites call instead"),
+        cl::init(false));
+
+static cl::opt<unsigned long long>
+ColdCallCount("asap-cold-call-count",
+        cl::desc("Call sites that ran at most this often are cold"),
+        cl::init(0), cl::Hidden);
+
+static cl::opt<bool>
+RunAtLTO("asap-lto",
+        cl::desc("Run ASAP on the merged module during link-time optimization"),
+        cl::init(false));
+
 static cl::opt<bool>
 PrintRemovedChecks("print-removed-checks",
         cl::desc("Should a list of removed checks be printed?"),
         cl::init(false));
 
+static cl::opt<std::string>
+ReportFile("asap-report",
+        cl::desc("Write a YAML report of all checks and what ASAP did with "
+                 "them to this file"),
+        cl::init(""));
+
+namespace {
+    // A family of checks that is selected within its own budget
+    struct FamilyBudget {
+        std::string Family;
+        double CostLevel;
+    };
+
+    // Parses the budgets given with -asap-kind-budget.
+    std::vector<FamilyBudget> parseFamilyBudgets() {
+        std::vector<FamilyBudget> Budgets;
+        for (const std::string &Arg : KindBudgets) {
+            std::pair<StringRef, StringRef> Parts = StringRef(Arg).split('=');
+            double CostLevel = 1.0;
+            if (Parts.second != "unlimited") {
+                std::string Level = Parts.second;
+                char *End;
+                CostLevel = std::strtod(Level.c_str(), &End);
+                if (End == Level.c_str() || *End) {
+                    CostLevel = -1.0;
+                }
+            }
+            if (Parts.first.empty() || CostLevel < 0.0 || CostLevel > 1.0) {
+                report_fatal_error("Invalid -asap-kind-budget: " + Arg);
+            }
+            Budgets.push_back({Parts.first, CostLevel});
+        }
+        return Budgets;
+    }
+
+    // Returns the index of the first budget whose family a check belongs to,
+    // or Budgets.size() if there is none.
+    size_t findFamily(BranchInst *BI, SanityCheckInstructionsPass *SCI,
+                      const std::vector<FamilyBudget> &Budgets) {
+        unsigned int RegularBranch = getRegularBranch(BI, SCI);
+        BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+        const CallInst *CI = SCI->findSanityCheckCall(Succ);
+        StringRef Kind = CI ? getSanityCheckKind(CI) : "other";
+        StringRef Handler;
+        if (CI && CI->getCalledFunction()) {
+            Handler = CI->getCalledFunction()->getName();
+        }
+
+        for (size_t i = 0, e = Budgets.size(); i != e; ++i) {
+            StringRef Family = Budgets[i].Family;
+            if (Family == Kind || (!Handler.empty() &&
+                                   Handler.startswith(Family))) {
+                return i;
+            }
+        }
+        return Budgets.size();
+    }
+
+    // Returns true if removing a check with the given cost keeps the remaining
+    // cost of its checks at or above the given cost level.
+    bool isWithinCostLevel(double Level, uint64_t TotalCost,
+                           uint64_t RemovedCost, uint64_t Cost) {
+        // Make sure we get the boundary conditions right... it's important
+        // that at cost level 0.0, we don't remove checks that cost zero.
+        return RemovedCost < TotalCost * (1.0 - Level) &&
+            (RemovedCost + Cost) <= TotalCost * (1.0 - Level);
+    }
+}
+
+AsapPass::AsapPass() : ModulePass(ID), SCC(0), SCI(0), Modified(false) {
+    // Needed for -asap-hoist-checks, -asap-clone-hot-functions and
+    // -asap-selection=value
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeDominatorTreeWrapperPassPass(Registry);
+    initializeLoopInfoWrapperPassPass(Registry);
+    initializeScalarEvolutionPass(Registry);
+    initializeTargetLibraryInfoWrapperPassPass(Registry);
+}
 
 bool AsapPass::runOnModule(Module &M) {
     SCC = &getAnalysis<SanityCheckCostPass>();
@@ -49,11 +237,50 @@ bool AsapPass::runOnModule(Module &M) {
         report_fatal_error("Please specify exactly one of -cost-level, "
                            "-sanity-level or -asap-cost-threshold");
     }
+    if (Selection != GreedySelection && CostLevel < 0.0) {
+        report_fatal_error("-asap-selection=optimal and -asap-selection=value "
+                           "require -cost-level");
+    }
+    if (Selection != GreedySelection && SharedCosts) {
+        report_fatal_error("-asap-selection=optimal and -asap-selection=value "
+                           "cannot be combined with -asap-shared-costs");
+    }
+    if (SampleChecks && CostLevel < 0.0) {
+        report_fatal_error("-asap-sample-checks requires -cost-level");
+    }
+    if (SampleChecks && HoistChecks) {
+        report_fatal_error("-asap-sample-checks cannot be combined with "
+                           "-asap-hoist-checks");
+    }
+    if (ToggleableChecks && (HoistChecks || SampleChecks)) {
+        report_fatal_error("-asap-toggleable-checks cannot be combined with "
+                           "-asap-hoist-checks or -asap-sample-checks");
+    }
+    if (CloneHotFunctions && (HoistChecks || SampleChecks ||
+                              ToggleableChecks)) {
+        report_fatal_error("-asap-clone-hot-functions cannot be combined "
+                           "with -asap-hoist-checks, -asap-sample-checks or "
+                           "-asap-toggleable-checks");
+    }
+    std::vector<FamilyBudget> Budgets = parseFamilyBudgets();
+    if (!Budgets.empty() && (SharedCosts || SampleChecks)) {
+        report_fatal_error("-asap-kind-budget cannot be combined with "
+                           "-asap-shared-costs or -asap-sample-checks");
+    }
+
+    Modified = false;
+
+    // The report describes checks as they are before ASAP changes them.
+    Report.reset();
+    if (!ReportFile.empty()) {
+        Report.reset(new sanitychecks::CheckReport(*SCI, *SCC));
+    }
 
     size_t TotalChecks = SCC->getCheckCosts().size();
     if (TotalChecks == 0) {
         dbgs() << "Removed 0 out of 0 static checks (nan%)\n";
         dbgs() << "Removed 0 out of 0 dynamic checks (nan%)\n";
+        writeReport(0, 0);
         return false;
     }
 
@@ -62,45 +289,471 @@ bool AsapPass::runOnModule(Module &M) {
         TotalCost += I.second;
     }
 
-    // Start removing checks. They are given in order of decreasing cost, so we
-    // simply remove the first few.
+    // Checks of families that have their own -asap-kind-budget are selected
+    // within that budget. The other checks share the budget that
+    // -sanity-level, -cost-level or -asap-cost-threshold sets.
+    typedef std::vector<SanityCheckCostPass::CheckCost> CheckCostVector;
+    const CheckCostVector *Checks = &SCC->getCheckCosts();
+    std::vector<CheckCostVector> FamilyChecks(Budgets.size());
+    CheckCostVector OtherChecks;
+    uint64_t OtherCost = TotalCost;
+    if (!Budgets.empty()) {
+        for (const SanityCheckCostPass::CheckCost &I : *Checks) {
+            size_t Family = findFamily(I.first, SCI, Budgets);
+            if (Family == Budgets.size()) {
+                OtherChecks.push_back(I);
+            } else {
+                FamilyChecks[Family].push_back(I);
+                OtherCost -= I.second;
+            }
+        }
+        Checks = &OtherChecks;
+    }
+
+    std::unique_ptr<sanitychecks::CheckValue> CV;
+    if (Selection == ValueSelection) {
+        CV.reset(new sanitychecks::CheckValue(
+            M, *SCI, &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI()));
+    }
+
     uint64_t RemovedCost = 0;
     size_t NChecksRemoved = 0;
-    for (const SanityCheckCostPass::CheckCost &I : SCC->getCheckCosts()) {
-        
-        if (SanityLevel >= 0.0) {
-            if ((NChecksRemoved + 1) > TotalChecks * (1.0 - SanityLevel)) {
+    if (Selection != GreedySelection) {
+        removeChecksOptimally(*Checks, OtherCost * CostLevel, CV.get(),
+                              &RemovedCost, &NChecksRemoved);
+    } else if (SharedCosts) {
+        sanitychecks::MarginalSavings MS(*SCC, *SCI);
+        TotalCost = MS.getTotalCost();
+        removeChecksBySavings(MS, TotalChecks, TotalCost,
+                              &RemovedCost, &NChecksRemoved);
+    } else {
+        // Start removing checks. They are given in order of decreasing cost,
+        // so we simply remove the first few.
+        for (const SanityCheckCostPass::CheckCost &I : *Checks) {
+            if (!canRemove(Checks->size(), OtherCost, NChecksRemoved,
+                           RemovedCost, I.second)) {
                 break;
             }
-        } else if (CostLevel >= 0.0) {
-            // Make sure we get the boundary conditions right... it's important
-            // that at cost level 0.0, we don't remove checks that cost zero.
-            if (RemovedCost >= TotalCost * (1.0 - CostLevel) ||
-                    (RemovedCost + I.second) > TotalCost * (1.0 - CostLevel)) {
-                break;
+
+            if (optimizeCheckAway(I.first)) {
+                RemovedCost += I.second;
+                NChecksRemoved += 1;
             }
-        } else if (CostThreshold != (unsigned long long)(-1)) {
-            if (I.second < CostThreshold) {
-                break;
+        }
+    }
+
+    for (size_t i = 0, e = Budgets.size(); i != e; ++i) {
+        uint64_t FamilyCost = 0;
+        size_t NFamilyChecksRemoved = 0;
+        uint64_t FamilyRemovedCost = removeFamilyChecks(
+            FamilyChecks[i], Budgets[i].CostLevel, CV.get(), &FamilyCost,
+            &NFamilyChecksRemoved);
+        dbgs() << "Removed " << NFamilyChecksRemoved << " out of "
+               << FamilyChecks[i].size() << " " << Budgets[i].Family
+               << " checks, and " << FamilyRemovedCost << " out of "
+               << FamilyCost << " of their cost\n";
+        RemovedCost += FamilyRemovedCost;
+        NChecksRemoved += NFamilyChecksRemoved;
+    }
+
+    if (HoistChecks) {
+        size_t NChecksHoisted = hoistChecks(M);
+        dbgs() << "Hoisted " << NChecksHoisted << " of the removed checks "
+               << "out of loops\n";
+    }
+
+    size_t NChecksSampled = 0;
+    uint64_t SampledCost = 0;
+    if (SampleChecks) {
+        uint64_t SampledChecksCost = 0;
+        NChecksSampled = sampleChecks(TotalCost, RemovedCost,
+                                      &SampledChecksCost, &SampledCost);
+        // Sampled checks still run, so they do not count as removed.
+        NChecksRemoved -= NChecksSampled;
+        RemovedCost -= SampledChecksCost;
+    }
+
+    if (ToggleableChecks) {
+        size_t NChecksToggleable = toggleChecks(M);
+        Modified |= NChecksToggleable != 0;
+        dbgs() << "Made " << NChecksToggleable << " checks toggleable at "
+               << "runtime; removed checks start disabled\n";
+    }
+
+    if (CloneHotFunctions) {
+        size_t NColdCalls = 0;
+        size_t NClones = cloneHotFunctions(M, &NColdCalls);
+        Modified |= NClones != 0;
+        dbgs() << "Kept removed checks in " << NClones << " checked clones, "
+               << "called from " << NColdCalls << " cold call sites\n";
+    }
+
+    printSummary(NChecksRemoved, TotalChecks, RemovedCost, TotalCost,
+                 NChecksSampled, SampledCost);
+    writeReport(TotalCost, RemovedCost);
+    return Modified;
+}
+
+// Returns true if a check with the given cost can be removed without exceeding
+// the limits set by -sanity-level, -cost-level or -asap-cost-threshold.
+bool AsapPass::canRemove(size_t TotalChecks, uint64_t TotalCost,
+                         size_t NChecksRemoved, uint64_t RemovedCost,
+                         uint64_t Cost) const {
+    if (SanityLevel >= 0.0) {
+        if ((NChecksRemoved + 1) > TotalChecks * (1.0 - SanityLevel)) {
+            return false;
+        }
+    } else if (CostLevel >= 0.0 && SampleChecks) {
+        // Sampled checks share the part of the budget that the kept checks
+        // leave, so checks are removed until the kept ones fit the budget.
+        if (RemovedCost >= TotalCost * (1.0 - CostLevel)) {
+            return false;
+        }
+    } else if (CostLevel >= 0.0) {
+        if (!isWithinCostLevel(CostLevel, TotalCost, RemovedCost, Cost)) {
+            return false;
+        }
+    } else if (CostThreshold != (unsigned long long)(-1)) {
+        if (Cost < CostThreshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Removes checks in order of decreasing marginal savings. After each removal,
+// the savings of checks that share instructions with the removed one are
+// updated, and these checks are re-queued.
+void AsapPass::removeChecksBySavings(sanitychecks::MarginalSavings &MS,
+                                     size_t TotalChecks, uint64_t TotalCost,
+                                     uint64_t *RemovedCost,
+                                     size_t *NChecksRemoved) {
+    const std::vector<SanityCheckCostPass::CheckCost> &Checks =
+        SCC->getCheckCosts();
+    DenseMap<BranchInst *, size_t> CheckIndex;
+
+    // Queue entries are pairs of savings and check index. Ties are broken by
+    // the original order of checks, so that the result is deterministic.
+    typedef std::pair<uint64_t, size_t> Entry;
+    auto LowerPriority = [](const Entry &a, const Entry &b) {
+        return a.first < b.first || (a.first == b.first && a.second > b.second);
+    };
+    std::priority_queue<Entry, std::vector<Entry>, decltype(LowerPriority)>
+        Queue(LowerPriority);
+    for (size_t i = 0, e = Checks.size(); i != e; ++i) {
+        CheckIndex[Checks[i].first] = i;
+        Queue.push(std::make_pair(MS.getSavings(Checks[i].first), i));
+    }
+
+    SmallPtrSet<BranchInst *, 16> Done;
+    SmallVector<BranchInst *, 8> Changed;
+    while (!Queue.empty()) {
+        Entry E = Queue.top();
+        Queue.pop();
+        BranchInst *BI = Checks[E.second].first;
+
+        // Skip checks we have already handled, and entries whose savings
+        // have grown since they were queued.
+        if (Done.count(BI) || E.first != MS.getSavings(BI)) {
+            continue;
+        }
+
+        if (!canRemove(TotalChecks, TotalCost, *NChecksRemoved, *RemovedCost,
+                       E.first)) {
+            break;
+        }
+
+        Done.insert(BI);
+        if (optimizeCheckAway(BI)) {
+            *RemovedCost += E.first;
+            *NChecksRemoved += 1;
+
+            Changed.clear();
+            MS.removeCheck(BI, Changed);
+            for (BranchInst *C : Changed) {
+                Queue.push(std::make_pair(MS.getSavings(C), CheckIndex[C]));
+            }
+        }
+    }
+}
+
+// Removes checks such that the remaining ones cost at most the budget, keeping
+// as many checks as possible. This is a 0/1 knapsack problem,
+// where each check weighs its cost and keeping it is worth one unit, or its
+// static value if CV is given. Checks without value are always removed.
+void AsapPass::removeChecksOptimally(
+        const std::vector<SanityCheckCostPass::CheckCost> &Checks,
+        uint64_t Budget, const sanitychecks::CheckValue *CV,
+        uint64_t *RemovedCost, size_t *NChecksRemoved) {
+    std::vector<sanitychecks::KnapsackItem> Items;
+    std::vector<const SanityCheckCostPass::CheckCost *> Candidates;
+    size_t NWorthlessChecks = 0;
+    for (const SanityCheckCostPass::CheckCost &I : Checks) {
+        // Checks without a regular branch cannot be removed; they use up
+        // part of the budget no matter what.
+        if (getRegularBranch(I.first, SCI) == (unsigned)(-1)) {
+            Budget -= std::min(Budget, I.second);
+            continue;
+        }
+        uint64_t Value = CV ? CV->getValue(I.first) : 1;
+        if (Value == 0) {
+            if (optimizeCheckAway(I.first)) {
+                *RemovedCost += I.second;
+                *NChecksRemoved += 1;
+                NWorthlessChecks += 1;
             }
+            continue;
+        }
+        Items.push_back({I.second, Value});
+        Candidates.push_back(&I);
+    }
+
+    std::vector<bool> Keep =
+        sanitychecks::solveKnapsack(Items, Budget, KnapsackTableSize);
+
+    for (size_t i = 0, e = Candidates.size(); i != e; ++i) {
+        if (!Keep[i] && optimizeCheckAway(Candidates[i]->first)) {
+            *RemovedCost += Candidates[i]->second;
+            *NChecksRemoved += 1;
+        }
+    }
+
+    if (CV) {
+        dbgs() << "Removed " << NWorthlessChecks << " checks that cannot "
+               << "fail\n";
+    }
+}
+
+// Families with their own budget always use a cost level, whichever option
+// sets the budget of the other checks.
+uint64_t AsapPass::removeFamilyChecks(
+        const std::vector<SanityCheckCostPass::CheckCost> &Checks,
+        double FamilyCostLevel, const sanitychecks::CheckValue *CV,
+        uint64_t *TotalCost, size_t *NChecksRemoved) {
+    *TotalCost = 0;
+    for (const SanityCheckCostPass::CheckCost &I : Checks) {
+        *TotalCost += I.second;
+    }
+
+    uint64_t RemovedCost = 0;
+    if (Selection != GreedySelection) {
+        removeChecksOptimally(Checks, *TotalCost * FamilyCostLevel, CV,
+                              &RemovedCost, NChecksRemoved);
+        return RemovedCost;
+    }
+
+    for (const SanityCheckCostPass::CheckCost &I : Checks) {
+        if (!isWithinCostLevel(FamilyCostLevel, *TotalCost, RemovedCost,
+                               I.second)) {
+            break;
         }
-        
         if (optimizeCheckAway(I.first)) {
             RemovedCost += I.second;
-            NChecksRemoved += 1;
+            *NChecksRemoved += 1;
         }
     }
-    
+    return RemovedCost;
+}
+
+// Tries to hoist the checks that optimizeCheckAway deferred out of their
+// loops, and removes those that cannot be hoisted. Loop analyses are only
+// computed once for each function. Returns the number of hoisted checks.
+size_t AsapPass::hoistChecks(Module &M) {
+    MapVector<Function *, SmallVector<BranchInst *, 16> > ChecksByFunction;
+    for (BranchInst *BI : ChecksToHoist) {
+        ChecksByFunction[BI->getParent()->getParent()].push_back(BI);
+    }
+
+    size_t NChecksHoisted = 0;
+    for (auto &FunctionChecks : ChecksByFunction) {
+        Function &F = *FunctionChecks.first;
+        LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+        DominatorTree &DT =
+            getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+        ScalarEvolution &SE = getAnalysis<ScalarEvolution>(F);
+
+        sanitychecks::CheckHoisting CH(*SCI, LI, DT, SE, M.getDataLayout());
+        std::vector<bool> Hoisted;
+        for (BranchInst *BI : FunctionChecks.second) {
+            Hoisted.push_back(CH.hoistCheck(BI));
+        }
+        CH.finish();
+
+        for (size_t i = 0, e = Hoisted.size(); i != e; ++i) {
+            BranchInst *BI = FunctionChecks.second[i];
+            disableCheck(BI, getRegularBranch(BI, SCI), Hoisted[i]);
+            NChecksHoisted += Hoisted[i];
+        }
+    }
+
+    ChecksToHoist.clear();
+    return NChecksHoisted;
+}
+
+// Each check gets an equal share of the remaining budget, which determines how
+// often it can run. Cheap checks thus run more often than expensive ones.
+// Checks whose counter alone would exceed their share are removed; their share
+// goes to the checks that follow. Checks are visited by increasing counter
+// cost, so that few of them need to be removed.
+size_t AsapPass::sampleChecks(uint64_t TotalCost, uint64_t RemovedCost,
+                              uint64_t *SampledChecksCost,
+                              uint64_t *SampledCost) {
+    uint64_t Budget = TotalCost * CostLevel;
+    uint64_t KeptCost = TotalCost - RemovedCost;
+    uint64_t RemainingBudget = Budget > KeptCost ? Budget - KeptCost : 0;
+
+    DenseMap<BranchInst *, uint64_t> CheckCosts;
+    for (const SanityCheckCostPass::CheckCost &I : SCC->getCheckCosts()) {
+        CheckCosts[I.first] = I.second;
+    }
+
+    struct Candidate {
+        BranchInst *BI;
+        Instruction *Entry;
+        uint64_t Cost;
+        uint64_t CounterCost;
+    };
+    std::vector<Candidate> Candidates;
+    for (BranchInst *BI : ChecksToSample) {
+        Instruction *Entry = findCheckRegion(BI, SCI);
+        if (!Entry) {
+            disableCheck(BI, getRegularBranch(BI, SCI), false);
+            continue;
+        }
+        // The counter runs as often as the first block of the check.
+        uint64_t Count = 0;
+        for (Instruction *I : SCI->getInstructionsBySanityCheck(BI)) {
+            Count = std::max(Count, SCC->getInstructionCount(I));
+        }
+        Candidates.push_back(
+            {BI, Entry, CheckCosts.lookup(BI), Count * SamplingCounterCost});
+    }
+    std::stable_sort(Candidates.begin(), Candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+                return a.CounterCost < b.CounterCost;
+            });
+
+    size_t NChecksSampled = 0;
+    for (size_t i = 0, e = Candidates.size(); i != e; ++i) {
+        const Candidate &C = Candidates[i];
+        uint64_t Share = RemainingBudget / (e - i);
+        uint64_t Period = 0;
+        uint64_t Cost = 0;
+        if (Share > C.CounterCost) {
+            uint64_t CheckShare = Share - C.CounterCost;
+            Period = std::max<uint64_t>(2,
+                (C.Cost + CheckShare - 1) / CheckShare);
+            Cost = (C.Cost + Period - 1) / Period + C.CounterCost;
+        }
+
+        // Sampling must also be cheaper than keeping the check.
+        unsigned int RegularBranch = getRegularBranch(C.BI, SCI);
+        if (Period == 0 || Period > MaxSamplingPeriod || Cost >= C.Cost) {
+            disableCheck(C.BI, RegularBranch, false);
+            continue;
+        }
+
+        if (PrintRemovedChecks) {
+            printRemovedCheck(C.BI, RegularBranch,
+                              "sampled 1 in " + std::to_string(Period));
+        }
+        sanitychecks::sampleCheck(C.BI, C.Entry, Period, *SCI);
+        Modified = true;
+        reportDecision(C.BI, sanitychecks::CheckSampled, Period);
+        RemainingBudget -= Cost;
+        *SampledChecksCost += C.Cost;
+        *SampledCost += Cost;
+        NChecksSampled += 1;
+    }
+
+    ChecksToSample.clear();
+    return NChecksSampled;
+}
+
+size_t AsapPass::toggleChecks(Module &M) {
+    SmallPtrSet<BranchInst *, 64> ToggledOff(ChecksToToggleOff.begin(),
+                                             ChecksToToggleOff.end());
+    sanitychecks::CheckToggles CT(M, *SCI);
+    size_t NChecksToggleable = 0;
+    for (const SanityCheckCostPass::CheckCost &I : SCC->getCheckCosts()) {
+        BranchInst *BI = I.first;
+        bool Removed = ToggledOff.count(BI);
+        if (CT.addToggle(BI, I.second, !Removed)) {
+            NChecksToggleable += 1;
+            if (Removed) {
+                reportDecision(BI, sanitychecks::CheckDisabledAtRuntime);
+            }
+            if (Removed && PrintRemovedChecks) {
+                printRemovedCheck(BI, getRegularBranch(BI, SCI),
+                                  "disabled at runtime");
+            }
+        } else if (Removed) {
+            disableCheck(BI, getRegularBranch(BI, SCI), false);
+        }
+    }
+    CT.finish();
+
+    ChecksToToggleOff.clear();
+    return NChecksToggleable;
+}
+
+// Clones the functions that lose checks before removing the checks that
+// optimizeCheckAway deferred, and lets cold call sites call the clones.
+size_t AsapPass::cloneHotFunctions(Module &M, size_t *NColdCalls) {
+    sanitychecks::HotColdCloning HCC(M, *SCI, *SCC, ColdCallCount);
+    for (BranchInst *BI : ChecksToClone) {
+        HCC.addFunction(BI->getParent()->getParent());
+    }
+    for (Function &F : M) {
+        if (!F.isDeclaration() && HCC.callsAddedFunction(F)) {
+            DominatorTree &DT =
+                getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+            LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+            HCC.findColdCalls(F, DT, LI);
+        }
+    }
+    size_t NClones = HCC.finish();
+
+    for (BranchInst *BI : ChecksToClone) {
+        disableCheck(BI, getRegularBranch(BI, SCI), false);
+        if (HCC.getClone(BI->getParent()->getParent())) {
+            reportDecision(BI, sanitychecks::CheckKeptInClones);
+        }
+    }
+
+    ChecksToClone.clear();
+    *NColdCalls = HCC.getNumColdCalls();
+    return NClones;
+}
+
+void AsapPass::printSummary(size_t NChecksRemoved, size_t TotalChecks,
+                            uint64_t RemovedCost, uint64_t TotalCost,
+                            size_t NChecksSampled, uint64_t SampledCost) {
     dbgs() << "Removed " << NChecksRemoved << " out of " << TotalChecks
            << " static checks (" << format("%0.2f", (100.0 * NChecksRemoved / TotalChecks)) << "%)\n";
     dbgs() << "Removed " << RemovedCost << " out of " << TotalCost
            << " dynamic checks (" << format("%0.2f", (100.0 * RemovedCost / TotalCost)) << "%)\n";
-    return false;
+    if (SampleChecks) {
+        dbgs() << "Sampled " << NChecksSampled << " out of " << TotalChecks
+               << " static checks ("
+               << format("%0.2f", (100.0 * NChecksSampled / TotalChecks)) << "%), "
+               << "at a predicted cost of " << SampledCost << "\n";
+    }
 }
 
 void AsapPass::getAnalysisUsage(AnalysisUsage& AU) const {
     AU.addRequired<SanityCheckCostPass>();
     AU.addRequired<SanityCheckInstructionsPass>();
+    if (Selection == ValueSelection) {
+        AU.addRequired<TargetLibraryInfoWrapperPass>();
+    }
+    if (HoistChecks || CloneHotFunctions) {
+        AU.addRequired<DominatorTreeWrapperPass>();
+        AU.addRequired<LoopInfoWrapperPass>();
+    }
+    if (HoistChecks) {
+        AU.addRequired<ScalarEvolution>();
+    }
 }
 
 // Tries to remove a sanity check; returns true if it worked.
@@ -110,14 +763,7 @@ bool AsapPass::optimizeCheckAway(llvm::Instruction *Inst) {
     
     unsigned int RegularBranch = getRegularBranch(BI, SCI);
     
-    bool Changed = false;
-    if (RegularBranch == 0) {
-        BI->setCondition(ConstantInt::getTrue(Inst->getContext()));
-        Changed = true;
-    } else if (RegularBranch == 1) {
-        BI->setCondition(ConstantInt::getFalse(Inst->getContext()));
-        Changed = true;
-    } else {
+    if (RegularBranch == (unsigned int)(-1)) {
         // This can happen, e.g., in the following case:
         //     array[-1] = a + b;
         // is transformed into
@@ -131,30 +777,115 @@ bool AsapPass::optimizeCheckAway(llvm::Instruction *Inst) {
         // http://lists.cs.uiuc.edu/pipermail/llvmdev/2014-April/071958.html
         dbgs() << "Warning: Sanity check with no regular branch found.\n";
         dbgs() << "The sanity check has been kept intact.\n";
+        return false;
     }
-    
-    if (PrintRemovedChecks && Changed) {
-        DebugLoc DL = getSanityCheckDebugLoc(BI, RegularBranch);
-        printDebugLoc(DL, BI->getContext(), dbgs());
-        dbgs() << ": SanityCheck with cost ";
-        dbgs() << *BI->getMetadata("cost")->getOperand(0);
 
-        if (MDNode *IA = DL.getInlinedAt()) {
-            dbgs() << " (inlined at ";
-            printDebugLoc(DebugLoc(IA), BI->getContext(), dbgs());
-            dbgs() << ")";
-        }
+    // Checks are hoisted once all of them have been selected, so that loop
+    // analyses are computed only once per function.
+    if (HoistChecks) {
+        ChecksToHoist.push_back(BI);
+        return true;
+    }
 
-        BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
-        if (const CallInst *CI = SCI->findSanityCheckCall(Succ)) {
-            dbgs() << " " << CI->getCalledFunction()->getName();
-        }
-        dbgs() << "\n";
+    // Likewise, how often sampled checks can run depends on the budget that
+    // is left once all checks have been selected.
+    if (SampleChecks) {
+        ChecksToSample.push_back(BI);
+        return true;
+    }
+
+    // Toggleable checks are guarded once all of them are known, because
+    // their enable bytes form a single table.
+    if (ToggleableChecks) {
+        ChecksToToggleOff.push_back(BI);
+        return true;
+    }
+
+    // Functions are cloned before any of their checks are removed, so that
+    // the clones keep all checks.
+    if (CloneHotFunctions) {
+        ChecksToClone.push_back(BI);
+        return true;
     }
 
-    return Changed;
+    disableCheck(BI, RegularBranch, false);
+    return true;
+}
+
+// Makes a sanity check always take its regular branch.
+void AsapPass::disableCheck(BranchInst *BI, unsigned int RegularBranch,
+                            bool Hoisted) {
+    Modified = true;
+    if (RegularBranch == 0) {
+        BI->setCondition(ConstantInt::getTrue(BI->getContext()));
+    } else {
+        BI->setCondition(ConstantInt::getFalse(BI->getContext()));
+    }
+    reportDecision(BI, Hoisted ? sanitychecks::CheckHoisted
+                               : sanitychecks::CheckRemoved);
+
+    if (PrintRemovedChecks) {
+        printRemovedCheck(BI, RegularBranch,
+                          Hoisted ? "hoisted out of loop" : "");
+    }
+}
+
+void AsapPass::reportDecision(BranchInst *BI,
+                              sanitychecks::CheckDecision Decision,
+                              uint64_t SamplingPeriod) {
+    if (Report) {
+        Report->setDecision(BI, Decision, SamplingPeriod);
+    }
+}
+
+void AsapPass::writeReport(uint64_t TotalCost, uint64_t RemovedCost) {
+    if (!Report) {
+        return;
+    }
+    std::error_code EC;
+    raw_fd_ostream OS(ReportFile, EC, sys::fs::F_Text);
+    if (EC) {
+        report_fatal_error("Cannot write " + ReportFile + ": " +
+                           EC.message());
+    }
+    Report->write(OS, TotalCost, RemovedCost);
+    Report.reset();
+}
+
+void AsapPass::printRemovedCheck(BranchInst *BI, unsigned int RegularBranch,
+                                 StringRef Note) {
+    DebugLoc DL = getSanityCheckDebugLoc(BI, RegularBranch);
+    printDebugLoc(DL, BI->getContext(), dbgs());
+    dbgs() << ": SanityCheck with cost ";
+    dbgs() << *BI->getMetadata("cost")->getOperand(0);
+
+    if (MDNode *IA = DL.getInlinedAt()) {
+        dbgs() << " (inlined at ";
+        printDebugLoc(DebugLoc(IA), BI->getContext(), dbgs());
+        dbgs() << ")";
+    }
+
+    BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+    if (const CallInst *CI = SCI->findSanityCheckCall(Succ)) {
+        dbgs() << " " << CI->getCalledFunction()->getName();
+    }
+    if (!Note.empty()) {
+        dbgs() << " (" << Note << ")";
+    }
+    dbgs() << "\n";
 }
 
 char AsapPass::ID = 0;
 static RegisterPass<AsapPass> X("asap",
         "Removes too costly sanity checks", false, false);
+
+ModulePass *llvm::createAsapPass() {
+    return new AsapPass();
+}
+
+void llvm::addAsapLTOPasses(const PassManagerBuilder &Builder,
+                            legacy::PassManagerBase &PM) {
+    if (RunAtLTO) {
+        PM.add(createAsapPass());
+    }
+}
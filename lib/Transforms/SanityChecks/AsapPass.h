@@ -1,13 +1,24 @@
 // This file is part of ASAP.
 // Please see LICENSE.txt for copyright and licensing information.
 
+#include "CheckReport.h"
+
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Pass.h"
 
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
 namespace sanitychecks {
+    class CheckValue;
     class GCOVFile;
+    class MarginalSavings;
 }
 
 namespace llvm {
+    class BranchInst;
     class Instruction;
 }
 
@@ -17,7 +28,7 @@ struct SanityCheckInstructionsPass;
 struct AsapPass : public llvm::ModulePass {
     static char ID;
 
-    AsapPass() : ModulePass(ID), SCC(0), SCI(0) {}
+    AsapPass();
 
     virtual bool runOnModule(llvm::Module &M);
 
@@ -27,7 +38,98 @@ private:
 
     SanityCheckCostPass *SCC;
     SanityCheckInstructionsPass *SCI;
-    
+
+    // The report requested with -asap-report, if any
+    std::unique_ptr<sanitychecks::CheckReport> Report;
+
+    // Checks that will be hoisted out of loops if possible, or removed
+    std::vector<llvm::BranchInst *> ChecksToHoist;
+
+    // Checks that will be sampled if the budget allows, or removed
+    std::vector<llvm::BranchInst *> ChecksToSample;
+
+    // Checks that will be disabled at runtime if possible, or removed
+    std::vector<llvm::BranchInst *> ChecksToToggleOff;
+
+    // Checks that will be removed once their functions have been cloned
+    std::vector<llvm::BranchInst *> ChecksToClone;
+
+    // Whether the module has been changed, i.e., whether any check has been
+    // removed, hoisted, sampled, made toggleable or cloned
+    bool Modified;
+
     // Tries to remove a sanity check; returns true if it worked.
     bool optimizeCheckAway(llvm::Instruction *Inst);
+
+    // Makes a check always take its regular branch, and reports it if
+    // -print-removed-checks is given.
+    void disableCheck(llvm::BranchInst *BI, unsigned int RegularBranch,
+                      bool Hoisted);
+
+    // Records the decision for a check in the report, if there is one.
+    void reportDecision(llvm::BranchInst *BI,
+                        sanitychecks::CheckDecision Decision,
+                        uint64_t SamplingPeriod = 0);
+
+    // Writes the report to the file given with -asap-report, if any.
+    void writeReport(uint64_t TotalCost, uint64_t RemovedCost);
+
+    // Prints a removed check, followed by the given note if it is not empty.
+    void printRemovedCheck(llvm::BranchInst *BI, unsigned int RegularBranch,
+                           llvm::StringRef Note);
+
+    // Hoists or removes the checks in ChecksToHoist; returns the number of
+    // hoisted checks.
+    size_t hoistChecks(llvm::Module &M);
+
+    // Samples the checks in ChecksToSample within the part of the
+    // -cost-level budget that the remaining checks leave, and removes those
+    // that cannot be sampled. Returns the number of sampled checks, and adds
+    // their cost without sampling to SampledChecksCost and their predicted
+    // cost with sampling to SampledCost.
+    size_t sampleChecks(uint64_t TotalCost, uint64_t RemovedCost,
+                        uint64_t *SampledChecksCost, uint64_t *SampledCost);
+
+    // Makes all checks that have a region toggleable at runtime; those in
+    // ChecksToToggleOff start disabled. Checks in ChecksToToggleOff that have
+    // no region are removed. Returns the number of toggleable checks.
+    size_t toggleChecks(llvm::Module &M);
+
+    // Removes the checks in ChecksToClone, but keeps them in clones of
+    // their functions that cold call sites use instead. Returns the number
+    // of clones, and the number of cold call sites in NColdCalls.
+    size_t cloneHotFunctions(llvm::Module &M, size_t *NColdCalls);
+
+    // Returns true if the budget allows removing a check with the given cost.
+    bool canRemove(size_t TotalChecks, uint64_t TotalCost,
+                   size_t NChecksRemoved, uint64_t RemovedCost,
+                   uint64_t Cost) const;
+
+    // Removes checks greedily by their marginal savings.
+    void removeChecksBySavings(sanitychecks::MarginalSavings &MS,
+                               size_t TotalChecks, uint64_t TotalCost,
+                               uint64_t *RemovedCost, size_t *NChecksRemoved);
+
+    // Removes checks from the given ones, which are sorted by decreasing
+    // cost, by solving a knapsack problem over the given budget. Checks are
+    // worth their static value according to CV, or all the same if CV is
+    // null.
+    void removeChecksOptimally(
+        const std::vector<std::pair<llvm::BranchInst *, uint64_t> > &Checks,
+        uint64_t Budget, const sanitychecks::CheckValue *CV,
+        uint64_t *RemovedCost, size_t *NChecksRemoved);
+
+    // Removes checks of a family that -asap-kind-budget gives its own cost
+    // level, using the selection given by -asap-selection. Stores the cost of
+    // all checks of the family in TotalCost, and returns the removed cost.
+    uint64_t removeFamilyChecks(
+        const std::vector<std::pair<llvm::BranchInst *, uint64_t> > &Checks,
+        double FamilyCostLevel, const sanitychecks::CheckValue *CV,
+        uint64_t *TotalCost, size_t *NChecksRemoved);
+
+    // Prints how many checks were removed and, with -asap-sample-checks,
+    // how many were sampled instead.
+    void printSummary(size_t NChecksRemoved, size_t TotalChecks,
+                      uint64_t RemovedCost, uint64_t TotalCost,
+                      size_t NChecksSampled, uint64_t SampledCost);
 };
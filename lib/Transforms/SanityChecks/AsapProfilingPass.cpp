@@ -0,0 +1,142 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/SanityChecks.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include <vector>
+#define DEBUG_TYPE "asap-profiling"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+ProfileFile("asap-profile-file",
+        cl::desc("Where instrumented programs write their check profile"),
+        cl::init("asap.profile"));
+
+namespace {
+
+    // Instruments every sanity check with a counter of its own. Each counter
+    // is identified by the check's stable ID (see getSanityCheckIds), so that
+    // the resulting profile can be matched to the checks even if the layout
+    // of basic blocks differs. The counters are registered with the ASAP
+    // profiling runtime, which writes them to an indexed check profile when
+    // the program exits.
+    struct AsapProfilingPass : public ModulePass {
+        static char ID;
+
+        AsapProfilingPass() : ModulePass(ID) {}
+
+        virtual bool runOnModule(Module &M) {
+            SanityCheckInstructionsPass &SCI =
+                getAnalysis<SanityCheckInstructionsPass>();
+            LLVMContext &Ctx = M.getContext();
+            Type *Int64Ty = Type::getInt64Ty(Ctx);
+
+            // Assign a counter index to every check, in instruction order.
+            std::vector<BranchInst *> Checks;
+            std::vector<Constant *> Ids;
+            for (Function &F : M) {
+                if (F.isDeclaration()) {
+                    continue;
+                }
+                DenseMap<BranchInst *, uint64_t> CheckIds;
+                getSanityCheckIds(&F, &SCI, CheckIds);
+                for (Instruction &I : inst_range(F)) {
+                    BranchInst *BI = dyn_cast<BranchInst>(&I);
+                    if (BI && CheckIds.count(BI)) {
+                        Checks.push_back(BI);
+                        Ids.push_back(ConstantInt::get(Int64Ty, CheckIds[BI]));
+                    }
+                }
+            }
+
+            DEBUG(dbgs() << "Instrumenting " << Checks.size()
+                         << " sanity checks\n");
+            if (Checks.empty()) {
+                return false;
+            }
+
+            ArrayType *TableTy = ArrayType::get(Int64Ty, Checks.size());
+            GlobalVariable *IdTable = new GlobalVariable(M, TableTy, true,
+                GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, Ids),
+                "__asap_check_ids");
+            GlobalVariable *Counters = new GlobalVariable(M, TableTy, false,
+                GlobalValue::PrivateLinkage, ConstantAggregateZero::get(TableTy),
+                "__asap_check_counters");
+
+            // Increment the counter right before the check's branch.
+            IRBuilder<> Builder(Ctx);
+            for (size_t i = 0, e = Checks.size(); i != e; ++i) {
+                Builder.SetInsertPoint(Checks[i]);
+                Value *Counter =
+                    Builder.CreateConstInBoundsGEP2_64(Counters, 0, i);
+                Value *Count = Builder.CreateLoad(Counter);
+                Builder.CreateStore(
+                    Builder.CreateAdd(Count, ConstantInt::get(Int64Ty, 1)),
+                    Counter);
+            }
+
+            insertRegistration(M, IdTable, Counters, Checks.size());
+            return true;
+        }
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+            AU.addRequired<SanityCheckInstructionsPass>();
+        }
+
+    private:
+
+        // Creates a constructor that registers this module's counters with
+        // the runtime:
+        //   void __asap_register_checks(const uint64_t *Ids,
+        //       uint64_t *Counters, uint64_t NumChecks, const char *File);
+        void insertRegistration(Module &M, GlobalVariable *IdTable,
+                                GlobalVariable *Counters, size_t NumChecks) {
+            LLVMContext &Ctx = M.getContext();
+            Type *Int64Ty = Type::getInt64Ty(Ctx);
+            Type *Int64PtrTy = Type::getInt64PtrTy(Ctx);
+
+            Constant *RegisterFn = M.getOrInsertFunction(
+                "__asap_register_checks", Type::getVoidTy(Ctx),
+                Int64PtrTy, Int64PtrTy, Int64Ty, Type::getInt8PtrTy(Ctx),
+                nullptr);
+
+            Function *Ctor = Function::Create(
+                FunctionType::get(Type::getVoidTy(Ctx), false),
+                GlobalValue::InternalLinkage, "asap.register_checks", &M);
+            IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Ctor));
+            Builder.CreateCall(RegisterFn, {
+                Builder.CreateConstInBoundsGEP2_64(IdTable, 0, 0),
+                Builder.CreateConstInBoundsGEP2_64(Counters, 0, 0),
+                ConstantInt::get(Int64Ty, NumChecks),
+                Builder.CreateGlobalStringPtr(ProfileFile)});
+            Builder.CreateRetVoid();
+
+            appendToGlobalCtors(M, Ctor, 0);
+        }
+    };
+}
+
+char AsapProfilingPass::ID = 0;
+static RegisterPass<AsapProfilingPass> X("asap-profiling",
+        "Counts how often each sanity check is executed", false, false);
+
+ModulePass *llvm::createAsapProfilingPass() {
+    return new AsapProfilingPass();
+}
@@ -0,0 +1,283 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckElimination.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+using namespace llvm;
+
+// How deep to look into conditions that combine several comparisons
+static const unsigned MaxConditionDepth = 4;
+
+namespace sanitychecks {
+
+CheckElimination::CheckElimination(SanityCheckInstructionsPass &SCI,
+                                   const DataLayout &DL,
+                                   const TargetLibraryInfo *TLI,
+                                   ScalarEvolution &SE, LazyValueInfo &LVI,
+                                   const GlobalSet &DynInitGlobals)
+    : SCI(SCI), DL(DL), TLI(TLI), SE(SE), LVI(LVI),
+      DynInitGlobals(DynInitGlobals) {}
+
+bool CheckElimination::isSafe(BranchInst *BI) {
+    unsigned int RegularBranch = getRegularBranch(BI, &SCI);
+    if (RegularBranch == (unsigned int)(-1)) {
+        return false;
+    }
+
+    // ASan's condition compares shadow memory, which tells nothing
+    // statically. The accessed address, however, may be provably in bounds.
+    BasicBlock *Fail = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+    if (const CallInst *Report = SCI.findSanityCheckCall(Fail)) {
+        uint64_t Size;
+        bool IsWrite;
+        if (Value *Addr = getAsanReportedAccess(Report, &Size, &IsWrite)) {
+            return Size != 0 && (isAccessInBounds(Addr, Size, DL, TLI,
+                                                  DynInitGlobals) ||
+                                 isAccessInRange(Addr, Size));
+        }
+    }
+
+    bool Taken;
+    if (!getConditionValue(BI->getCondition(), BI, &Taken, 0)) {
+        return false;
+    }
+    return BI->getSuccessor(Taken ? 0 : 1) ==
+        BI->getSuccessor(RegularBranch);
+}
+
+bool CheckElimination::isAccessInRange(Value *Addr, uint64_t Size) {
+    Value *Object = GetUnderlyingObject(Addr, DL);
+    if (!isSafeObject(Object, DynInitGlobals)) {
+        return false;
+    }
+    uint64_t ObjectSize;
+    if (!getObjectSize(Object, ObjectSize, DL, TLI) || ObjectSize < Size) {
+        return false;
+    }
+    if (!SE.isSCEVable(Addr->getType())) {
+        return false;
+    }
+
+    const SCEV *Offset = SE.getMinusSCEV(SE.getSCEV(Addr),
+                                         SE.getSCEV(Object));
+    ConstantRange Range = SE.getSignedRange(Offset);
+    if (Range.isEmptySet()) {
+        return false;
+    }
+    APInt Limit(Range.getBitWidth(), ObjectSize - Size);
+    return !Range.getSignedMin().isNegative() &&
+        Range.getSignedMax().sle(Limit);
+}
+
+bool CheckElimination::getConditionValue(Value *Cond, Instruction *CxtI,
+                                         bool *Result, unsigned Depth) {
+    if (Depth > MaxConditionDepth) {
+        return false;
+    }
+
+    if (ConstantInt *C = dyn_cast<ConstantInt>(Cond)) {
+        *Result = !C->isZero();
+        return true;
+    }
+
+    // Clang negates overflow flags, and combines conditions with and/or.
+    if (BinaryOperator::isNot(Cond)) {
+        if (!getConditionValue(BinaryOperator::getNotArgument(Cond), CxtI,
+                               Result, Depth + 1)) {
+            return false;
+        }
+        *Result = !*Result;
+        return true;
+    }
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(Cond)) {
+        if (BO->getOpcode() != Instruction::And &&
+                BO->getOpcode() != Instruction::Or) {
+            return false;
+        }
+        // The value that decides the result on its own
+        bool Decisive = BO->getOpcode() == Instruction::Or;
+        bool LHS, RHS;
+        bool KnowLHS = getConditionValue(BO->getOperand(0), CxtI, &LHS,
+                                         Depth + 1);
+        bool KnowRHS = getConditionValue(BO->getOperand(1), CxtI, &RHS,
+                                         Depth + 1);
+        if ((KnowLHS && LHS == Decisive) || (KnowRHS && RHS == Decisive)) {
+            *Result = Decisive;
+            return true;
+        }
+        if (KnowLHS && KnowRHS) {
+            *Result = !Decisive;
+            return true;
+        }
+        return false;
+    }
+
+    // The overflow flag of a *.with.overflow intrinsic
+    if (ExtractValueInst *EV = dyn_cast<ExtractValueInst>(Cond)) {
+        IntrinsicInst *II = dyn_cast<IntrinsicInst>(EV->getAggregateOperand());
+        if (II && EV->getNumIndices() == 1 && *EV->idx_begin() == 1 &&
+                cannotOverflow(II, CxtI)) {
+            *Result = false;
+            return true;
+        }
+        return false;
+    }
+
+    if (ICmpInst *Cmp = dyn_cast<ICmpInst>(Cond)) {
+        Value *LHS = Cmp->getOperand(0);
+        Value *RHS = Cmp->getOperand(1);
+        if (SE.isSCEVable(LHS->getType())) {
+            const SCEV *L = SE.getSCEV(LHS);
+            const SCEV *R = SE.getSCEV(RHS);
+            if (SE.isKnownPredicate(Cmp->getPredicate(), L, R)) {
+                *Result = true;
+                return true;
+            }
+            if (SE.isKnownPredicate(Cmp->getInversePredicate(), L, R)) {
+                *Result = false;
+                return true;
+            }
+        }
+        if (Constant *C = dyn_cast<Constant>(RHS)) {
+            LazyValueInfo::Tristate Known =
+                LVI.getPredicateAt(Cmp->getPredicate(), LHS, C, CxtI);
+            if (Known != LazyValueInfo::Unknown) {
+                *Result = Known == LazyValueInfo::True;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CheckElimination::cannotOverflow(IntrinsicInst *II, Instruction *CxtI) {
+    switch (II->getIntrinsicID()) {
+    case Intrinsic::sadd_with_overflow:
+    case Intrinsic::ssub_with_overflow:
+    case Intrinsic::smul_with_overflow:
+    case Intrinsic::uadd_with_overflow:
+    case Intrinsic::usub_with_overflow:
+    case Intrinsic::umul_with_overflow:
+        break;
+    default:
+        return false;
+    }
+    unsigned IID = II->getIntrinsicID();
+    Value *LHS = II->getArgOperand(0);
+    Value *RHS = II->getArgOperand(1);
+    return isWithinSafeRange(IID, LHS, RHS, false, CxtI) ||
+        isWithinSafeRange(IID, RHS, LHS, true, CxtI);
+}
+
+// Computes the range of V for which the operation cannot overflow, whatever
+// value in its ScalarEvolution range Other has. The computation is done at
+// twice the bit width, so that the bounds themselves cannot overflow.
+bool CheckElimination::isWithinSafeRange(unsigned IID, Value *V, Value *Other,
+                                         bool IsRHS, Instruction *CxtI) {
+    bool Signed = IID == Intrinsic::sadd_with_overflow ||
+        IID == Intrinsic::ssub_with_overflow ||
+        IID == Intrinsic::smul_with_overflow;
+    unsigned Width = V->getType()->getIntegerBitWidth();
+    auto Extend = [&](const APInt &A) {
+        return Signed ? A.sext(2 * Width) : A.zext(2 * Width);
+    };
+
+    const SCEV *OtherSCEV = SE.getSCEV(Other);
+    ConstantRange OtherRange = Signed ? SE.getSignedRange(OtherSCEV)
+                                      : SE.getUnsignedRange(OtherSCEV);
+    if (OtherRange.isEmptySet()) {
+        return false;
+    }
+    APInt OtherMin = Extend(Signed ? OtherRange.getSignedMin()
+                                   : OtherRange.getUnsignedMin());
+    APInt OtherMax = Extend(Signed ? OtherRange.getSignedMax()
+                                   : OtherRange.getUnsignedMax());
+    APInt Min = Extend(Signed ? APInt::getSignedMinValue(Width)
+                              : APInt::getMinValue(Width));
+    APInt Max = Extend(Signed ? APInt::getSignedMaxValue(Width)
+                              : APInt::getMaxValue(Width));
+
+    APInt Lo, Hi;
+    switch (IID) {
+    case Intrinsic::sadd_with_overflow:
+    case Intrinsic::uadd_with_overflow:
+        Lo = Min - OtherMin;
+        Hi = Max - OtherMax;
+        break;
+    case Intrinsic::ssub_with_overflow:
+    case Intrinsic::usub_with_overflow:
+        if (IsRHS) {
+            Lo = OtherMax - Max;
+            Hi = OtherMin - Min;
+        } else {
+            Lo = Min + OtherMax;
+            Hi = Max + OtherMin;
+        }
+        break;
+    default:
+        // Only multiplications by a positive constant are handled; the
+        // divisions round towards zero, which is the safe direction here.
+        if (OtherMin != OtherMax || OtherMin.isNegative()) {
+            return false;
+        }
+        if (OtherMin == 0) {
+            return true;
+        }
+        Lo = Signed ? Min.sdiv(OtherMin) : Min;
+        Hi = Signed ? Max.sdiv(OtherMin) : Max.udiv(OtherMin);
+        break;
+    }
+
+    // All bounds fit into the signed range at twice the width.
+    if (Lo.slt(Min)) {
+        Lo = Min;
+    }
+    if (Hi.sgt(Max)) {
+        Hi = Max;
+    }
+    if (Lo.sgt(Hi)) {
+        return false;
+    }
+    return isWithin(V, Lo.trunc(Width), Hi.trunc(Width), Signed, CxtI);
+}
+
+bool CheckElimination::isWithin(Value *V, const APInt &Min, const APInt &Max,
+                                bool Signed, Instruction *CxtI) {
+    const SCEV *S = SE.getSCEV(V);
+    ConstantRange Range = Signed ? SE.getSignedRange(S)
+                                 : SE.getUnsignedRange(S);
+    APInt RangeMin = Signed ? Range.getSignedMin() : Range.getUnsignedMin();
+    APInt RangeMax = Signed ? Range.getSignedMax() : Range.getUnsignedMax();
+
+    // Each bound holds if ScalarEvolution knows it, or if LazyValueInfo
+    // knows it from the conditions that lead to CxtI.
+    Type *Ty = V->getType();
+    bool AboveMin = Signed ? RangeMin.sge(Min) : RangeMin.uge(Min);
+    if (!AboveMin) {
+        CmpInst::Predicate Pred = Signed ? CmpInst::ICMP_SGE
+                                         : CmpInst::ICMP_UGE;
+        AboveMin = LVI.getPredicateAt(Pred, V, ConstantInt::get(Ty, Min),
+                                      CxtI) == LazyValueInfo::True;
+    }
+    bool BelowMax = Signed ? RangeMax.sle(Max) : RangeMax.ule(Max);
+    if (!BelowMax) {
+        CmpInst::Predicate Pred = Signed ? CmpInst::ICMP_SLE
+                                         : CmpInst::ICMP_ULE;
+        BelowMax = LVI.getPredicateAt(Pred, V, ConstantInt::get(Ty, Max),
+                                      CxtI) == LazyValueInfo::True;
+    }
+    return AboveMin && BelowMax;
+}
+
+}  // namespace sanitychecks
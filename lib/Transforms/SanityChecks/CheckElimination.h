@@ -0,0 +1,89 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKELIMINATION_H
+#define SANITYCHECKS_CHECKELIMINATION_H
+
+#include "utils.h"
+
+#include <cstdint>
+
+namespace llvm {
+    class APInt;
+    class BranchInst;
+    class DataLayout;
+    class Instruction;
+    class IntrinsicInst;
+    class LazyValueInfo;
+    class ScalarEvolution;
+    class TargetLibraryInfo;
+    class Value;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Proves that sanity checks can never fail, so that they can be removed
+    // before their costs are computed. The following checks are recognized:
+    //
+    // - ASan checks of accesses that lie within a local or global variable
+    //   (see isSafeObject), either at a known offset (e.g., constant indices
+    //   into a local array), or within a range that ScalarEvolution computes
+    //   (e.g., loops with a bounded trip count over a fixed-size array).
+    //   Heap accesses keep their checks, since the object may be freed.
+    // - Overflow checks whose operands are limited to a safe range, by
+    //   ScalarEvolution or by conditions that LazyValueInfo knows about.
+    // - Other checks whose condition is a comparison with a known result,
+    //   such as bounds checks of induction variables.
+    //
+    // The checks of one function must be queried before any of them is
+    // removed.
+    class CheckElimination {
+    public:
+        CheckElimination(SanityCheckInstructionsPass &SCI,
+                         const llvm::DataLayout &DL,
+                         const llvm::TargetLibraryInfo *TLI,
+                         llvm::ScalarEvolution &SE, llvm::LazyValueInfo &LVI,
+                         const GlobalSet &DynInitGlobals);
+
+        // Returns true if the given check can never fail.
+        bool isSafe(llvm::BranchInst *BI);
+
+    private:
+        SanityCheckInstructionsPass &SCI;
+        const llvm::DataLayout &DL;
+        const llvm::TargetLibraryInfo *TLI;
+        llvm::ScalarEvolution &SE;
+        llvm::LazyValueInfo &LVI;
+        const GlobalSet &DynInitGlobals;
+
+        // Returns true if Addr lies at least Size bytes before the end of
+        // its object for all offsets that ScalarEvolution deems possible,
+        // and the object is safe (see isSafeObject).
+        bool isAccessInRange(llvm::Value *Addr, uint64_t Size);
+
+        // Tries to determine the value of a branch condition at CxtI.
+        // Returns false if it is unknown.
+        bool getConditionValue(llvm::Value *Cond, llvm::Instruction *CxtI,
+                               bool *Result, unsigned Depth);
+
+        // Returns true if the given *.with.overflow intrinsic cannot
+        // overflow at CxtI.
+        bool cannotOverflow(llvm::IntrinsicInst *II, llvm::Instruction *CxtI);
+
+        // Returns true if one operand of an overflow intrinsic stays within
+        // the range in which it cannot overflow, given the range of Other.
+        bool isWithinSafeRange(unsigned IID, llvm::Value *V,
+                               llvm::Value *Other, bool IsRHS,
+                               llvm::Instruction *CxtI);
+
+        // Returns true if Min <= V <= Max at CxtI.
+        bool isWithin(llvm::Value *V, const llvm::APInt &Min,
+                      const llvm::APInt &Max, bool Signed,
+                      llvm::Instruction *CxtI);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKELIMINATION_H */
@@ -0,0 +1,556 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckHoisting.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#define DEBUG_TYPE "asap-hoisting"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+CheckHoisting::CheckHoisting(SanityCheckInstructionsPass &SCI, LoopInfo &LI,
+                             DominatorTree &DT, ScalarEvolution &SE,
+                             const DataLayout &DL)
+    : SCI(SCI), LI(LI), DT(DT), SE(SE), Expander(SE, DL, "asap.hoist"),
+      CurrentLoop(0) {}
+
+bool CheckHoisting::hoistCheck(BranchInst *BI) {
+    unsigned int RegularBranch = getRegularBranch(BI, &SCI);
+    if (RegularBranch == (unsigned)(-1)) {
+        return false;
+    }
+
+    Loop *L = LI.getLoopFor(BI->getParent());
+    if (!L || !canHoistFrom(L)) {
+        return false;
+    }
+
+    if (L != CurrentLoop) {
+        CurrentLoop = L;
+        EndpointValues[First].clear();
+        EndpointValues[Last].clear();
+    }
+
+    // The check must run in every iteration, including the last one. ASan
+    // uses a second check for small accesses, which only runs if the first
+    // one fails; what matters is that the access itself always runs.
+    BasicBlock *FailBlock = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+    const CallInst *CI = SCI.findSanityCheckCall(FailBlock);
+    if (CI &&
+            CI->getCalledFunction()->getName().startswith("__asan_report_")) {
+        if (!DT.dominates(BI->getSuccessor(RegularBranch),
+                          L->getLoopLatch())) {
+            return false;
+        }
+        return hoistAsanCheck(BI, L, FailBlock);
+    }
+    if (!DT.dominates(BI->getParent(), L->getLoopLatch())) {
+        return false;
+    }
+    return hoistGenericCheck(BI, L, FailBlock, RegularBranch == 1);
+}
+
+void CheckHoisting::finish() {
+    for (auto &LoopRegions : Regions) {
+        for (const Region &R : LoopRegions.second) {
+            emitRegionCheck(LoopRegions.first, R);
+        }
+    }
+    Regions.clear();
+}
+
+// Returns true if all iterations of L run to completion, unless a sanity
+// check fails, and if the number of iterations is known.
+bool CheckHoisting::canHoistFrom(Loop *L) {
+    auto Cached = HoistableLoops.find(L);
+    if (Cached != HoistableLoops.end()) {
+        return Cached->second;
+    }
+    bool &Result = HoistableLoops[L];
+    Result = false;
+
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!L->empty() || !L->getLoopPreheader() || !Latch) {
+        return false;
+    }
+
+    const auto &CheckBlocks =
+        SCI.getSanityCheckBlocks(L->getHeader()->getParent());
+    const auto &Checks =
+        SCI.getSanityCheckBranches(L->getHeader()->getParent());
+    if (Checks.count(Latch->getTerminator())) {
+        return false;
+    }
+
+    bool LatchExits = false;
+    SmallVector<BasicBlock *, 8> ExitingBlocks;
+    L->getExitingBlocks(ExitingBlocks);
+    for (BasicBlock *BB : ExitingBlocks) {
+        TerminatorInst *TI = BB->getTerminator();
+        for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i) {
+            BasicBlock *Succ = TI->getSuccessor(i);
+            if (L->contains(Succ) || CheckBlocks.count(Succ)) {
+                continue;
+            }
+            if (BB != Latch) {
+                DEBUG(dbgs() << "asap: loop " << L->getHeader()->getName()
+                             << " has more than one exit\n");
+                return false;
+            }
+            LatchExits = true;
+        }
+    }
+    if (!LatchExits) {
+        return false;
+    }
+
+    // Calls might not return, or change ASan's shadow memory.
+    for (BasicBlock *BB : L->getBlocks()) {
+        for (Instruction &I : *BB) {
+            if ((isa<CallInst>(I) || isa<InvokeInst>(I)) &&
+                    !isa<IntrinsicInst>(I)) {
+                DEBUG(dbgs() << "asap: loop " << L->getHeader()->getName()
+                             << " contains calls\n");
+                return false;
+            }
+        }
+    }
+
+    const SCEV *ExitCount = SE.getExitCount(L, Latch);
+    if (isa<SCEVCouldNotCompute>(ExitCount) ||
+            !isSafeToExpand(ExitCount, SE)) {
+        DEBUG(dbgs() << "asap: unknown trip count for loop "
+                     << L->getHeader()->getName() << "\n");
+        return false;
+    }
+
+    Result = true;
+    return true;
+}
+
+// ASan checks are hoisted by checking the entire memory region that the
+// check accesses in the loop. They are not emitted right away, so that
+// neighboring regions can be coalesced.
+bool CheckHoisting::hoistAsanCheck(BranchInst *BI, Loop *L,
+                                   BasicBlock *FailBlock) {
+    const CallInst *CI = SCI.findSanityCheckCall(FailBlock);
+    StringRef Name = CI->getCalledFunction()->getName()
+                         .drop_front(strlen("__asan_report_"));
+
+    Region R;
+    if (Name.startswith("load")) {
+        R.IsWrite = false;
+    } else if (Name.startswith("store")) {
+        R.IsWrite = true;
+    } else {
+        return false;
+    }
+    Name = Name.drop_front(R.IsWrite ? 5 : 4);
+
+    // Accesses of unusual size are checked byte by byte; the size argument
+    // is just used for the report.
+    if (Name == "_n") {
+        R.Size = 1;
+    } else if (Name.getAsInteger(10, R.Size)) {
+        return false;
+    }
+
+    const PtrToIntOperator *Addr =
+        dyn_cast<PtrToIntOperator>(CI->getArgOperand(0));
+    if (!Addr) {
+        return false;
+    }
+    const SCEV *S =
+        SE.getSCEV(const_cast<Value *>(Addr->getPointerOperand()));
+    if (SE.isLoopInvariant(S, L)) {
+        R.Start = S;
+        R.Step = 0;
+    } else {
+        const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+        if (!AR || AR->getLoop() != L || !AR->isAffine()) {
+            return false;
+        }
+        const SCEVConstant *Step =
+            dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+        if (!Step) {
+            return false;
+        }
+        R.Start = AR->getStart();
+        R.Step = Step->getValue()->getSExtValue();
+
+        // The region must not contain bytes that the loop skips.
+        if ((uint64_t)std::abs(R.Step) > R.Size) {
+            return false;
+        }
+    }
+    if (!isSafeToExpand(R.Start, SE)) {
+        return false;
+    }
+    R.DL = CI->getDebugLoc();
+
+    // Coalesce with a region whose accesses in each iteration overlap or
+    // touch those of this check.
+    for (Region &Other : Regions[L]) {
+        if (Other.Step != R.Step) {
+            continue;
+        }
+        const SCEVConstant *Distance =
+            dyn_cast<SCEVConstant>(SE.getMinusSCEV(R.Start, Other.Start));
+        if (!Distance) {
+            continue;
+        }
+        int64_t Delta = Distance->getValue()->getSExtValue();
+        if (Delta > (int64_t)Other.Size || -Delta > (int64_t)R.Size) {
+            continue;
+        }
+        if (Delta < 0) {
+            Other.Start = R.Start;
+            Other.Size = std::max(Other.Size - Delta, R.Size);
+        } else {
+            Other.Size = std::max(Other.Size, Delta + R.Size);
+        }
+        Other.IsWrite |= R.IsWrite;
+        DEBUG(dbgs() << "asap: coalesced check " << *BI << "\n");
+        return true;
+    }
+
+    Regions[L].push_back(R);
+    return true;
+}
+
+void CheckHoisting::emitRegionCheck(Loop *L, const Region &R) {
+    Module *M = L->getHeader()->getModule();
+    LLVMContext &Ctx = M->getContext();
+    Type *IntptrTy = M->getDataLayout().getIntPtrType(Ctx);
+
+    // The region starts at the first or last access, depending on the
+    // direction of the loop.
+    const SCEV *N = SE.getTruncateOrZeroExtend(
+        SE.getExitCount(L, L->getLoopLatch()), IntptrTy);
+    const SCEV *Begin = R.Start;
+    if (R.Step < 0) {
+        Begin = SE.getAddExpr(Begin,
+            SE.getMulExpr(SE.getConstant(IntptrTy, R.Step, true), N));
+    }
+    const SCEV *Size = SE.getAddExpr(
+        SE.getMulExpr(SE.getConstant(IntptrTy, std::abs(R.Step)), N),
+        SE.getConstant(IntptrTy, R.Size));
+
+    Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+    Value *BeginValue = Expander.expandCodeFor(Begin, IntptrTy, InsertPt);
+    Value *SizeValue = Expander.expandCodeFor(Size, IntptrTy, InsertPt);
+
+    // uptr __asan_region_is_poisoned(uptr beg, uptr size) returns the first
+    // poisoned address in the region, or zero.
+    Constant *IsPoisoned = M->getOrInsertFunction("__asan_region_is_poisoned",
+        IntptrTy, IntptrTy, IntptrTy, nullptr);
+    IRBuilder<> Builder(InsertPt);
+    CallInst *Poisoned = Builder.CreateCall(IsPoisoned,
+                                            {BeginValue, SizeValue});
+    Poisoned->setDebugLoc(R.DL);
+    BasicBlock *FailBB = insertGuard(L, Builder.CreateIsNotNull(Poisoned));
+
+    Constant *Report = M->getOrInsertFunction(
+        R.IsWrite ? "__asan_report_store_n" : "__asan_report_load_n",
+        Type::getVoidTy(Ctx), IntptrTy, IntptrTy, nullptr);
+    CallInst *Call = CallInst::Create(Report,
+        {Poisoned, ConstantInt::get(IntptrTy, R.Size)}, "",
+        FailBB->getTerminator());
+    Call->setDebugLoc(R.DL);
+}
+
+// Other checks are hoisted by evaluating their condition for the first and
+// the last iteration. This is correct for conditions on a value that is
+// linear in the iteration number, where the failing iterations are at either
+// end of the iteration space. That is the case for ordered comparisons and
+// arithmetic overflow, provided the operands do not wrap.
+bool CheckHoisting::hoistGenericCheck(BranchInst *BI, Loop *L,
+                                      BasicBlock *FailBlock,
+                                      bool FailsOnTrue) {
+    Value *Cond = BI->getCondition();
+    Value *Core = Cond;
+    bool CoreFailsOnTrue = FailsOnTrue;
+    while (BinaryOperator::isNot(Core)) {
+        Core = BinaryOperator::getNotArgument(Core);
+        CoreFailsOnTrue = !CoreFailsOnTrue;
+    }
+
+    unsigned Opcode, Kind;
+    bool Signed;
+    bool AllowBothVarying = true;
+    Value *LHS, *RHS;
+    if (ICmpInst *ICI = dyn_cast<ICmpInst>(Core)) {
+        // Equality may fail in the middle of the iteration space.
+        if (ICI->isEquality()) {
+            return false;
+        }
+        Opcode = Instruction::ICmp;
+        Kind = ICI->getPredicate();
+        Signed = ICI->isSigned();
+        LHS = ICI->getOperand(0);
+        RHS = ICI->getOperand(1);
+    } else if (ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(Core)) {
+        IntrinsicInst *II =
+            dyn_cast<IntrinsicInst>(EVI->getAggregateOperand());
+        if (!II || EVI->getNumIndices() != 1 || EVI->getIndices()[0] != 1) {
+            return false;
+        }
+        switch (II->getIntrinsicID()) {
+        case Intrinsic::sadd_with_overflow:
+        case Intrinsic::ssub_with_overflow:
+            Signed = true;
+            break;
+        case Intrinsic::uadd_with_overflow:
+        case Intrinsic::usub_with_overflow:
+            Signed = false;
+            break;
+        case Intrinsic::smul_with_overflow:
+            Signed = true;
+            AllowBothVarying = false;
+            break;
+        case Intrinsic::umul_with_overflow:
+            Signed = false;
+            AllowBothVarying = false;
+            break;
+        default:
+            return false;
+        }
+        // The results that do not overflow are in the middle of the range.
+        if (!CoreFailsOnTrue) {
+            return false;
+        }
+        Opcode = Instruction::Call;
+        Kind = II->getIntrinsicID();
+        LHS = II->getArgOperand(0);
+        RHS = II->getArgOperand(1);
+    } else {
+        return false;
+    }
+
+    // Both operands must be invariant, or affine without wrapping.
+    SCEV::NoWrapFlags NoWrap = Signed ? SCEV::FlagNSW : SCEV::FlagNUW;
+    unsigned NVarying = 0;
+    for (Value *Op : {LHS, RHS}) {
+        if (!SE.isSCEVable(Op->getType())) {
+            return false;
+        }
+        const SCEV *S = SE.getSCEV(Op);
+        if (SE.isLoopInvariant(S, L)) {
+            continue;
+        }
+        const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+        if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+                !AR->getNoWrapFlags(NoWrap)) {
+            return false;
+        }
+        NVarying += 1;
+    }
+    if (NVarying > 1 && !AllowBothVarying) {
+        return false;
+    }
+
+    ConditionKey Key(Opcode, Kind, SE.getSCEV(LHS), SE.getSCEV(RHS),
+                     CoreFailsOnTrue);
+    if (HoistedConditions[L].count(Key)) {
+        DEBUG(dbgs() << "asap: coalesced check " << *BI << "\n");
+        return true;
+    }
+
+    // The failure block is copied in front of the loop, so it must be
+    // possible to compute all values that it uses there.
+    if (!isa<UnreachableInst>(FailBlock->getTerminator())) {
+        return false;
+    }
+    SmallPtrSet<Value *, 16> Visited;
+    if (!canMaterialize(Cond, L, Visited)) {
+        return false;
+    }
+    for (Instruction &I : *FailBlock) {
+        if (PHINode *PN = dyn_cast<PHINode>(&I)) {
+            Value *V = PN->getIncomingValueForBlock(BI->getParent());
+            if (!canMaterialize(V, L, Visited)) {
+                return false;
+            }
+            continue;
+        }
+        for (Value *Op : I.operands()) {
+            if (!canMaterialize(Op, L, Visited)) {
+                return false;
+            }
+        }
+    }
+
+    Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+    Value *FailsFirst = materialize(Cond, L, First, InsertPt);
+    Value *FailsLast = materialize(Cond, L, Last, InsertPt);
+    IRBuilder<> Builder(InsertPt);
+    if (!FailsOnTrue) {
+        FailsFirst = Builder.CreateNot(FailsFirst);
+        FailsLast = Builder.CreateNot(FailsLast);
+    }
+    BasicBlock *Guard = InsertPt->getParent();
+    BasicBlock *FailBB =
+        insertGuard(L, Builder.CreateOr(FailsFirst, FailsLast));
+
+    // Copy the failure block, reporting the values of the failing iteration.
+    InsertPt = Guard->getTerminator();
+    Builder.SetInsertPoint(FailBB->getTerminator());
+    DenseMap<Value *, Value *> Copies;
+    auto GetFailingValue = [&](Value *V) -> Value * {
+        auto Copy = Copies.find(V);
+        if (Copy != Copies.end()) {
+            return Copy->second;
+        }
+        Instruction *I = dyn_cast<Instruction>(V);
+        if (!I || !L->contains(I)) {
+            return V;
+        }
+        return Builder.CreateSelect(FailsFirst,
+                                    materialize(V, L, First, InsertPt),
+                                    materialize(V, L, Last, InsertPt));
+    };
+    for (Instruction &I : *FailBlock) {
+        if (isa<TerminatorInst>(I)) {
+            break;
+        }
+        if (PHINode *PN = dyn_cast<PHINode>(&I)) {
+            Copies[PN] = GetFailingValue(
+                PN->getIncomingValueForBlock(BI->getParent()));
+            continue;
+        }
+        Instruction *Copy = I.clone();
+        for (unsigned i = 0, e = I.getNumOperands(); i != e; ++i) {
+            Copy->setOperand(i, GetFailingValue(I.getOperand(i)));
+        }
+        Builder.Insert(Copy, I.getName());
+        Copies[&I] = Copy;
+    }
+
+    HoistedConditions[L].insert(Key);
+    DEBUG(dbgs() << "asap: hoisted check " << *BI << "\n");
+    return true;
+}
+
+bool CheckHoisting::canMaterialize(Value *V, Loop *L,
+                                   SmallPtrSetImpl<Value *> &Visited) {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !L->contains(I) || !Visited.insert(V).second) {
+        return true;
+    }
+
+    if (SE.isSCEVable(V->getType())) {
+        const SCEV *S = SE.getSCEV(V);
+        const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+        if (SE.isLoopInvariant(S, L) ||
+                (AR && AR->getLoop() == L && AR->isAffine())) {
+            return isSafeToExpand(S, SE);
+        }
+    }
+
+    if (isa<PHINode>(I) || I->mayReadFromMemory() ||
+            !isSafeToSpeculativelyExecute(I)) {
+        return false;
+    }
+    for (Value *Op : I->operands()) {
+        if (!canMaterialize(Op, L, Visited)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Value *CheckHoisting::materialize(Value *V, Loop *L, Endpoint E,
+                                  Instruction *InsertPt) {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !L->contains(I)) {
+        return V;
+    }
+    auto Cached = EndpointValues[E].find(V);
+    if (Cached != EndpointValues[E].end()) {
+        return Cached->second;
+    }
+
+    Value *Result = 0;
+    if (SE.isSCEVable(V->getType())) {
+        const SCEV *S = SE.getSCEV(V);
+        const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+        if (SE.isLoopInvariant(S, L)) {
+            Result = Expander.expandCodeFor(S, V->getType(), InsertPt);
+        } else if (AR && AR->getLoop() == L && AR->isAffine()) {
+            Result = Expander.expandCodeFor(getValueAtEndpoint(AR, E),
+                                            V->getType(), InsertPt);
+        }
+    }
+
+    if (!Result) {
+        Instruction *Copy = I->clone();
+        for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+            Copy->setOperand(i,
+                materialize(I->getOperand(i), L, E, InsertPt));
+        }
+        Copy->setName(I->getName() + (E == First ? ".first" : ".last"));
+        Copy->insertBefore(InsertPt);
+        Result = Copy;
+    }
+
+    EndpointValues[E][V] = Result;
+    return Result;
+}
+
+const SCEV *CheckHoisting::getValueAtEndpoint(const SCEVAddRecExpr *AR,
+                                              Endpoint E) {
+    if (E == First) {
+        return AR->getStart();
+    }
+    const Loop *L = AR->getLoop();
+    Type *Ty = SE.getEffectiveSCEVType(AR->getType());
+    const SCEV *N = SE.getTruncateOrZeroExtend(
+        SE.getExitCount(const_cast<Loop *>(L), L->getLoopLatch()), Ty);
+    return SE.getAddExpr(AR->getStart(),
+                         SE.getMulExpr(AR->getStepRecurrence(SE), N));
+}
+
+BasicBlock *CheckHoisting::insertGuard(Loop *L, Value *Fail) {
+    BasicBlock *Guard = L->getLoopPreheader();
+    BasicBlock *Preheader =
+        SplitBlock(Guard, Guard->getTerminator(), &DT, &LI);
+    Preheader->setName(L->getHeader()->getName() + ".asap.ph");
+
+    LLVMContext &Ctx = Guard->getContext();
+    BasicBlock *FailBB = BasicBlock::Create(Ctx, "asap.hoisted.fail",
+                                            Guard->getParent());
+    new UnreachableInst(Ctx, FailBB);
+
+    TerminatorInst *OldTerm = Guard->getTerminator();
+    BranchInst *Branch = BranchInst::Create(FailBB, Preheader, Fail, OldTerm);
+    Branch->setMetadata(LLVMContext::MD_prof,
+                        MDBuilder(Ctx).createBranchWeights(1, 100000));
+    OldTerm->eraseFromParent();
+    DT.addNewBlock(FailBB, Guard);
+    return FailBB;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,133 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKHOISTING_H
+#define SANITYCHECKS_CHECKHOISTING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/IR/DebugLoc.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tuple>
+
+namespace llvm {
+    class BasicBlock;
+    class BranchInst;
+    class DataLayout;
+    class DominatorTree;
+    class Instruction;
+    class Loop;
+    class LoopInfo;
+    class SCEV;
+    class SCEVAddRecExpr;
+    class ScalarEvolution;
+    class Value;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Moves sanity checks out of loops, as an alternative to removing them.
+    //
+    // A check inside a loop can be hoisted if its condition only depends on
+    // loop-invariant values and on affine functions of the loop's induction
+    // variable that do not wrap, in a way that the failing iterations are a
+    // prefix or suffix of the iteration space. Such a check fails for some
+    // iteration if and only if it fails for the first or the last one. The
+    // hoisted check evaluates both in the loop preheader, using the loop's
+    // trip count from ScalarEvolution, much like InductiveRangeCheckElimination
+    // computes safe iteration spaces.
+    //
+    // ASan checks do not fit this pattern, because they load shadow memory.
+    // Instead, all accesses of a check in the loop are covered by a single
+    // call to __asan_region_is_poisoned. Checks of neighboring accesses are
+    // coalesced into one region, and checks with identical hoisted conditions
+    // are only hoisted once.
+    //
+    // Hoisting only applies to innermost loops whose iterations all run to
+    // completion unless a sanity check fails: the only exits besides the
+    // latch lead to sanity check blocks, the loop makes no calls, and the
+    // check dominates the latch. The hoisted check thus fails if and only if
+    // the original check would have failed, only earlier.
+    class CheckHoisting {
+    public:
+        CheckHoisting(SanityCheckInstructionsPass &SCI, llvm::LoopInfo &LI,
+                      llvm::DominatorTree &DT, llvm::ScalarEvolution &SE,
+                      const llvm::DataLayout &DL);
+
+        // Tries to move the given check out of its loop. Returns true on
+        // success; the caller then disables the check inside the loop.
+        bool hoistCheck(llvm::BranchInst *BI);
+
+        // Emits the checks that have been coalesced so far. Must be called
+        // once all checks have been hoisted.
+        void finish();
+
+    private:
+        SanityCheckInstructionsPass &SCI;
+        llvm::LoopInfo &LI;
+        llvm::DominatorTree &DT;
+        llvm::ScalarEvolution &SE;
+        llvm::SCEVExpander Expander;
+
+        // Memory accessed by an ASan check throughout a loop. The check
+        // accesses Size bytes at Start + k * Step in iteration k.
+        struct Region {
+            const llvm::SCEV *Start;
+            int64_t Step;
+            uint64_t Size;
+            bool IsWrite;
+            llvm::DebugLoc DL;
+        };
+
+        // Regions of ASan checks that will be hoisted, by loop
+        std::map<llvm::Loop *, llvm::SmallVector<Region, 4> > Regions;
+
+        // Conditions of checks that have already been hoisted, by loop. A
+        // condition is given by the opcode and predicate or intrinsic of the
+        // instruction that decides the check, its operands, and whether the
+        // check fails if that instruction yields true.
+        typedef std::tuple<unsigned, unsigned, const llvm::SCEV *,
+                           const llvm::SCEV *, bool> ConditionKey;
+        std::map<llvm::Loop *, std::set<ConditionKey> > HoistedConditions;
+
+        // Loops that have been checked by canHoistFrom
+        llvm::DenseMap<llvm::Loop *, bool> HoistableLoops;
+
+        // Values at the first and last iteration of CurrentLoop
+        enum Endpoint { First, Last };
+        llvm::Loop *CurrentLoop;
+        llvm::DenseMap<llvm::Value *, llvm::Value *> EndpointValues[2];
+
+        bool canHoistFrom(llvm::Loop *L);
+        bool hoistAsanCheck(llvm::BranchInst *BI, llvm::Loop *L,
+                            llvm::BasicBlock *FailBlock);
+        bool hoistGenericCheck(llvm::BranchInst *BI, llvm::Loop *L,
+                               llvm::BasicBlock *FailBlock,
+                               bool FailsOnTrue);
+
+        // Returns true if the values that V takes in the first and last
+        // iteration of L can be computed in L's preheader.
+        bool canMaterialize(llvm::Value *V, llvm::Loop *L,
+                            llvm::SmallPtrSetImpl<llvm::Value *> &Visited);
+        llvm::Value *materialize(llvm::Value *V, llvm::Loop *L, Endpoint E,
+                                 llvm::Instruction *InsertPt);
+        const llvm::SCEV *getValueAtEndpoint(const llvm::SCEVAddRecExpr *AR,
+                                             Endpoint E);
+
+        // Splits the preheader of L, and branches to a new block if Fail is
+        // true. Returns the new block, which is terminated by unreachable.
+        llvm::BasicBlock *insertGuard(llvm::Loop *L, llvm::Value *Fail);
+
+        void emitRegionCheck(llvm::Loop *L, const Region &R);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKHOISTING_H */
@@ -0,0 +1,73 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckProfile.h"
+#include "utils.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+bool CheckProfile::read(std::unique_ptr<MemoryBuffer> B) {
+    const size_t HeaderSize = 4 * sizeof(uint64_t);
+    StringRef Data = B->getBuffer();
+    if (Data.size() < HeaderSize ||
+            reinterpret_cast<uintptr_t>(Data.data()) % alignof(uint64_t)) {
+        errs() << "Check profile is too short or misaligned.\n";
+        return false;
+    }
+
+    const uint64_t *Header = reinterpret_cast<const uint64_t *>(Data.data());
+    if (Header[0] != CheckProfileMagic) {
+        errs() << "Unexpected check profile magic.\n";
+        return false;
+    }
+    if (Header[1] != CheckProfileVersion) {
+        errs() << "Unexpected check profile version: " << Header[1] << ".\n";
+        return false;
+    }
+
+    NumBuckets = Header[2];
+    if (NumBuckets == 0 || (NumBuckets & (NumBuckets - 1)) != 0 ||
+            (Data.size() - HeaderSize) / (2 * sizeof(uint64_t)) != NumBuckets) {
+        errs() << "Invalid number of buckets in check profile.\n";
+        return false;
+    }
+
+    Buckets = Header + 4;
+    Buffer = std::move(B);
+    return true;
+}
+
+uint64_t CheckProfile::getCheckCount(uint64_t CheckId) const {
+    uint64_t Mask = NumBuckets - 1;
+    for (uint64_t i = CheckId & Mask, n = 0; n != NumBuckets;
+            i = (i + 1) & Mask, ++n) {
+        uint64_t BucketId = Buckets[2 * i];
+        if (BucketId == CheckId) {
+            return Buckets[2 * i + 1];
+        }
+        if (BucketId == 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+uint64_t CheckProfile::getCount(Instruction *Inst, BranchInst *Check) {
+    prepare(*Check->getParent()->getParent());
+    return getCheckCount(CheckIds.lookup(Check));
+}
+
+void CheckProfile::prepare(Function &F) {
+    if (!FunctionsWithIds.lookup(&F)) {
+        getSanityCheckIds(&F, SCI, CheckIds);
+        FunctionsWithIds[&F] = true;
+    }
+}
+
+}  // namespace sanitychecks
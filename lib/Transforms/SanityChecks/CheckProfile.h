@@ -0,0 +1,69 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKPROFILE_H
+#define SANITYCHECKS_CHECKPROFILE_H
+
+#include "ProfileSource.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <memory>
+
+namespace llvm {
+    class Function;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // The indexed check profile format, written by the ASAP profiling runtime
+    // (runtime/asap-profile-rt.c). All fields are 64-bit words in host byte
+    // order:
+    //
+    //   Magic, Version, NumBuckets, NumEntries,
+    //   NumBuckets x { CheckId, Count }
+    //
+    // NumBuckets is a power of two. Entries are stored in an open-addressing
+    // hash table: an entry lives in the first free bucket at or after
+    // (CheckId & (NumBuckets - 1)). Empty buckets have a CheckId of zero.
+    const uint64_t CheckProfileMagic = 0x464f525050415341ULL;  // "ASAPPROF"
+    const uint64_t CheckProfileVersion = 2;
+
+    // Reads execution counts of individual sanity checks from an indexed
+    // check profile. The file is memory-mapped, and lookups take constant
+    // time.
+    class CheckProfile : public ProfileSource {
+    public:
+        CheckProfile(SanityCheckInstructionsPass *SCI) : SCI(SCI) {}
+
+        // Reads the given profile; returns false if it is invalid.
+        bool read(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+        // Returns the execution count of the check with the given ID.
+        uint64_t getCheckCount(uint64_t CheckId) const;
+
+        // The instructions of a check are assumed to execute as often as the
+        // check itself.
+        uint64_t getCount(llvm::Instruction *Inst,
+                          llvm::BranchInst *Check) override;
+
+        void prepare(llvm::Function &F) override;
+
+    private:
+        SanityCheckInstructionsPass *SCI;
+        std::unique_ptr<llvm::MemoryBuffer> Buffer;
+        const uint64_t *Buckets;
+        uint64_t NumBuckets;
+
+        // Check IDs, computed per function when first needed
+        llvm::DenseMap<llvm::Function *, bool> FunctionsWithIds;
+        llvm::DenseMap<llvm::BranchInst *, uint64_t> CheckIds;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKPROFILE_H */
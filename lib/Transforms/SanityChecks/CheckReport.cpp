@@ -0,0 +1,173 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckReport.h"
+#include "SanityCheckCostPass.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/YAMLTraits.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace sanitychecks;
+
+namespace {
+    // The whole report, as a single YAML mapping
+    struct ReportDocument {
+        uint64_t TotalChecks;
+        uint64_t TotalCost;
+        uint64_t RemovedChecks;
+        uint64_t RemovedCost;
+        std::vector<CheckRecord> *Checks;
+    };
+
+    CheckLocation getLocation(const DILocation *DL) {
+        return {DL->getFilename(), DL->getLine(), DL->getColumn()};
+    }
+}
+
+LLVM_YAML_IS_FLOW_SEQUENCE_VECTOR(sanitychecks::CheckLocation)
+LLVM_YAML_IS_SEQUENCE_VECTOR(sanitychecks::CheckRecord)
+
+// The report is only ever written, so the mappings below may use temporaries
+// and leave out keys whose values are implied.
+namespace llvm {
+namespace yaml {
+
+template <> struct ScalarEnumerationTraits<CheckDecision> {
+    static void enumeration(IO &io, CheckDecision &Decision) {
+        io.enumCase(Decision, "kept", CheckKept);
+        io.enumCase(Decision, "removed", CheckRemoved);
+        io.enumCase(Decision, "hoisted", CheckHoisted);
+        io.enumCase(Decision, "sampled", CheckSampled);
+        io.enumCase(Decision, "disabled-at-runtime", CheckDisabledAtRuntime);
+        io.enumCase(Decision, "kept-in-clones", CheckKeptInClones);
+    }
+};
+
+template <> struct MappingTraits<CheckLocation> {
+    static void mapping(IO &io, CheckLocation &Location) {
+        io.mapRequired("file", Location.File);
+        io.mapRequired("line", Location.Line);
+        io.mapOptional("column", Location.Column, 0U);
+    }
+
+    static const bool flow = true;
+};
+
+template <> struct MappingTraits<CheckRecord> {
+    static void mapping(IO &io, CheckRecord &Record) {
+        Hex64 Id = Record.Id;
+        io.mapRequired("id", Id);
+        io.mapRequired("function", Record.Function);
+        io.mapRequired("kind", Record.Kind);
+        io.mapOptional("access-size", Record.AccessSize, uint64_t(0));
+        io.mapOptional("handler", Record.Handler, StringRef());
+        if (Record.Location.Line != 0) {
+            io.mapRequired("location", Record.Location);
+        }
+        io.mapOptional("inlined-at", Record.InlinedAt);
+        io.mapRequired("count", Record.Count);
+        io.mapRequired("cost", Record.Cost);
+        io.mapRequired("decision", Record.Decision);
+        io.mapOptional("sampling-period", Record.SamplingPeriod, uint64_t(0));
+    }
+};
+
+template <> struct MappingTraits<ReportDocument> {
+    static void mapping(IO &io, ReportDocument &Doc) {
+        io.mapRequired("total-checks", Doc.TotalChecks);
+        io.mapRequired("total-cost", Doc.TotalCost);
+        io.mapRequired("removed-checks", Doc.RemovedChecks);
+        io.mapRequired("removed-cost", Doc.RemovedCost);
+        io.mapRequired("checks", *Doc.Checks);
+    }
+};
+
+}  // namespace yaml
+}  // namespace llvm
+
+namespace sanitychecks {
+
+CheckReport::CheckReport(SanityCheckInstructionsPass &SCI,
+                         const SanityCheckCostPass &SCC) {
+    const std::vector<SanityCheckCostPass::CheckCost> &Checks =
+        SCC.getCheckCosts();
+
+    DenseMap<BranchInst *, uint64_t> Ids;
+    SmallPtrSet<Function *, 16> Functions;
+    for (const SanityCheckCostPass::CheckCost &I : Checks) {
+        Function *F = I.first->getParent()->getParent();
+        if (Functions.insert(F).second) {
+            getSanityCheckIds(F, &SCI, Ids);
+        }
+    }
+
+    Records.reserve(Checks.size());
+    for (const SanityCheckCostPass::CheckCost &I : Checks) {
+        BranchInst *BI = I.first;
+        CheckRecord R;
+        R.Id = Ids.lookup(BI);
+        R.Function = BI->getParent()->getParent()->getName();
+        R.Kind = "other";
+        R.AccessSize = 0;
+        R.Location = {StringRef(), 0, 0};
+        R.Count = SCC.getInstructionCount(BI);
+        R.Cost = I.second;
+        R.Decision = CheckKept;
+        R.SamplingPeriod = 0;
+
+        unsigned int RegularBranch = getRegularBranch(BI, &SCI);
+        BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+        const CallInst *CI = SCI.findSanityCheckCall(Succ);
+        if (CI && CI->getCalledFunction()) {
+            R.Kind = getSanityCheckKind(CI);
+            R.Handler = CI->getCalledFunction()->getName();
+            bool IsWrite;
+            if (!getAsanReportedAccess(CI, &R.AccessSize, &IsWrite)) {
+                R.AccessSize = 0;
+            }
+        }
+
+        const DILocation *DL = dyn_cast_or_null<DILocation>(
+            getSanityCheckDebugLoc(BI, RegularBranch).getAsMDNode());
+        if (DL) {
+            R.Location = getLocation(DL);
+            for (DL = DL->getInlinedAt(); DL; DL = DL->getInlinedAt()) {
+                R.InlinedAt.push_back(getLocation(DL));
+            }
+        }
+
+        RecordIndex[BI] = Records.size();
+        Records.push_back(std::move(R));
+    }
+}
+
+void CheckReport::setDecision(BranchInst *BI, CheckDecision Decision,
+                              uint64_t SamplingPeriod) {
+    auto I = RecordIndex.find(BI);
+    assert(I != RecordIndex.end() && "Not a sanity check");
+    CheckRecord &R = Records[I->second];
+    R.Decision = Decision;
+    R.SamplingPeriod = SamplingPeriod;
+}
+
+void CheckReport::write(raw_ostream &OS, uint64_t TotalCost,
+                        uint64_t RemovedCost) {
+    uint64_t RemovedChecks = 0;
+    for (const CheckRecord &R : Records) {
+        RemovedChecks += R.Decision != CheckKept;
+    }
+
+    ReportDocument Doc = {Records.size(), TotalCost, RemovedChecks,
+                          RemovedCost, &Records};
+    yaml::Output Out(OS);
+    Out << Doc;
+}
+
+}  // namespace sanitychecks
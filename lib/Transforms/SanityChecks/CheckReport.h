@@ -0,0 +1,100 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKREPORT_H
+#define SANITYCHECKS_CHECKREPORT_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class BranchInst;
+    class raw_ostream;
+}
+
+struct SanityCheckCostPass;
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // What ASAP did with a sanity check
+    enum CheckDecision {
+        CheckKept,
+        CheckRemoved,
+        CheckHoisted,
+        CheckSampled,
+        CheckDisabledAtRuntime,
+        CheckKeptInClones
+    };
+
+    // A source location of a sanity check; Line is 0 if unknown.
+    struct CheckLocation {
+        llvm::StringRef File;
+        unsigned Line;
+        unsigned Column;
+    };
+
+    // Everything the report says about one sanity check
+    struct CheckRecord {
+        uint64_t Id;
+        std::string Function;
+        llvm::StringRef Kind;
+        llvm::StringRef Handler;
+        uint64_t AccessSize;
+        CheckLocation Location;
+        std::vector<CheckLocation> InlinedAt;
+        uint64_t Count;
+        uint64_t Cost;
+        CheckDecision Decision;
+        uint64_t SamplingPeriod;
+    };
+
+    // Records the decision that ASAP takes for each sanity check, and writes
+    // all checks as a YAML document for tools that process ASAP's results:
+    //
+    //   total-checks: 2
+    //   total-cost: 1200
+    //   removed-checks: 1
+    //   removed-cost: 1000
+    //   checks:
+    //     - id: 0x3E1B...
+    //       function: foo
+    //       kind: asan-write
+    //       access-size: 4
+    //       handler: __asan_report_store4
+    //       location: { file: foo.c, line: 12, column: 7 }
+    //       inlined-at: [ { file: bar.c, line: 30, column: 3 } ]
+    //       count: 250
+    //       cost: 1000
+    //       decision: removed
+    //     ...
+    //
+    // Checks are listed by decreasing cost. Their IDs are those of
+    // getSanityCheckIds. The report describes all checks when it is created,
+    // so it must be created before any check is modified.
+    class CheckReport {
+    public:
+        CheckReport(SanityCheckInstructionsPass &SCI,
+                    const SanityCheckCostPass &SCC);
+
+        // Sets the decision for a check; checks are kept by default.
+        void setDecision(llvm::BranchInst *BI, CheckDecision Decision,
+                         uint64_t SamplingPeriod = 0);
+
+        // Writes the report. TotalCost and RemovedCost are those of the
+        // summary that ASAP prints.
+        void write(llvm::raw_ostream &OS, uint64_t TotalCost,
+                   uint64_t RemovedCost);
+
+    private:
+        std::vector<CheckRecord> Records;
+        llvm::DenseMap<llvm::BranchInst *, size_t> RecordIndex;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKREPORT_H */
@@ -0,0 +1,56 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckSampling.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include <cassert>
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+void sampleCheck(BranchInst *BI, Instruction *Entry, uint32_t Period,
+                 SanityCheckInstructionsPass &SCI) {
+    assert(Period >= 2 && "Sampling period too small");
+    BasicBlock *Cont = BI->getSuccessor(getRegularBranch(BI, &SCI));
+    BasicBlock *Head = Entry->getParent();
+    Module &M = *Head->getParent()->getParent();
+    LLVMContext &Ctx = M.getContext();
+    IntegerType *Int32Ty = Type::getInt32Ty(Ctx);
+
+    // The counter is shared by all threads. Monotonic accesses keep it
+    // cheap; lost updates only change which executions are checked.
+    GlobalVariable *Counter = new GlobalVariable(M, Int32Ty, false,
+        GlobalValue::PrivateLinkage, ConstantInt::get(Int32Ty, 0),
+        "asap.sample.counter");
+
+    BasicBlock *Sampled = Head->splitBasicBlock(Entry, "asap.sampled");
+    Head->getTerminator()->eraseFromParent();
+
+    IRBuilder<> Builder(Head);
+    Builder.SetCurrentDebugLocation(BI->getDebugLoc());
+    LoadInst *Count = Builder.CreateLoad(Counter);
+    Count->setAlignment(4);
+    Count->setAtomic(Monotonic);
+    Value *RunCheck = Builder.CreateICmpEQ(Count, ConstantInt::get(Int32Ty, 0));
+    Value *NextCount = Builder.CreateSelect(RunCheck,
+        ConstantInt::get(Int32Ty, Period - 1),
+        Builder.CreateSub(Count, ConstantInt::get(Int32Ty, 1)));
+    StoreInst *Store = Builder.CreateStore(NextCount, Counter);
+    Store->setAlignment(4);
+    Store->setAtomic(Monotonic);
+    Builder.CreateCondBr(RunCheck, Sampled, Cont,
+        MDBuilder(Ctx).createBranchWeights(1, Period - 1));
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,33 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKSAMPLING_H
+#define SANITYCHECKS_CHECKSAMPLING_H
+
+#include <cstdint>
+
+namespace llvm {
+    class BranchInst;
+    class Instruction;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Sampled checks run only once every N times they are reached, which
+    // divides their cost by N while still detecting errors that occur
+    // repeatedly. Every sampled check has a counter of its own; the check
+    // runs whenever the counter reaches zero, starting with its first
+    // execution. Skipping a check skips all the code that computes it, so
+    // only checks with a region (see findCheckRegion) can be sampled.
+
+    // Guards the region that starts at Entry with a counter, so that the
+    // check BI runs once every Period times. Entry must have been returned
+    // by findCheckRegion.
+    void sampleCheck(llvm::BranchInst *BI, llvm::Instruction *Entry,
+                     uint32_t Period, SanityCheckInstructionsPass &SCI);
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKSAMPLING_H */
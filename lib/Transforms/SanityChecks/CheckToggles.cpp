@@ -0,0 +1,141 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckToggles.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+CheckToggles::CheckToggles(Module &M, SanityCheckInstructionsPass &SCI)
+    : M(M), SCI(SCI) {}
+
+bool CheckToggles::addToggle(BranchInst *BI, uint64_t Cost, bool Enabled) {
+    Instruction *Entry = findCheckRegion(BI, &SCI);
+    if (!Entry) {
+        return false;
+    }
+
+    // IDs are computed before any guard changes the function.
+    Function *F = BI->getParent()->getParent();
+    auto FunctionIds = Ids.find(F);
+    if (FunctionIds == Ids.end()) {
+        FunctionIds = Ids.insert(std::make_pair(
+            F, DenseMap<BranchInst *, uint64_t>())).first;
+        getSanityCheckIds(F, &SCI, FunctionIds->second);
+    }
+
+    Toggles.push_back({BI, Entry, FunctionIds->second[BI], Cost, Enabled});
+    return true;
+}
+
+void CheckToggles::finish() {
+    if (Toggles.empty()) {
+        return;
+    }
+
+    LLVMContext &Ctx = M.getContext();
+    Type *Int64Ty = Type::getInt64Ty(Ctx);
+    SmallVector<uint8_t, 64> InitialStates;
+    SmallVector<Constant *, 64> IdValues;
+    SmallVector<Constant *, 64> CostValues;
+    for (const Toggle &T : Toggles) {
+        InitialStates.push_back(T.Enabled);
+        IdValues.push_back(ConstantInt::get(Int64Ty, T.Id));
+        CostValues.push_back(ConstantInt::get(Int64Ty, T.Cost));
+    }
+
+    GlobalVariable *Enabled = new GlobalVariable(M,
+        ArrayType::get(Type::getInt8Ty(Ctx), Toggles.size()), false,
+        GlobalValue::PrivateLinkage,
+        ConstantDataArray::get(Ctx, InitialStates), "__asap_check_enabled");
+
+    ArrayType *TableTy = ArrayType::get(Int64Ty, Toggles.size());
+    GlobalVariable *IdTable = new GlobalVariable(M, TableTy, true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, IdValues),
+        "__asap_toggle_ids");
+    GlobalVariable *CostTable = new GlobalVariable(M, TableTy, true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, CostValues),
+        "__asap_toggle_costs");
+
+    for (size_t i = 0, e = Toggles.size(); i != e; ++i) {
+        insertGuard(Toggles[i], Enabled, i);
+    }
+    insertRegistration(IdTable, CostTable, Enabled);
+    Toggles.clear();
+}
+
+// Splits the check's region off its first block, and only enters it if the
+// enable byte is set. The byte can change at any time, hence the atomic load.
+void CheckToggles::insertGuard(const Toggle &T, GlobalVariable *Enabled,
+                               uint64_t Index) {
+    BasicBlock *Cont = T.BI->getSuccessor(getRegularBranch(T.BI, &SCI));
+    BasicBlock *Head = T.Entry->getParent();
+    BasicBlock *Toggled = Head->splitBasicBlock(T.Entry, "asap.toggled");
+    Head->getTerminator()->eraseFromParent();
+
+    IRBuilder<> Builder(Head);
+    Builder.SetCurrentDebugLocation(T.BI->getDebugLoc());
+    LoadInst *Flag = Builder.CreateLoad(
+        Builder.CreateConstInBoundsGEP2_64(Enabled, 0, Index));
+    Flag->setAlignment(1);
+    Flag->setAtomic(Monotonic);
+    Builder.CreateCondBr(Builder.CreateIsNotNull(Flag), Toggled, Cont);
+}
+
+// Creates a constructor that registers this module's toggles with the
+// runtime, and a destructor that unregisters them, so that the runtime does
+// not keep pointers into a shared library after dlclose:
+//   void __asap_register_toggles(const uint64_t *Ids, const uint64_t *Costs,
+//       uint8_t *Enabled, uint64_t NumChecks);
+//   void __asap_unregister_toggles(uint8_t *Enabled);
+void CheckToggles::insertRegistration(GlobalVariable *IdTable,
+                                      GlobalVariable *CostTable,
+                                      GlobalVariable *Enabled) {
+    LLVMContext &Ctx = M.getContext();
+    Type *Int64Ty = Type::getInt64Ty(Ctx);
+    Type *Int64PtrTy = Type::getInt64PtrTy(Ctx);
+
+    Constant *RegisterFn = M.getOrInsertFunction(
+        "__asap_register_toggles", Type::getVoidTy(Ctx),
+        Int64PtrTy, Int64PtrTy, Type::getInt8PtrTy(Ctx), Int64Ty, nullptr);
+
+    Function *Ctor = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), false),
+        GlobalValue::InternalLinkage, "asap.register_toggles", &M);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Ctor));
+    Builder.CreateCall(RegisterFn, {
+        Builder.CreateConstInBoundsGEP2_64(IdTable, 0, 0),
+        Builder.CreateConstInBoundsGEP2_64(CostTable, 0, 0),
+        Builder.CreateConstInBoundsGEP2_64(Enabled, 0, 0),
+        ConstantInt::get(Int64Ty, Toggles.size())});
+    Builder.CreateRetVoid();
+    appendToGlobalCtors(M, Ctor, 0);
+
+    Constant *UnregisterFn = M.getOrInsertFunction(
+        "__asap_unregister_toggles", Type::getVoidTy(Ctx),
+        Type::getInt8PtrTy(Ctx), nullptr);
+
+    Function *Dtor = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), false),
+        GlobalValue::InternalLinkage, "asap.unregister_toggles", &M);
+    Builder.SetInsertPoint(BasicBlock::Create(Ctx, "entry", Dtor));
+    Builder.CreateCall(UnregisterFn,
+                       Builder.CreateConstInBoundsGEP2_64(Enabled, 0, 0));
+    Builder.CreateRetVoid();
+    appendToGlobalDtors(M, Dtor, 0);
+}
+
+}  // namespace sanitychecks
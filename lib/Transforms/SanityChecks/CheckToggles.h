@@ -0,0 +1,71 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKTOGGLES_H
+#define SANITYCHECKS_CHECKTOGGLES_H
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+    class BranchInst;
+    class Function;
+    class GlobalVariable;
+    class Instruction;
+    class Module;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Makes sanity checks toggleable at runtime. Each toggleable check is
+    // guarded by an enable byte; the check's region (see findCheckRegion)
+    // only runs if the byte is nonzero. The enable bytes of a module form an
+    // array. At startup, the module registers the array with the ASAP toggle
+    // runtime, together with the checks' stable IDs and costs, and
+    // unregisters it when the module is unloaded. The runtime then enables
+    // or disables checks by ID or by cost while the program runs (see
+    // runtime/asap-toggle.h).
+    class CheckToggles {
+    public:
+        CheckToggles(llvm::Module &M, SanityCheckInstructionsPass &SCI);
+
+        // Makes the given check toggleable, and enables it initially if
+        // Enabled is true. Returns false if the check has no region, in
+        // which case the IR remains unchanged.
+        bool addToggle(llvm::BranchInst *BI, uint64_t Cost, bool Enabled);
+
+        // Inserts the guards and emits the tables and their registration.
+        // Must be called once all toggles have been added.
+        void finish();
+
+    private:
+        llvm::Module &M;
+        SanityCheckInstructionsPass &SCI;
+
+        struct Toggle {
+            llvm::BranchInst *BI;
+            llvm::Instruction *Entry;
+            uint64_t Id;
+            uint64_t Cost;
+            bool Enabled;
+        };
+        std::vector<Toggle> Toggles;
+
+        // Stable check IDs, for the functions that have toggles
+        llvm::DenseMap<llvm::Function *,
+                       llvm::DenseMap<llvm::BranchInst *, uint64_t> > Ids;
+
+        void insertGuard(const Toggle &T, llvm::GlobalVariable *Enabled,
+                         uint64_t Index);
+        void insertRegistration(llvm::GlobalVariable *IdTable,
+                                llvm::GlobalVariable *CostTable,
+                                llvm::GlobalVariable *Enabled);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKTOGGLES_H */
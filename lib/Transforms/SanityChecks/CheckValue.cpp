@@ -0,0 +1,103 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CheckValue.h"
+#include "SanityCheckInstructionsPass.h"
+#include "utils.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+
+using namespace llvm;
+
+namespace {
+    // Values of the different kinds of checks
+    const uint64_t TsanValue = 1;
+    const uint64_t DefaultValue = 2;
+    const uint64_t BoundsValue = 4;
+    const uint64_t AssertionValue = 4;
+
+    // Components of the value of ASan checks
+    const uint64_t AccessValue = 1;
+    const uint64_t VariableIndexValue = 2;
+    const uint64_t ForeignObjectValue = 2;
+    const uint64_t WriteValue = 1;
+
+    // How many GEPs and casts to look through to find an accessed object
+    const unsigned MaxAddressDepth = 8;
+}
+
+namespace sanitychecks {
+
+CheckValue::CheckValue(const Module &M, const SanityCheckInstructionsPass &SCI,
+                       const TargetLibraryInfo *TLI)
+    : SCI(SCI), DL(M.getDataLayout()), TLI(TLI) {
+    getDynamicallyInitializedGlobals(M, DynInitGlobals);
+}
+
+uint64_t CheckValue::getValue(BranchInst *BI) const {
+    const CallInst *Report = nullptr;
+    for (unsigned i = 0, e = BI->getNumSuccessors(); i != e && !Report; ++i) {
+        Report = SCI.findSanityCheckCall(BI->getSuccessor(i));
+    }
+    if (!Report || !Report->getCalledFunction()) {
+        return DefaultValue;
+    }
+
+    StringRef Name = Report->getCalledFunction()->getName();
+    if (Name.startswith("__asan_report_")) {
+        return getAccessValue(Report);
+    }
+    if (Name.startswith("__ubsan_handle_out_of_bounds")) {
+        return BoundsValue;
+    }
+    if (Name == "__assert_fail" || Name == "__assert_rtn") {
+        return AssertionValue;
+    }
+    if (Name.startswith("__tsan_")) {
+        return TsanValue;
+    }
+    return DefaultValue;
+}
+
+uint64_t CheckValue::getAccessValue(const CallInst *Report) const {
+    uint64_t Size;
+    bool IsWrite;
+    Value *Addr = getAsanReportedAccess(Report, &Size, &IsWrite);
+    if (!Addr) {
+        return DefaultValue;
+    }
+    if (Size != 0 && isAccessInBounds(Addr, Size, DL, TLI, DynInitGlobals)) {
+        return 0;
+    }
+
+    uint64_t Result = AccessValue;
+    if (IsWrite) {
+        Result += WriteValue;
+    }
+
+    bool VariableIndex = false;
+    Value *Object = Addr;
+    for (unsigned i = 0; i < MaxAddressDepth; ++i) {
+        Object = Object->stripPointerCasts();
+        GEPOperator *GEP = dyn_cast<GEPOperator>(Object);
+        if (!GEP) {
+            break;
+        }
+        VariableIndex |= !GEP->hasAllConstantIndices();
+        Object = GEP->getPointerOperand();
+    }
+    if (VariableIndex) {
+        Result += VariableIndexValue;
+    }
+    if (!isa<AllocaInst>(Object) && !isa<GlobalVariable>(Object)) {
+        Result += ForeignObjectValue;
+    }
+    return Result;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,56 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_CHECKVALUE_H
+#define SANITYCHECKS_CHECKVALUE_H
+
+#include "utils.h"
+
+#include <cstdint>
+
+namespace llvm {
+    class BranchInst;
+    class CallInst;
+    class DataLayout;
+    class Module;
+    class TargetLibraryInfo;
+}
+
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Estimates statically how valuable a sanity check is, i.e., how likely
+    // it is to catch a real bug. Values are small integers that only matter
+    // relative to each other:
+    //
+    // - ASan checks of accesses that are provably in bounds of a local or
+    //   global variable are worth nothing (see isSafeObject). Heap accesses
+    //   are never worth nothing, because the object may have been freed.
+    // - Other ASan checks are worth more if the address is computed with a
+    //   variable index, if the object comes from outside the function (an
+    //   argument, a loaded pointer or a call result) rather than from a
+    //   local or global variable, and if the access is a write.
+    // - Bounds checks and assertions are worth more than other checks;
+    //   TSan callbacks are worth the least.
+    class CheckValue {
+    public:
+        CheckValue(const llvm::Module &M,
+                   const SanityCheckInstructionsPass &SCI,
+                   const llvm::TargetLibraryInfo *TLI);
+
+        uint64_t getValue(llvm::BranchInst *BI) const;
+
+    private:
+        const SanityCheckInstructionsPass &SCI;
+        const llvm::DataLayout &DL;
+        const llvm::TargetLibraryInfo *TLI;
+        GlobalSet DynInitGlobals;
+
+        // Returns the value of the ASan check that reports through Report.
+        uint64_t getAccessValue(const llvm::CallInst *Report) const;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_CHECKVALUE_H */
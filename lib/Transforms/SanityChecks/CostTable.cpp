@@ -0,0 +1,63 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "CostTable.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdlib>
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+bool CostTable::read(StringRef Data) {
+    SmallVector<StringRef, 32> Lines;
+    Data.split(Lines, "\n", -1, false);
+    for (StringRef Line : Lines) {
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#")) {
+            continue;
+        }
+
+        std::pair<StringRef, StringRef> KeyAndValue = Line.split(' ');
+        StringRef Value = KeyAndValue.second.trim();
+        if (KeyAndValue.first == "target") {
+            Target = Value;
+            continue;
+        }
+        StringMap<double> *Table = &Costs;
+        if (KeyAndValue.first == "cached") {
+            KeyAndValue = Value.split(' ');
+            Value = KeyAndValue.second.trim();
+            Table = &CachedCosts;
+        }
+
+        std::string CostString = Value.str();
+        char *CostEnd;
+        double Cost = strtod(CostString.c_str(), &CostEnd);
+        if (CostString.empty() || *CostEnd != '\0' || Cost < 0) {
+            errs() << "Invalid line in cost table: " << Line << "\n";
+            return false;
+        }
+        if (KeyAndValue.first == "unit" && Table == &Costs) {
+            UnitCost = Cost;
+        } else {
+            (*Table)[KeyAndValue.first] = Cost;
+        }
+    }
+    return true;
+}
+
+double CostTable::getCost(StringRef ReportingFunction) const {
+    auto Cost = Costs.find(ReportingFunction);
+    return Cost != Costs.end() ? Cost->second : -1.0;
+}
+
+double CostTable::getCachedCost(StringRef ReportingFunction) const {
+    auto Cost = CachedCosts.find(ReportingFunction);
+    return Cost != CachedCosts.end() ? Cost->second : -1.0;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,58 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_COSTTABLE_H
+#define SANITYCHECKS_COSTTABLE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+namespace sanitychecks {
+
+    // Measured costs of sanity checks, written by asap-clang -asap-calibrate.
+    // The table is a text file with one "<function> <cost>" pair per line,
+    // where <function> reports the errors of a kind of check (e.g.,
+    // __asan_report_load4), and <cost> is the number of cycles that such a
+    // check adds to each execution. A line "target <arch>" names the
+    // architecture on which the costs were measured, and a line
+    // "unit <cost>" gives the cycles per unit of the static cost estimate
+    // (see getInstructionCost). The costs are averaged over kernels whose
+    // accesses hit and miss the cache; a line "cached <function> <cost>"
+    // gives the cost of the check when all its accesses hit the cache. Empty
+    // lines and lines starting with '#' are ignored.
+    class CostTable {
+    public:
+        CostTable() : UnitCost(-1.0) {}
+
+        // Parses the given table; returns false if it is invalid.
+        bool read(llvm::StringRef Data);
+
+        // The architecture on which the costs were measured, if known
+        llvm::StringRef getTarget() const { return Target; }
+
+        // The cycles per unit of the static cost estimate, or a negative
+        // value if the table does not know it
+        double getUnitCost() const { return UnitCost; }
+
+        // Returns the cost of a check whose errors are reported by the given
+        // function, or a negative value if the table does not know it.
+        double getCost(llvm::StringRef ReportingFunction) const;
+
+        // Like getCost, but for checks whose accesses hit the cache
+        double getCachedCost(llvm::StringRef ReportingFunction) const;
+
+        // Whether the table has any costs of checks that hit the cache
+        bool hasCachedCosts() const { return !CachedCosts.empty(); }
+
+    private:
+        std::string Target;
+        double UnitCost;
+        llvm::StringMap<double> Costs;
+        llvm::StringMap<double> CachedCosts;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_COSTTABLE_H */
@@ -17,6 +17,7 @@
 #include "GCOV.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Support/Debug.h"
@@ -127,7 +128,6 @@ void GCOVFile::collectLineCounts(FileInfo &FI) {
 }
 
 uint64_t GCOVFile::getCount(Instruction *Inst) const {
-    BasicBlock *ParentB = Inst->getParent();
     Function   *ParentF = Inst->getParent()->getParent();
     const GCOVFunction *F = getFunction(ParentF);
     if (!F) {
@@ -139,35 +139,7 @@ uint64_t GCOVFile::getCount(Instruction *Inst) const {
                      << " in GCOV data\n");
         return 0;
     }
-    
-    // Find the offset of the block inside its function, and take the GCOV block
-    // at the same offset.
-    // FIXME: This could break very easily, if the order in which GCOV handles
-    //        blocks changes... we try to assert on the shape of the CFG, but
-    //        there is no real guarantee.
-    
-    // GCOVProfiler::emitProfileNotes() splits the entry block of the function.
-    // It also adds a "return block", which is always the last block.
-    // Hence the first and last block of the GCOVFunction are unused, and hence
-    // the +2.
-    assert(ParentF->size() + 2 == F->getNumBlocks()
-            && "Function size does not match GCOV data?");
-    Function::iterator ParentBI = ParentF->begin();
-    GCOVFunction::BlockIterator BI = F->block_begin();
-    ++BI;  // Skip split entry block
-    while (ParentBI != ParentF->end() && &(*ParentBI) != ParentB) {
-        assert(((isa<ReturnInst>(ParentBI->getTerminator()) && BI->getNumDstEdges() == 1) ||
-                (ParentBI->getTerminator()->getNumSuccessors() == BI->getNumDstEdges()))
-                && "CFG mismatch: dst edges");
-        ++ParentBI;
-        ++BI;
-    }
-    assert(ParentBI != ParentF->end()
-            && "Basic block not a member of its parent function?.");
-    assert(ParentBI->getTerminator()->getNumSuccessors() == BI->getNumDstEdges()
-            && "CFG mismatch: dst edges");
-    
-    return BI->getCount();
+    return F->getCount(Inst);
 }
 
 const GCOVFunction *GCOVFile::getFunction(const Function* F) const {
@@ -180,6 +152,71 @@ const GCOVFunction *GCOVFile::getFunction(const Function* F) const {
     return nullptr;
 }
 
+//===----------------------------------------------------------------------===//
+// GCOVFileSet implementation.
+
+void GCOVFileSet::addFile(std::unique_ptr<GCOVFile> File) {
+    for (const GCOVFunction &F : File->functions()) {
+        FunctionsByName[F.getName()].push_back(&F);
+    }
+    Files.push_back(std::move(File));
+}
+
+uint64_t GCOVFileSet::getCount(Instruction *Inst) const {
+    Function *ParentF = Inst->getParent()->getParent();
+    const GCOVFunction *F = getFunction(ParentF);
+    if (!F) {
+        DEBUG(dbgs() << "Warning: could not find function "
+                     << ParentF->getName()
+                     << " in GCOV data\n");
+        return 0;
+    }
+    return F->getCount(Inst);
+}
+
+const GCOVFunction *GCOVFileSet::getFunction(const Function *F) const {
+    auto Cached = FunctionCache.find(F);
+    if (Cached != FunctionCache.end()) {
+        return Cached->second;
+    }
+
+    StringRef Name = F->getName();
+    StringRef Filename;
+    if (DISubprogram *SP = getDISubprogram(F)) {
+        Name = SP->getLinkageName().empty() ? SP->getName()
+                                            : SP->getLinkageName();
+        Filename = SP->getFilename();
+    }
+
+    // GCOVFunction::getCount relies on the CFG matching the coverage data, so
+    // the match must be unique. Without debug info, the name must be unique
+    // among all files; otherwise, the file must match, too.
+    const GCOVFunction *Result = nullptr;
+    auto Candidates = FunctionsByName.find(Name);
+    if (Candidates != FunctionsByName.end()) {
+        for (const GCOVFunction *Candidate : Candidates->second) {
+            if (!Filename.empty() && Candidate->getFilename() != Filename) {
+                continue;
+            }
+            if (Result) {
+                DEBUG(dbgs() << "Warning: function " << Name
+                             << " is ambiguous in GCOV data\n");
+                Result = nullptr;
+                break;
+            }
+            Result = Candidate;
+        }
+    }
+    if (Result && Result->getNumBlocks() != F->size() + 2) {
+        DEBUG(dbgs() << "Warning: CFG of function " << Name
+                     << " does not match GCOV data\n");
+        Result = nullptr;
+    }
+
+    FunctionCache[F] = Result;
+    return Result;
+}
+
 //===----------------------------------------------------------------------===//
 // GCOVFunction implementation.
 
@@ -389,6 +426,40 @@ bool GCOVFunction::readGCDA(GCOVBuffer &Buff, GCOV::GCOVVersion Version) {
   return true;
 }
 
+uint64_t GCOVFunction::getCount(Instruction *Inst) const {
+    BasicBlock *ParentB = Inst->getParent();
+    Function   *ParentF = Inst->getParent()->getParent();
+
+    // Find the offset of the block inside its function, and take the GCOV block
+    // at the same offset.
+    // FIXME: This could break very easily, if the order in which GCOV handles
+    //        blocks changes... we try to assert on the shape of the CFG, but
+    //        there is no real guarantee.
+    
+    // GCOVProfiler::emitProfileNotes() splits the entry block of the function.
+    // It also adds a "return block", which is always the last block.
+    // Hence the first and last block of the GCOVFunction are unused, and hence
+    // the +2.
+    assert(ParentF->size() + 2 == getNumBlocks()
+            && "Function size does not match GCOV data?");
+    Function::iterator ParentBI = ParentF->begin();
+    GCOVFunction::BlockIterator BI = block_begin();
+    ++BI;  // Skip split entry block
+    while (ParentBI != ParentF->end() && &(*ParentBI) != ParentB) {
+        assert(((isa<ReturnInst>(ParentBI->getTerminator()) && BI->getNumDstEdges() == 1) ||
+                (ParentBI->getTerminator()->getNumSuccessors() == BI->getNumDstEdges()))
+                && "CFG mismatch: dst edges");
+        ++ParentBI;
+        ++BI;
+    }
+    assert(ParentBI != ParentF->end()
+            && "Basic block not a member of its parent function?.");
+    assert(ParentBI->getTerminator()->getNumSuccessors() == BI->getNumDstEdges()
+            && "CFG mismatch: dst edges");
+    
+    return BI->getCount();
+}
+
 /// getEntryCount - Get the number of times the function was called by
 /// retrieving the entry block's count.
 uint64_t GCOVFunction::getEntryCount() const {
@@ -21,6 +21,8 @@
 #ifndef LLVM_SUPPORT_GCOV_H
 #define LLVM_SUPPORT_GCOV_H
 
+#include "ProfileSource.h"
+
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallVector.h"
@@ -30,6 +32,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 namespace llvm {
+    class BranchInst;
     class Function;
     class Instruction;
 }
@@ -268,6 +271,13 @@ public:
 
   // Returns the number of times a given instruction has been executed.
   uint64_t getCount(llvm::Instruction *Inst) const;
+
+  typedef pointee_iterator<SmallVectorImpl<
+      std::unique_ptr<GCOVFunction>>::const_iterator> FunctionIterator;
+  iterator_range<FunctionIterator> functions() const {
+    return make_range(FunctionIterator(Functions.begin()),
+                      FunctionIterator(Functions.end()));
+  }
   
 private:
   bool GCNOInitialized;
@@ -282,6 +292,37 @@ private:
   const GCOVFunction *getFunction(const llvm::Function *F) const;
 };
 
+/// GCOVFileSet - Collects coverage information for several pairs of coverage
+/// files, e.g., for all objects that are linked into one program.
+class GCOVFileSet : public ProfileSource {
+public:
+  void addFile(std::unique_ptr<GCOVFile> File);
+
+  // Returns the number of times a given instruction has been executed.
+  uint64_t getCount(llvm::Instruction *Inst) const;
+
+  uint64_t getCount(llvm::Instruction *Inst,
+                    llvm::BranchInst *Check) override {
+    return getCount(Inst);
+  }
+
+  void prepare(llvm::Function &F) override { getFunction(&F); }
+
+private:
+  SmallVector<std::unique_ptr<GCOVFile>, 1> Files;
+
+  // All GCOV functions, by name. Local functions from different files can
+  // share a name; these are told apart by their source file, and are not
+  // found at all if that is unknown.
+  StringMap<SmallVector<const GCOVFunction *, 1>> FunctionsByName;
+  mutable DenseMap<const llvm::Function *, const GCOVFunction *> FunctionCache;
+
+  // Finds the GCOVFunction corresponding to the given LLVM function. Since
+  // functions can be renamed when modules are linked, this uses the name
+  // from the function's debug info, which is also what GCOV records.
+  const GCOVFunction *getFunction(const llvm::Function *F) const;
+};
+
 /// GCOVEdge - Collects edge information.
 struct GCOVEdge {
   GCOVEdge(GCOVBlock &S, GCOVBlock &D) : Src(S), Dst(D), Count(0) {}
@@ -315,6 +356,10 @@ public:
   void dump() const;
   void collectLineCounts(FileInfo &FI);
 
+  // Returns the number of times a given instruction of the corresponding LLVM
+  // function has been executed.
+  uint64_t getCount(llvm::Instruction *Inst) const;
+
 private:
   GCOVFile &Parent;
   uint32_t Ident;
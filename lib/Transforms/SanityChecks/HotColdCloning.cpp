@@ -0,0 +1,158 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "HotColdCloning.h"
+#include "SanityCheckCostPass.h"
+#include "SanityCheckInstructionsPass.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "asap"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+HotColdCloning::HotColdCloning(Module &M, SanityCheckInstructionsPass &SCI,
+                               SanityCheckCostPass &SCC,
+                               uint64_t ColdCallCount)
+    : M(M), SCI(SCI), SCC(SCC), ColdCallCount(ColdCallCount) {}
+
+void HotColdCloning::addFunction(Function *F) {
+    Clones.insert(std::make_pair(F, nullptr));
+}
+
+Function *HotColdCloning::getAddedCallee(CallSite CS) const {
+    Function *Callee = CS.getCalledFunction();
+    return Callee && Clones.count(Callee) ? Callee : nullptr;
+}
+
+bool HotColdCloning::callsAddedFunction(Function &F) const {
+    for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+            CallSite CS(&I);
+            if (CS && getAddedCallee(CS)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void HotColdCloning::findColdCalls(Function &F, DominatorTree &DT,
+                                   LoopInfo &LI) {
+    for (Instruction *Inst : SCI.getSanityCheckBranches(&F)) {
+        for (Instruction *I : SCI.getInstructionsBySanityCheck(Inst)) {
+            uint64_t &Count = BlockCounts[I->getParent()];
+            Count = std::max(Count, SCC.getInstructionCount(I));
+        }
+    }
+
+    for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+            CallSite CS(&I);
+            if (!CS || !getAddedCallee(CS)) {
+                continue;
+            }
+            uint64_t Count = getCountBound(&I, DT, LI);
+            if (Count <= ColdCallCount) {
+                DEBUG(dbgs() << "Cold call (count " << Count << "): " << I
+                             << "\n");
+                ColdCalls.push_back(CS);
+            }
+        }
+    }
+}
+
+// A block that dominates I within I's loop runs at least as often as I,
+// because every path from one execution of I to the next passes through the
+// loop header, and thus through the dominating block.
+uint64_t HotColdCloning::getCountBound(Instruction *I, DominatorTree &DT,
+                                       LoopInfo &LI) {
+    Loop *L = LI.getLoopFor(I->getParent());
+    for (DomTreeNode *N = DT.getNode(I->getParent()); N; N = N->getIDom()) {
+        BasicBlock *BB = N->getBlock();
+        if (LI.getLoopFor(BB) != L) {
+            break;
+        }
+        auto Count = BlockCounts.find(BB);
+        if (Count != BlockCounts.end()) {
+            return Count->second;
+        }
+    }
+    return (uint64_t)(-1);
+}
+
+size_t HotColdCloning::finish() {
+    // Clone the functions that cold calls reach, directly or through other
+    // checked clones.
+    std::vector<Function *> Worklist;
+    for (CallSite CS : ColdCalls) {
+        Worklist.push_back(getAddedCallee(CS));
+    }
+    size_t NClones = 0;
+    while (!Worklist.empty()) {
+        Function *F = Worklist.back();
+        Worklist.pop_back();
+        Function *&Clone = Clones[F];
+        if (Clone) {
+            continue;
+        }
+        Clone = createCheckedClone(F);
+        NClones += 1;
+        for (BasicBlock &BB : *F) {
+            for (Instruction &I : BB) {
+                CallSite CS(&I);
+                if (CS && getAddedCallee(CS)) {
+                    Worklist.push_back(getAddedCallee(CS));
+                }
+            }
+        }
+    }
+
+    for (auto &FunctionClone : Clones) {
+        if (!FunctionClone.second) {
+            continue;
+        }
+        for (BasicBlock &BB : *FunctionClone.second) {
+            for (Instruction &I : BB) {
+                CallSite CS(&I);
+                if (CS && getAddedCallee(CS)) {
+                    CS.setCalledFunction(Clones.lookup(getAddedCallee(CS)));
+                }
+            }
+        }
+    }
+
+    for (CallSite CS : ColdCalls) {
+        CS.setCalledFunction(Clones.lookup(getAddedCallee(CS)));
+    }
+    return NClones;
+}
+
+// The clone is local to the module, so that it does not clash with clones of
+// the same inline function in other modules.
+Function *HotColdCloning::createCheckedClone(Function *F) {
+    ValueToValueMapTy VMap;
+    Function *Clone = CloneFunction(F, VMap, false);
+    Clone->setLinkage(GlobalValue::InternalLinkage);
+    Clone->setVisibility(GlobalValue::DefaultVisibility);
+    Clone->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+    Clone->setComdat(nullptr);
+    M.getFunctionList().push_back(Clone);
+    Clone->setName(F->getName() + ".asap.checked");
+    DEBUG(dbgs() << "Created checked clone " << Clone->getName() << "\n");
+    return Clone;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,97 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_HOTCOLDCLONING_H
+#define SANITYCHECKS_HOTCOLDCLONING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/IR/CallSite.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class DominatorTree;
+    class Function;
+    class Instruction;
+    class LoopInfo;
+    class Module;
+}
+
+struct SanityCheckCostPass;
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Keeps the checks that ASAP removes on the paths where they are cheap.
+    // Before checks are removed from a function, the function is cloned, and
+    // the clone keeps all checks. Direct calls that are cold according to
+    // the profile then call the checked clone, while hot calls, indirect
+    // calls and calls from other modules use the lean original. Calls made
+    // by a checked clone go to checked clones as well, so that cold callers
+    // are fully protected down the call tree.
+    //
+    // The profile only counts check instructions. A call runs at most as
+    // often as the closest block that dominates it, lies in the same loop,
+    // and contains check instructions; calls are cold if this bound is at
+    // most the given count. Calls without such a block are considered hot,
+    // which is what ASAP would do without cloning.
+    class HotColdCloning {
+    public:
+        HotColdCloning(llvm::Module &M, SanityCheckInstructionsPass &SCI,
+                       SanityCheckCostPass &SCC, uint64_t ColdCallCount);
+
+        // Marks a function whose checks will be removed.
+        void addFunction(llvm::Function *F);
+
+        // Returns true if F calls any of the added functions directly.
+        bool callsAddedFunction(llvm::Function &F) const;
+
+        // Records the cold calls from F to added functions. DT and LI must
+        // be computed for F.
+        void findColdCalls(llvm::Function &F, llvm::DominatorTree &DT,
+                           llvm::LoopInfo &LI);
+
+        // Clones the added functions that cold calls reach, and redirects
+        // these calls. Must be called before any checks are removed.
+        // Returns the number of clones.
+        size_t finish();
+
+        size_t getNumColdCalls() const { return ColdCalls.size(); }
+
+        // Returns the checked clone of an added function, or null if finish
+        // did not clone it.
+        llvm::Function *getClone(llvm::Function *F) const {
+            return Clones.lookup(F);
+        }
+
+    private:
+        llvm::Module &M;
+        SanityCheckInstructionsPass &SCI;
+        SanityCheckCostPass &SCC;
+        uint64_t ColdCallCount;
+
+        // Added functions, and their checked clones once created
+        llvm::MapVector<llvm::Function *, llvm::Function *> Clones;
+
+        std::vector<llvm::CallSite> ColdCalls;
+
+        // Execution counts of blocks that contain check instructions
+        llvm::DenseMap<llvm::BasicBlock *, uint64_t> BlockCounts;
+
+        // Returns the added function that CS calls directly, or null.
+        llvm::Function *getAddedCallee(llvm::CallSite CS) const;
+
+        // Returns an upper bound for the execution count of I, or
+        // (uint64_t)-1 if the profile does not tell.
+        uint64_t getCountBound(llvm::Instruction *I, llvm::DominatorTree &DT,
+                               llvm::LoopInfo &LI);
+
+        llvm::Function *createCheckedClone(llvm::Function *F);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_HOTCOLDCLONING_H */
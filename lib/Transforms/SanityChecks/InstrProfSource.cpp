@@ -0,0 +1,56 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "InstrProfSource.h"
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#define DEBUG_TYPE "sanity-check-cost"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+uint64_t InstrProfSource::getCount(Instruction *Inst, BranchInst *Check) {
+    BasicBlock *BB = Inst->getParent();
+    prepare(*BB->getParent());
+    return BlockCounts.lookup(BB);
+}
+
+void InstrProfSource::prepare(Function &F) {
+    if (!FunctionsWithCounts.lookup(&F)) {
+        computeBlockCounts(&F);
+        FunctionsWithCounts[&F] = true;
+    }
+}
+
+void InstrProfSource::computeBlockCounts(Function *F) {
+    Optional<uint64_t> EntryCount = F->getEntryCount();
+    if (!EntryCount) {
+        DEBUG(dbgs() << "Warning: no profile for function " << F->getName()
+                     << "\n");
+        return;
+    }
+
+    // The frequencies are only valid until the next function is analyzed,
+    // so all counts are computed at once. The product can exceed 64 bits,
+    // and is rounded to the nearest count.
+    BlockFrequencyInfo &BFI = GetBFI(*F);
+    APInt EntryFreq(128, BFI.getEntryFreq());
+    if (EntryFreq == 0) {
+        return;
+    }
+    for (BasicBlock &BB : *F) {
+        APInt Count(128, *EntryCount);
+        Count *= APInt(128, BFI.getBlockFreq(&BB).getFrequency());
+        Count += EntryFreq.lshr(1);
+        BlockCounts[&BB] = Count.udiv(EntryFreq).getLimitedValue();
+    }
+}
+
+}  // namespace sanitychecks
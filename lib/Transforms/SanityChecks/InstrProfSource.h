@@ -0,0 +1,55 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_INSTRPROFSOURCE_H
+#define SANITYCHECKS_INSTRPROFSOURCE_H
+
+#include "ProfileSource.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <functional>
+
+namespace llvm {
+    class BasicBlock;
+    class BlockFrequencyInfo;
+    class Function;
+}
+
+namespace sanitychecks {
+
+    // Reads execution counts from the instrprof profile that clang applied
+    // with -fprofile-instr-use=<file.profdata>. Clang records the profile in
+    // the IR, as function entry counts and branch weights, so any program
+    // that is built with the profile can be analyzed; it need not be built
+    // with -fprofile-instr-generate itself.
+    //
+    // A block executes as often as its function's entry count, scaled by
+    // the block's frequency relative to the entry block. BlockFrequencyInfo
+    // computes these frequencies from the branch weights. Functions without
+    // an entry count have not been executed in the profiled runs.
+    class InstrProfSource : public ProfileSource {
+    public:
+        typedef std::function<llvm::BlockFrequencyInfo &(llvm::Function &)>
+            BFIGetter;
+
+        explicit InstrProfSource(BFIGetter GetBFI) : GetBFI(GetBFI) {}
+
+        uint64_t getCount(llvm::Instruction *Inst,
+                          llvm::BranchInst *Check) override;
+
+        void prepare(llvm::Function &F) override;
+
+    private:
+        BFIGetter GetBFI;
+
+        // Block counts, computed per function when first needed
+        llvm::DenseMap<llvm::Function *, bool> FunctionsWithCounts;
+        llvm::DenseMap<llvm::BasicBlock *, uint64_t> BlockCounts;
+
+        void computeBlockCounts(llvm::Function *F);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_INSTRPROFSOURCE_H */
@@ -0,0 +1,136 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "Knapsack.h"
+
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#define DEBUG_TYPE "sanity-check-knapsack"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+namespace {
+
+    const uint64_t Infinity = (uint64_t)(-1);
+
+    // Solves the knapsack problem exactly, using dynamic programming over
+    // values. MinWeight[v] is the minimal weight needed to obtain a value of
+    // exactly v; this keeps the table small even though costs are large.
+    void solveExact(const std::vector<KnapsackItem> &Items,
+                    const std::vector<size_t> &Candidates,
+                    uint64_t TotalValue, uint64_t Capacity,
+                    std::vector<bool> &Selected) {
+        size_t NValues = TotalValue + 1;
+        std::vector<uint64_t> MinWeight(NValues, Infinity);
+        MinWeight[0] = 0;
+
+        // Taken[i * NValues + v] is true if candidate i was used to reach
+        // value v, given candidates 0 ... i.
+        std::vector<bool> Taken(Candidates.size() * NValues, false);
+
+        uint64_t ReachableValue = 0;
+        for (size_t i = 0, e = Candidates.size(); i != e; ++i) {
+            const KnapsackItem &Item = Items[Candidates[i]];
+            ReachableValue += Item.Value;
+            for (uint64_t v = ReachableValue; v >= Item.Value; --v) {
+                uint64_t Previous = MinWeight[v - Item.Value];
+                if (Previous == Infinity || Item.Weight > Capacity - Previous) {
+                    continue;
+                }
+                if (Previous + Item.Weight < MinWeight[v]) {
+                    MinWeight[v] = Previous + Item.Weight;
+                    Taken[i * NValues + v] = true;
+                }
+            }
+        }
+
+        uint64_t BestValue = TotalValue;
+        while (MinWeight[BestValue] == Infinity) {
+            --BestValue;
+        }
+
+        for (size_t i = Candidates.size(); i != 0 && BestValue != 0; --i) {
+            if (Taken[(i - 1) * NValues + BestValue]) {
+                Selected[Candidates[i - 1]] = true;
+                BestValue -= Items[Candidates[i - 1]].Value;
+            }
+        }
+    }
+
+    // Approximates the knapsack problem by taking items in order of
+    // decreasing value per weight. The result is compared against the most
+    // valuable single item, which guarantees at least half the optimal value.
+    void solveGreedy(const std::vector<KnapsackItem> &Items,
+                     std::vector<size_t> Candidates, uint64_t Capacity,
+                     std::vector<bool> &Selected) {
+        std::sort(Candidates.begin(), Candidates.end(),
+                [&Items](size_t a, size_t b) {
+                    return (double)Items[a].Value * Items[b].Weight >
+                           (double)Items[b].Value * Items[a].Weight;
+                });
+
+        uint64_t UsedWeight = 0;
+        uint64_t GreedyValue = 0;
+        size_t BestItem = Candidates.front();
+        std::vector<size_t> GreedyItems;
+        for (size_t i : Candidates) {
+            if (Items[i].Value > Items[BestItem].Value) {
+                BestItem = i;
+            }
+            if (Items[i].Weight <= Capacity - UsedWeight) {
+                UsedWeight += Items[i].Weight;
+                GreedyValue += Items[i].Value;
+                GreedyItems.push_back(i);
+            }
+        }
+
+        if (Items[BestItem].Value > GreedyValue) {
+            Selected[BestItem] = true;
+        } else {
+            for (size_t i : GreedyItems) {
+                Selected[i] = true;
+            }
+        }
+    }
+
+}  // anonymous namespace
+
+std::vector<bool> solveKnapsack(const std::vector<KnapsackItem> &Items,
+                                uint64_t Capacity, uint64_t MaxTableSize) {
+    std::vector<bool> Selected(Items.size(), false);
+
+    // Items without weight are always selected, and items that cannot be
+    // selected or do not add value need not be considered at all.
+    std::vector<size_t> Candidates;
+    uint64_t TotalValue = 0;
+    for (size_t i = 0, e = Items.size(); i != e; ++i) {
+        if (Items[i].Weight == 0) {
+            Selected[i] = true;
+        } else if (Items[i].Weight <= Capacity && Items[i].Value > 0) {
+            Candidates.push_back(i);
+            TotalValue += Items[i].Value;
+        }
+    }
+
+    if (Candidates.empty()) {
+        return Selected;
+    }
+
+    if (TotalValue < MaxTableSize / Candidates.size()) {
+        DEBUG(dbgs() << "Solving knapsack exactly for " << Candidates.size()
+                     << " items\n");
+        solveExact(Items, Candidates, TotalValue, Capacity, Selected);
+    } else {
+        DEBUG(dbgs() << "Approximating knapsack for " << Candidates.size()
+                     << " items\n");
+        solveGreedy(Items, Candidates, Capacity, Selected);
+    }
+
+    return Selected;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,32 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_KNAPSACK_H
+#define SANITYCHECKS_KNAPSACK_H
+
+#include <cstdint>
+#include <vector>
+
+namespace sanitychecks {
+
+    // An item for the knapsack solver. For ASAP, this is a sanity check; its
+    // weight is the check's cost, and its value is the benefit of keeping it.
+    struct KnapsackItem {
+        uint64_t Weight;
+        uint64_t Value;
+    };
+
+    // Selects a subset of Items whose total weight is at most Capacity, such
+    // that their total value is maximal. Returns one flag per item, which is
+    // true if the item has been selected.
+    //
+    // If the dynamic programming table (number of items times total value)
+    // has at most MaxTableSize entries, the result is exact. Otherwise, the
+    // solver falls back to a greedy approximation that picks items by
+    // decreasing value per weight.
+    std::vector<bool> solveKnapsack(const std::vector<KnapsackItem> &Items,
+                                    uint64_t Capacity, uint64_t MaxTableSize);
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_KNAPSACK_H */
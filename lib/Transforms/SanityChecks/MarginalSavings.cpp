@@ -0,0 +1,58 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "MarginalSavings.h"
+#include "SanityCheckCostPass.h"
+#include "SanityCheckInstructionsPass.h"
+
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+MarginalSavings::MarginalSavings(const SanityCheckCostPass &SCC,
+                                 const SanityCheckInstructionsPass &SCI)
+        : SCC(SCC), SCI(SCI), TotalCost(0) {
+    for (const SanityCheckCostPass::CheckCost &I : SCC.getCheckCosts()) {
+        for (Instruction *Inst : SCI.getInstructionsBySanityCheck(I.first)) {
+            Users[Inst].push_back(I.first);
+            RemainingUsers[Inst] += 1;
+        }
+    }
+
+    for (const auto &U : Users) {
+        uint64_t Cost = SCC.getInstructionCost(U.first);
+        TotalCost += Cost;
+        if (U.second.size() == 1) {
+            Savings[U.second.front()] += Cost;
+        }
+    }
+}
+
+void MarginalSavings::removeCheck(BranchInst *BI,
+                                  SmallVectorImpl<BranchInst *> &Changed) {
+    assert(!Removed.lookup(BI) && "Check has already been removed");
+    Removed[BI] = true;
+
+    for (Instruction *Inst : SCI.getInstructionsBySanityCheck(BI)) {
+        unsigned &Remaining = RemainingUsers[Inst];
+        assert(Remaining > 0 && "Instruction without remaining users?");
+        Remaining -= 1;
+        if (Remaining != 1) {
+            continue;
+        }
+
+        // Only one check still uses this instruction; removing that check
+        // now also removes the instruction.
+        for (BranchInst *User : Users[Inst]) {
+            if (!Removed.lookup(User)) {
+                Savings[User] += SCC.getInstructionCost(Inst);
+                Changed.push_back(User);
+                break;
+            }
+        }
+    }
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,67 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_MARGINALSAVINGS_H
+#define SANITYCHECKS_MARGINALSAVINGS_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <cstdint>
+
+namespace llvm {
+    class BranchInst;
+    class Instruction;
+}
+
+struct SanityCheckCostPass;
+struct SanityCheckInstructionsPass;
+
+namespace sanitychecks {
+
+    // Tracks how much cost is actually saved by removing a sanity check.
+    //
+    // Instructions can be shared among several checks (e.g., ASan's shadow
+    // address computation for neighboring accesses). Such an instruction only
+    // disappears once all checks that use it have been removed. The savings
+    // of a check are thus the cost of those of its instructions that no
+    // other remaining check uses; they grow as other checks are removed.
+    class MarginalSavings {
+    public:
+        MarginalSavings(const SanityCheckCostPass &SCC,
+                        const SanityCheckInstructionsPass &SCI);
+
+        // Returns the cost saved by removing the given check now.
+        uint64_t getSavings(llvm::BranchInst *BI) const {
+            return Savings.lookup(BI);
+        }
+
+        // Returns the total cost of all checks, counting shared instructions
+        // only once.
+        uint64_t getTotalCost() const { return TotalCost; }
+
+        // Marks a check as removed, and updates the savings of the remaining
+        // checks. Checks whose savings changed are appended to Changed.
+        void removeCheck(llvm::BranchInst *BI,
+                         llvm::SmallVectorImpl<llvm::BranchInst *> &Changed);
+
+    private:
+        const SanityCheckCostPass &SCC;
+        const SanityCheckInstructionsPass &SCI;
+
+        // For each check instruction, the checks that use it
+        llvm::DenseMap<llvm::Instruction *,
+                       llvm::SmallVector<llvm::BranchInst *, 4> > Users;
+
+        // For each check instruction, the number of checks using it that
+        // have not yet been removed
+        llvm::DenseMap<llvm::Instruction *, unsigned> RemainingUsers;
+
+        llvm::DenseMap<llvm::BranchInst *, uint64_t> Savings;
+        llvm::DenseMap<llvm::BranchInst *, bool> Removed;
+        uint64_t TotalCost;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_MARGINALSAVINGS_H */
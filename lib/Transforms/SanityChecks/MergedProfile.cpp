@@ -0,0 +1,67 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "MergedProfile.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace sanitychecks {
+
+void MergedProfile::addWorkload(std::unique_ptr<ProfileSource> Source,
+                                double Weight) {
+    TotalWeight += Weight;
+    Workloads.push_back(Workload{std::move(Source), Weight});
+}
+
+void MergedProfile::prepare(llvm::Function &F) {
+    for (Workload &W : Workloads) {
+        W.Source->prepare(F);
+    }
+}
+
+uint64_t MergedProfile::getCount(llvm::Instruction *Inst,
+                                 llvm::BranchInst *Check) {
+    if (Workloads.empty() || TotalWeight <= 0) {
+        return 0;
+    }
+
+    if (Mode == MeanMerge) {
+        double Sum = 0;
+        for (Workload &W : Workloads) {
+            Sum += W.Weight * W.Source->getCount(Inst, Check);
+        }
+        return (uint64_t)(Sum / TotalWeight + 0.5);
+    }
+
+    if (Mode == MaxMerge) {
+        uint64_t Max = 0;
+        for (Workload &W : Workloads) {
+            if (W.Weight > 0) {
+                Max = std::max(Max, W.Source->getCount(Inst, Check));
+            }
+        }
+        return Max;
+    }
+
+    // Walk through the counts in increasing order, until the requested
+    // fraction of the total weight is covered.
+    std::vector<std::pair<uint64_t, double>> Counts;
+    for (Workload &W : Workloads) {
+        Counts.push_back(std::make_pair(W.Source->getCount(Inst, Check),
+                                        W.Weight));
+    }
+    std::sort(Counts.begin(), Counts.end());
+
+    double Needed = TotalWeight * Percentile / 100;
+    double Covered = 0;
+    for (const auto &C : Counts) {
+        Covered += C.second;
+        if (Covered >= Needed) {
+            return C.first;
+        }
+    }
+    return Counts.back().first;
+}
+
+}  // namespace sanitychecks
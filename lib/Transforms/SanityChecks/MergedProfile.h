@@ -0,0 +1,64 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_MERGEDPROFILE_H
+#define SANITYCHECKS_MERGEDPROFILE_H
+
+#include "ProfileSource.h"
+
+#include <memory>
+#include <vector>
+
+namespace sanitychecks {
+
+    // How counts of several workloads are combined into one.
+    enum MergeMode {
+        // The weighted average count
+        MeanMerge,
+        // The count of the workload in which an instruction is hottest
+        MaxMerge,
+        // The smallest count that is not exceeded in the given percentage of
+        // the (weighted) workloads
+        PercentileMerge
+    };
+
+    // Combines the profiles of several workloads. Each workload has a weight,
+    // e.g., its share of the traffic. The weights should add up to one, but
+    // are normalized otherwise.
+    //
+    // Counts of different workloads are compared directly, so the profiles
+    // should describe comparable amounts of work.
+    //
+    // Counts are merged per instruction, before costs are summed and the
+    // budget is applied. MaxMerge thus budgets for a synthetic worst case in
+    // which every check is as hot as in its hottest workload; no workload
+    // spends more on the kept checks than this one does. This approximates,
+    // but is not the same as, applying the budget to each workload.
+    class MergedProfile : public ProfileSource {
+    public:
+        MergedProfile(MergeMode Mode, double Percentile)
+            : Mode(Mode), Percentile(Percentile), TotalWeight(0) {}
+
+        void addWorkload(std::unique_ptr<ProfileSource> Source, double Weight);
+        size_t getNumWorkloads() const { return Workloads.size(); }
+
+        uint64_t getCount(llvm::Instruction *Inst,
+                          llvm::BranchInst *Check) override;
+
+        void prepare(llvm::Function &F) override;
+
+    private:
+        struct Workload {
+            std::unique_ptr<ProfileSource> Source;
+            double Weight;
+        };
+
+        MergeMode Mode;
+        double Percentile;
+        double TotalWeight;
+        std::vector<Workload> Workloads;
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_MERGEDPROFILE_H */
@@ -0,0 +1,63 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "MissProfile.h"
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+namespace sanitychecks {
+
+double MissProfile::getMisses(LoadInst *Load) {
+    Location L;
+    if (!getLocation(Load, L)) {
+        return 0;
+    }
+    uint64_t Weight = Samples->getInstructionWeight(Load);
+    if (Weight == 0) {
+        return 0;
+    }
+
+    if (!LoadsCounted) {
+        countLoads(*Load->getParent()->getParent()->getParent());
+        LoadsCounted = true;
+    }
+    return (double)Weight / LoadsByLocation[L];
+}
+
+void MissProfile::prepare(Function &F) {
+    if (!LoadsCounted) {
+        countLoads(*F.getParent());
+        LoadsCounted = true;
+    }
+    Samples->prepare(F);
+}
+
+bool MissProfile::getLocation(LoadInst *Load, Location &L) {
+    DILocation *DIL = Load->getDebugLoc();
+    if (!DIL) {
+        return false;
+    }
+    L = std::make_tuple(DIL->getScope()->getSubprogram(), DIL->getLine(),
+                        DIL->getDiscriminator());
+    return true;
+}
+
+void MissProfile::countLoads(Module &M) {
+    for (Function &F : M) {
+        for (Instruction &I : inst_range(F)) {
+            Location L;
+            LoadInst *Load = dyn_cast<LoadInst>(&I);
+            if (Load && getLocation(Load, L)) {
+                LoadsByLocation[L] += 1;
+            }
+        }
+    }
+}
+
+}  // namespace sanitychecks
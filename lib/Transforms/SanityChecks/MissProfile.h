@@ -0,0 +1,60 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_MISSPROFILE_H
+#define SANITYCHECKS_MISSPROFILE_H
+
+#include "SampleProfSource.h"
+
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace llvm {
+    class DISubprogram;
+    class LoadInst;
+    class Module;
+}
+
+namespace sanitychecks {
+
+    // Cache misses by source location, from a sample profile of a memory
+    // event (e.g., perf samples of load misses, converted with
+    // create_llvm_prof). Checks whose shadow loads miss the cache stall the
+    // pipeline, and cost much more than their execution count suggests.
+    //
+    // The profile cannot tell apart the loads at one source location, such
+    // as a shadow load and the access it protects. Their samples are thus
+    // shared evenly among all loads at that location.
+    class MissProfile {
+    public:
+        MissProfile(std::unique_ptr<SampleProfSource> Samples)
+            : Samples(std::move(Samples)), LoadsCounted(false) {}
+
+        // Returns the number of miss samples attributed to the given load.
+        double getMisses(llvm::LoadInst *Load);
+
+        // Prepares getMisses for the loads of F, like
+        // ProfileSource::prepare.
+        void prepare(llvm::Function &F);
+
+    private:
+        std::unique_ptr<SampleProfSource> Samples;
+
+        // A source location, as the sample profile sees it: subprogram, line
+        // and discriminator
+        typedef std::tuple<const llvm::DISubprogram *, unsigned, unsigned>
+            Location;
+
+        // Number of loads at each location in the module. Inlined copies of
+        // a function share its samples, so they are counted together.
+        bool LoadsCounted;
+        std::map<Location, unsigned> LoadsByLocation;
+
+        static bool getLocation(llvm::LoadInst *Load, Location &L);
+        void countLoads(llvm::Module &M);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_MISSPROFILE_H */
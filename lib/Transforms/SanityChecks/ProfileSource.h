@@ -0,0 +1,36 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_PROFILESOURCE_H
+#define SANITYCHECKS_PROFILESOURCE_H
+
+#include <cstdint>
+
+namespace llvm {
+    class BranchInst;
+    class Function;
+    class Instruction;
+}
+
+namespace sanitychecks {
+
+    // A source of execution counts, from which SanityCheckCostPass computes
+    // the cost of sanity checks.
+    class ProfileSource {
+    public:
+        virtual ~ProfileSource() {}
+
+        // Returns the number of times Inst has been executed. Inst is one of
+        // the instructions that belong to the sanity check Check.
+        virtual uint64_t getCount(llvm::Instruction *Inst,
+                                  llvm::BranchInst *Check) = 0;
+
+        // Computes what getCount needs for the instructions of F, such as
+        // per-function caches. Afterwards, getCount may be called for these
+        // instructions from several threads at once.
+        virtual void prepare(llvm::Function &F) {}
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_PROFILESOURCE_H */
@@ -0,0 +1,89 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "SampleProfSource.h"
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#define DEBUG_TYPE "sanity-check-cost"
+
+using namespace llvm;
+using namespace llvm::sampleprof;
+
+namespace sanitychecks {
+
+uint64_t SampleProfSource::getCount(Instruction *Inst, BranchInst *Check) {
+    BasicBlock *BB = Inst->getParent();
+    auto Cached = BlockWeights.find(BB);
+    if (Cached != BlockWeights.end()) {
+        return Cached->second;
+    }
+
+    uint64_t Weight = 0;
+    for (Instruction &I : *BB) {
+        Weight = std::max(Weight, getInstructionWeight(&I));
+    }
+    BlockWeights[BB] = Weight;
+    return Weight;
+}
+
+void SampleProfSource::prepare(Function &F) {
+    for (BasicBlock &BB : F) {
+        getCount(&BB.front(), nullptr);
+    }
+}
+
+uint64_t SampleProfSource::getInstructionWeight(Instruction *Inst) {
+    DILocation *DIL = Inst->getDebugLoc();
+    if (!DIL) {
+        return 0;
+    }
+    // The samples of inlined code are recorded in the function that the
+    // code was inlined into, at the outermost inline site. Profiles of this
+    // format have no separate samples per inline site, so the standalone
+    // profile of the inlined function would count its other copies.
+    while (DILocation *InlinedAt = DIL->getInlinedAt()) {
+        DIL = InlinedAt;
+    }
+    DISubprogram *SP = DIL->getScope()->getSubprogram();
+    if (!SP || DIL->getLine() < SP->getLine()) {
+        return 0;
+    }
+    FunctionSamples *Samples = getSamples(SP);
+    if (!Samples) {
+        return 0;
+    }
+    return Samples->samplesAt(DIL->getLine() - SP->getLine(),
+                              DIL->getDiscriminator());
+}
+
+FunctionSamples *SampleProfSource::getSamples(DISubprogram *SP) {
+    auto Cached = SamplesBySubprogram.find(SP);
+    if (Cached != SamplesBySubprogram.end()) {
+        return Cached->second;
+    }
+
+    // Profiles are keyed by symbol names, i.e., mangled names.
+    StringRef Name = SP->getLinkageName().empty() ? SP->getName()
+                                                   : SP->getLinkageName();
+    StringMap<FunctionSamples> &Profiles = Reader->getProfiles();
+    auto Found = Profiles.find(Name);
+    FunctionSamples *Result =
+        Found != Profiles.end() ? &Found->second : nullptr;
+    DEBUG(
+        if (!Result) {
+            dbgs() << "Warning: no samples for function " << Name << "\n";
+        }
+    );
+
+    SamplesBySubprogram[SP] = Result;
+    return Result;
+}
+
+}  // namespace sanitychecks
@@ -0,0 +1,58 @@
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef SANITYCHECKS_SAMPLEPROFSOURCE_H
+#define SANITYCHECKS_SAMPLEPROFSOURCE_H
+
+#include "ProfileSource.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ProfileData/SampleProfReader.h"
+
+#include <memory>
+
+namespace llvm {
+    class BasicBlock;
+    class DISubprogram;
+}
+
+namespace sanitychecks {
+
+    // Reads execution counts from a sample profile (the text or binary
+    // formats of SampleProfReader), e.g., converted from perf data that was
+    // collected on the optimized, instrumented program.
+    //
+    // Samples are attributed to source lines relative to the start of a
+    // function, plus a discriminator. As in the SampleProfile pass, the
+    // weight of a basic block is the maximum number of samples of any of its
+    // instructions. Because samples are matched by source location rather
+    // than by block layout, the profiled binary may be optimized
+    // differently than the code being analyzed. Inlined instructions are
+    // matched at their outermost inline site, in the profile of the function
+    // that contains them.
+    class SampleProfSource : public ProfileSource {
+    public:
+        SampleProfSource(
+            std::unique_ptr<llvm::sampleprof::SampleProfileReader> Reader)
+            : Reader(std::move(Reader)) {}
+
+        uint64_t getCount(llvm::Instruction *Inst,
+                          llvm::BranchInst *Check) override;
+
+        void prepare(llvm::Function &F) override;
+
+        // Returns the number of samples at the source location of Inst.
+        uint64_t getInstructionWeight(llvm::Instruction *Inst);
+
+    private:
+        std::unique_ptr<llvm::sampleprof::SampleProfileReader> Reader;
+        llvm::DenseMap<llvm::BasicBlock *, uint64_t> BlockWeights;
+        llvm::DenseMap<llvm::DISubprogram *,
+                       llvm::sampleprof::FunctionSamples *> SamplesBySubprogram;
+
+        llvm::sampleprof::FunctionSamples *getSamples(llvm::DISubprogram *SP);
+    };
+
+}  // namespace sanitychecks
+
+#endif  /* SANITYCHECKS_SAMPLEPROFSOURCE_H */
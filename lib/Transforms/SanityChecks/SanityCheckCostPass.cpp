@@ -3,11 +3,21 @@
 
 #include "SanityCheckCostPass.h"
 #include "SanityCheckInstructionsPass.h"
+#include "CheckProfile.h"
 #include "CostModel.h"
+#include "CostTable.h"
 #include "GCOV.h"
+#include "InstrProfSource.h"
+#include "MergedProfile.h"
+#include "MissProfile.h"
+#include "SampleProfSource.h"
 #include "utils.h"
 
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
@@ -16,53 +26,143 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Transforms/SanityChecks.h"
 
 #include <algorithm>
+#include <cstdlib>
 #include <memory>
 #include <system_error>
 #define DEBUG_TYPE "sanity-check-cost"
 
 using namespace llvm;
 
+static cl::list<std::string>
+InputGCNO("gcno", cl::desc("<input gcno file>"), cl::ZeroOrMore, cl::Hidden);
+
+static cl::list<std::string>
+InputGCDA("gcda", cl::desc("<input gcda file>"), cl::ZeroOrMore, cl::Hidden);
+
+static cl::opt<std::string>
+InputGCOVList("gcov-list",
+        cl::desc("File that lists pairs of gcno and gcda files, one pair "
+                 "per line"),
+        cl::init(""), cl::Hidden);
+
+static cl::opt<std::string>
+InputCheckProfile("asap-profile",
+        cl::desc("Indexed check profile, written by programs instrumented "
+                 "with -asap-profiling"),
+        cl::init(""));
+
+static cl::opt<bool>
+UseInstrProfile("asap-instr-profile",
+        cl::desc("Use the instrprof profile that clang recorded in the IR "
+                 "with -fprofile-instr-use"),
+        cl::init(false));
+
+static cl::opt<std::string>
+InputSampleProfile("asap-sample-profile",
+        cl::desc("Sample profile (text or binary), e.g., converted from perf "
+                 "data"),
+        cl::init(""));
+
 static cl::opt<std::string>
-InputGCNO("gcno", cl::desc("<input gcno file>"), cl::init(""), cl::Hidden);
+InputWorkloads("asap-workloads",
+        cl::desc("File that lists the profiles of several workloads, one "
+                 "\"<weight> <kind> <file>\" per line. <kind> is one of "
+                 "checks, sample or gcov-list"),
+        cl::init(""));
+
+static cl::opt<sanitychecks::MergeMode>
+WorkloadMerge("asap-workload-merge",
+        cl::desc("How counts of several workloads are combined"),
+        cl::values(
+            clEnumValN(sanitychecks::MeanMerge, "mean",
+                "Weighted average over workloads (default)"),
+            clEnumValN(sanitychecks::MaxMerge, "max",
+                "Worst case over workloads, per instruction"),
+            clEnumValN(sanitychecks::PercentileMerge, "percentile",
+                "Weighted percentile over workloads, per instruction, see "
+                "-asap-workload-percentile"),
+            clEnumValEnd),
+        cl::init(sanitychecks::MeanMerge));
+
+static cl::opt<double>
+WorkloadPercentile("asap-workload-percentile",
+        cl::desc("Percentile for -asap-workload-merge=percentile"),
+        cl::init(90.0));
 
 static cl::opt<std::string>
-InputGCDA("gcda", cl::desc("<input gcda file>"), cl::init(""), cl::Hidden);
+InputCostTable("asap-cost-table",
+        cl::desc("Measured costs of check kinds, written by asap-clang "
+                 "-asap-calibrate; replaces the static cost estimate"),
+        cl::init(""));
+
+static cl::opt<std::string>
+InputMissProfile("asap-miss-profile",
+        cl::desc("Sample profile of cache misses (e.g., perf samples of load "
+                 "misses); checks whose loads miss become more expensive"),
+        cl::init(""));
+
+static cl::opt<double>
+MissCost("asap-miss-cost",
+        cl::desc("Cost of each sample in -asap-miss-profile, i.e., the miss "
+                 "penalty times the sampling period"),
+        cl::init(100.0));
 
 namespace {
     bool largerCost(const SanityCheckCostPass::CheckCost &a,
                      const SanityCheckCostPass::CheckCost &b) {
         return a.second > b.second;
     }
+
+    // The checks of one function and their costs. The per-instruction
+    // vectors list the instructions of each check in turn.
+    struct FunctionCosts {
+        std::vector<BranchInst *> Checks;
+        std::vector<uint64_t> CheckCosts;
+
+        // Target cost per execution, execution count and total cost
+        std::vector<unsigned> UnitCosts;
+        std::vector<uint64_t> Counts;
+        std::vector<uint64_t> Costs;
+    };
 }  // anonymous namespace
 
 
 bool SanityCheckCostPass::runOnModule(Module &M) {
     SanityCheckInstructionsPass &SCI = getAnalysis<SanityCheckInstructionsPass>();
     TargetTransformInfoWrapperPass &TTIWP = getAnalysis<TargetTransformInfoWrapperPass>();
-    std::unique_ptr<sanitychecks::GCOVFile> GF(createGCOVFile());
+    std::unique_ptr<sanitychecks::ProfileSource> PS(createProfileSource(M, &SCI));
+    std::unique_ptr<sanitychecks::CostTable> CT(createCostTable(M));
+    std::unique_ptr<sanitychecks::MissProfile> MP(createMissProfile(M, &SCI));
 
+    // Target costs come from TargetTransformInfo, which is not thread-safe,
+    // and the profiles fill their caches. Both happen function by function,
+    // before the counts and costs are computed in parallel.
+    std::vector<FunctionCosts> Results;
     for (Function &F: M) {
+        const SanityCheckInstructionsPass::InstructionSet &Branches =
+            SCI.getSanityCheckBranches(&F);
+        if (Branches.empty()) {
+            continue;
+        }
         DEBUG(dbgs() << "SanityCheckCostPass on " << F.getName() << "\n");
         const TargetTransformInfo &TTI = TTIWP.getTTI(F);
+        PS->prepare(F);
+        if (MP) {
+            MP->prepare(F);
+        }
 
-        for (Instruction *Inst: SCI.getSanityCheckBranches(&F)) {
+        Results.emplace_back();
+        FunctionCosts &R = Results.back();
+        for (Instruction *Inst: Branches) {
             assert(Inst->getParent()->getParent() == &F && "SCI must only contain instructions of the current function.");
             
             BranchInst *BI = dyn_cast<BranchInst>(Inst);
             assert(BI && BI->isConditional() && "SanityCheckBranches must not contain instructions that aren't conditional branches.");
+            R.Checks.push_back(BI);
 
-#ifndef NDEBUG
-            int nInstructions = 0;
-            int nFreeInstructions = 0;
-#endif
-            
-            // The cost of a check is the sum of the cost of all instructions
-            // that this check uses.
-            // TODO: If an instruction is used by multiple checks, we need an
-            // intelligent way to handle the nonlinearity.
-            uint64_t Cost = 0;
             for (Instruction *CI: SCI.getInstructionsBySanityCheck(BI)) {
                 unsigned CurrentCost = sanitychecks::getInstructionCost(CI, &TTI);
 
@@ -71,23 +171,85 @@ bool SanityCheckCostPass::runOnModule(Module &M) {
                     CurrentCost = 1;
                 }
 
+                assert(CurrentCost <= 100 && "Outlier cost value?");
+                R.UnitCosts.push_back(CurrentCost);
+            }
+        }
+    }
+
+    parallelFor(Results.size(), [&](size_t i) {
+        FunctionCosts &R = Results[i];
+        size_t Next = 0;
+        for (BranchInst *BI: R.Checks) {
+            // The cost of a check is the sum of the cost of all instructions
+            // that this check uses.
+            // If an instruction is used by multiple checks, it is counted
+            // for each of them; see MarginalSavings for a model that
+            // handles this nonlinearity.
+            SmallVector<InstructionCost, 16> Costs;
+            uint64_t MaxCount = 0;
+            for (Instruction *CI: SCI.getInstructionsBySanityCheck(BI)) {
+                uint64_t Count = PS->getCount(CI, BI);
+                Costs.push_back(std::make_pair(CI, R.UnitCosts[Next++] * Count));
+                R.Counts.push_back(Count);
+                MaxCount = std::max(MaxCount, Count);
+            }
+
+            // A measured cost applies to each execution of the check, i.e.,
+            // of its most frequent instructions. It is distributed among the
+            // instructions in proportion to their estimated costs.
+            if (CT) {
+                scaleToMeasuredCost(BI, *CT, SCI, MaxCount, MP != nullptr,
+                                    Costs);
+            }
+
+            // Loads that miss the cache cost more on top of that. The costs
+            // are in cycles by now, and exclude misses.
+            if (MP) {
+                for (InstructionCost &I : Costs) {
+                    if (LoadInst *Load = dyn_cast<LoadInst>(I.first)) {
+                        I.second += (uint64_t)(MP->getMisses(Load) * MissCost);
+                    }
+                }
+            }
+
+            uint64_t Cost = 0;
+            for (const InstructionCost &I : Costs) {
+                R.Costs.push_back(I.second);
+                Cost += I.second;
+            }
+            R.CheckCosts.push_back(Cost);
+        }
+    });
+
+    // Results are merged in the order of the sequential computation.
+    for (FunctionCosts &R: Results) {
+        size_t Next = 0;
+        for (size_t c = 0, e = R.Checks.size(); c != e; ++c) {
+            BranchInst *BI = R.Checks[c];
+            uint64_t Cost = R.CheckCosts[c];
+
+#ifndef NDEBUG
+            int nInstructions = 0;
+            int nFreeInstructions = 0;
+#endif
+            for (Instruction *CI: SCI.getInstructionsBySanityCheck(BI)) {
                 DEBUG(
-                    if (CurrentCost == 0) {
+                    nInstructions += 1;
+                    if (R.UnitCosts[Next] == 0) {
                         nFreeInstructions += 1;
                     }
                 );
-
-                assert(CurrentCost <= 100 && "Outlier cost value?");
-
-                Cost += CurrentCost * GF->getCount(CI);
-                DEBUG(nInstructions += 1);
+                InstructionCounts[CI] = R.Counts[Next];
+                InstructionCosts[CI] = R.Costs[Next];
+                ++Next;
             }
 
             APInt CountInt = APInt(64, Cost);
             MDNode *MD = MDNode::get(M.getContext(),
                 {ConstantAsMetadata::get(ConstantInt::get(
                     Type::getInt64Ty(M.getContext()), CountInt))});
-            Inst->setMetadata("cost", MD);
+            BI->setMetadata("cost", MD);
             CheckCosts.push_back(std::make_pair(BI, Cost));
 
             DEBUG(
@@ -97,7 +259,7 @@ bool SanityCheckCostPass::runOnModule(Module &M) {
                 printDebugLoc(DL, M.getContext(), dbgs());
                 dbgs() << "\nnInstructions: " << nInstructions << "\n";
                 dbgs() << "nFreeInstructions: " << nFreeInstructions << "\n";
-                dbgs() << "Count: " << GF->getCount(BI) << "\n";
+                dbgs() << "Count: " << PS->getCount(BI, BI) << "\n";
                 dbgs() << "Cost: " << Cost << "\n";
             );
         }
@@ -111,6 +273,9 @@ bool SanityCheckCostPass::runOnModule(Module &M) {
 void SanityCheckCostPass::getAnalysisUsage(AnalysisUsage& AU) const {
     AU.addRequired<TargetTransformInfoWrapperPass>();
     AU.addRequired<SanityCheckInstructionsPass>();
+    if (UseInstrProfile) {
+        AU.addRequired<BlockFrequencyInfo>();
+    }
     AU.setPreservesAll();
 }
 
@@ -126,38 +291,333 @@ void SanityCheckCostPass::print(raw_ostream &O, const Module *M) const {
     }
 }
 
-sanitychecks::GCOVFile *SanityCheckCostPass::createGCOVFile() {
-    sanitychecks::GCOVFile *GF = new sanitychecks::GCOVFile;
+void SanityCheckCostPass::printBinary(raw_ostream &O) const {
+    uint64_t Header[] = {SanityCheckCostsMagic, SanityCheckCostsVersion,
+                         CheckCosts.size()};
+    O.write(reinterpret_cast<const char *>(Header), sizeof(Header));
+    for (const CheckCost &I : CheckCosts) {
+        O.write(reinterpret_cast<const char *>(&I.second), sizeof(I.second));
+    }
+}
+
+sanitychecks::CostTable *SanityCheckCostPass::createCostTable(Module &M) {
+    if (InputCostTable.empty()) {
+        return nullptr;
+    }
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buff =
+        MemoryBuffer::getFile(InputCostTable);
+    if (std::error_code EC = Buff.getError()) {
+        report_fatal_error(InputCostTable + ":" + EC.message());
+    }
+    std::unique_ptr<sanitychecks::CostTable> CT(new sanitychecks::CostTable);
+    if (!CT->read(Buff.get()->getBuffer())) {
+        report_fatal_error(InputCostTable + ": Invalid cost table!");
+    }
+
+    // Costs measured on one architecture say little about another one.
+    Triple TT(M.getTargetTriple());
+    StringRef Arch = TT.getArchName();
+    if (!CT->getTarget().empty() && !Arch.empty() && CT->getTarget() != Arch) {
+        report_fatal_error(InputCostTable + ": Cost table is for " +
+                           CT->getTarget() + ", but the module is for " +
+                           Arch);
+    }
 
-    if (InputGCNO.empty()) {
-        report_fatal_error("Need to specify --gcno!");
+    // Without it, estimated and measured costs would be mixed.
+    if (CT->getUnitCost() < 0) {
+        report_fatal_error(InputCostTable + ": Cost table has no unit cost, "
+                           "please calibrate again!");
+    }
+    if (!InputMissProfile.empty() && !CT->hasCachedCosts()) {
+        report_fatal_error(InputCostTable + ": Cost table has no costs of "
+                           "cached checks, please calibrate again!");
     }
+    return CT.release();
+}
+
+sanitychecks::MissProfile *SanityCheckCostPass::createMissProfile(
+        Module &M, SanityCheckInstructionsPass *SCI) {
+    if (InputMissProfile.empty()) {
+        return nullptr;
+    }
+    // The miss cost is in cycles, and the calibrated costs must not include
+    // misses already.
+    if (InputCostTable.empty()) {
+        report_fatal_error("-asap-miss-profile requires -asap-cost-table, "
+                           "whose costs are in cycles");
+    }
+    std::unique_ptr<sanitychecks::SampleProfSource> Samples(
+        static_cast<sanitychecks::SampleProfSource *>(
+            createProfileSource("sample", InputMissProfile, M, SCI)));
+    return new sanitychecks::MissProfile(std::move(Samples));
+}
+
+void SanityCheckCostPass::scaleToMeasuredCost(BranchInst *BI,
+        const sanitychecks::CostTable &CT, SanityCheckInstructionsPass &SCI,
+        uint64_t MaxCount, bool Cached,
+        SmallVectorImpl<InstructionCost> &Costs) {
+    unsigned int RegularBranch = getRegularBranch(BI, &SCI);
+    BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+    const CallInst *CI = SCI.findSanityCheckCall(Succ);
+    double MeasuredCost = -1.0;
+    if (CI && CI->getCalledFunction()) {
+        StringRef Name = CI->getCalledFunction()->getName();
+        MeasuredCost = Cached ? CT.getCachedCost(Name) : CT.getCost(Name);
+    }
+    uint64_t EstimatedCost = 0;
+    for (const InstructionCost &I : Costs) {
+        EstimatedCost += I.second;
+    }
+    if (EstimatedCost == 0) {
+        return;
+    }
+
+    double Scale = MeasuredCost < 0 ? CT.getUnitCost()
+                                    : MeasuredCost * MaxCount / EstimatedCost;
+    for (InstructionCost &I : Costs) {
+        I.second = (uint64_t)(I.second * Scale + 0.5);
+    }
+}
+
+sanitychecks::GCOVFile *SanityCheckCostPass::createGCOVFile(
+        StringRef GCNOName, StringRef GCDAName) {
+    std::unique_ptr<sanitychecks::GCOVFile> GF(new sanitychecks::GCOVFile);
+
     ErrorOr<std::unique_ptr<MemoryBuffer>> GCNO_Buff =
-        MemoryBuffer::getFileOrSTDIN(InputGCNO);
+        MemoryBuffer::getFileOrSTDIN(GCNOName);
     if (std::error_code EC = GCNO_Buff.getError()) {
-        report_fatal_error(InputGCNO + ":" + EC.message());
+        report_fatal_error(GCNOName + ":" + EC.message());
     }
     sanitychecks::GCOVBuffer GCNO_GB(GCNO_Buff.get().get());
     if (!GF->readGCNO(GCNO_GB)) {
-        report_fatal_error(InputGCNO + ": Invalid .gcno file!");
+        report_fatal_error(GCNOName + ": Invalid .gcno file!");
     }
 
-    if (InputGCDA.empty()) {
-        report_fatal_error("Need to specify --gcda!");
-    }
     ErrorOr<std::unique_ptr<MemoryBuffer>> GCDA_Buff =
-        MemoryBuffer::getFileOrSTDIN(InputGCDA);
+        MemoryBuffer::getFileOrSTDIN(GCDAName);
     if (std::error_code EC = GCDA_Buff.getError()) {
-        report_fatal_error(InputGCDA + ":" + EC.message());
+        report_fatal_error(GCDAName + ":" + EC.message());
     }
     sanitychecks::GCOVBuffer GCDA_GB(GCDA_Buff.get().get());
     if (!GF->readGCDA(GCDA_GB)) {
-        report_fatal_error(InputGCDA + ": Invalid .gcda file!");
+        report_fatal_error(GCDAName + ": Invalid .gcda file!");
+    }
+
+    return GF.release();
+}
+
+sanitychecks::ProfileSource *SanityCheckCostPass::createProfileSource(
+        Module &M, SanityCheckInstructionsPass *SCI) {
+    if (!GCNOName.empty()) {
+        std::unique_ptr<sanitychecks::GCOVFileSet> GFS(
+            new sanitychecks::GCOVFileSet);
+        GFS->addFile(std::unique_ptr<sanitychecks::GCOVFile>(
+            createGCOVFile(GCNOName, GCDAName)));
+        return GFS.release();
+    }
+    if (!InputCheckProfile.empty() + UseInstrProfile +
+            !InputSampleProfile.empty() + !InputWorkloads.empty() > 1) {
+        report_fatal_error("Use at most one of -asap-profile, "
+                           "-asap-instr-profile, -asap-sample-profile and "
+                           "-asap-workloads!");
+    }
+    if (!InputWorkloads.empty()) {
+        return createMergedProfile(M, SCI);
+    }
+    if (!InputSampleProfile.empty()) {
+        return createProfileSource("sample", InputSampleProfile, M, SCI);
+    }
+    if (UseInstrProfile) {
+        // Each function's frequencies are used right away by prepare().
+        return new sanitychecks::InstrProfSource(
+            [this](Function &F) -> BlockFrequencyInfo & {
+                return getAnalysis<BlockFrequencyInfo>(F);
+            });
+    }
+    if (!InputCheckProfile.empty()) {
+        return createProfileSource("checks", InputCheckProfile, M, SCI);
+    }
+    return createGCOVFileSet();
+}
+
+sanitychecks::ProfileSource *SanityCheckCostPass::createProfileSource(
+        StringRef Kind, StringRef FileName, Module &M,
+        SanityCheckInstructionsPass *SCI) {
+    if (Kind == "gcov-list") {
+        std::unique_ptr<sanitychecks::GCOVFileSet> GFS(
+            new sanitychecks::GCOVFileSet);
+        if (addGCOVList(GFS.get(), FileName) == 0) {
+            report_fatal_error(FileName + ": No GCOV files listed!");
+        }
+        return GFS.release();
+    }
+
+    if (Kind == "sample") {
+        ErrorOr<std::unique_ptr<sampleprof::SampleProfileReader>> Reader =
+            sampleprof::SampleProfileReader::create(FileName, M.getContext());
+        if (std::error_code EC = Reader.getError()) {
+            report_fatal_error(FileName + ":" + EC.message());
+        }
+        if (std::error_code EC = Reader.get()->read()) {
+            report_fatal_error(FileName + ":" + EC.message());
+        }
+        return new sanitychecks::SampleProfSource(std::move(Reader.get()));
+    }
+
+    if (Kind == "checks") {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Buff =
+            MemoryBuffer::getFile(FileName, -1,
+                                  /*RequiresNullTerminator=*/false);
+        if (std::error_code EC = Buff.getError()) {
+            report_fatal_error(FileName + ":" + EC.message());
+        }
+        std::unique_ptr<sanitychecks::CheckProfile> CP(
+            new sanitychecks::CheckProfile(SCI));
+        if (!CP->read(std::move(Buff.get()))) {
+            report_fatal_error(FileName + ": Invalid check profile!");
+        }
+        return CP.release();
     }
 
-    return GF;
+    report_fatal_error("Unknown profile kind: " + Kind);
 }
 
+sanitychecks::ProfileSource *SanityCheckCostPass::createMergedProfile(
+        Module &M, SanityCheckInstructionsPass *SCI) {
+    if (WorkloadMerge == sanitychecks::PercentileMerge &&
+            (WorkloadPercentile <= 0 || WorkloadPercentile > 100)) {
+        report_fatal_error("-asap-workload-percentile must be in (0, 100]");
+    }
+    std::unique_ptr<sanitychecks::MergedProfile> MP(
+        new sanitychecks::MergedProfile(WorkloadMerge, WorkloadPercentile));
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> ListBuff =
+        MemoryBuffer::getFileOrSTDIN(InputWorkloads);
+    if (std::error_code EC = ListBuff.getError()) {
+        report_fatal_error(InputWorkloads + ":" + EC.message());
+    }
+    SmallVector<StringRef, 16> Lines;
+    ListBuff.get()->getBuffer().split(Lines, "\n", -1, false);
+    for (StringRef Line : Lines) {
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#")) {
+            continue;
+        }
+
+        // Each line is "<weight> <kind> <file>"
+        std::pair<StringRef, StringRef> WeightAndRest = Line.split(' ');
+        std::pair<StringRef, StringRef> KindAndFile =
+            WeightAndRest.second.trim().split(' ');
+        StringRef FileName = KindAndFile.second.trim();
+        std::string WeightString = WeightAndRest.first.str();
+        char *WeightEnd;
+        double Weight = strtod(WeightString.c_str(), &WeightEnd);
+        if (WeightString.empty() || *WeightEnd != '\0' || Weight < 0 ||
+                FileName.empty()) {
+            report_fatal_error(InputWorkloads + ": Invalid line: " + Line);
+        }
+        MP->addWorkload(std::unique_ptr<sanitychecks::ProfileSource>(
+            createProfileSource(KindAndFile.first, FileName, M, SCI)),
+            Weight);
+    }
+
+    if (MP->getNumWorkloads() == 0) {
+        report_fatal_error(InputWorkloads + ": No workloads listed!");
+    }
+    return MP.release();
+}
+
+sanitychecks::GCOVFileSet *SanityCheckCostPass::createGCOVFileSet() {
+    std::unique_ptr<sanitychecks::GCOVFileSet> GFS(
+        new sanitychecks::GCOVFileSet);
+
+    if (InputGCNO.size() != InputGCDA.size()) {
+        report_fatal_error("Need to specify as many --gcda as --gcno files!");
+    }
+    for (size_t i = 0, e = InputGCNO.size(); i != e; ++i) {
+        GFS->addFile(std::unique_ptr<sanitychecks::GCOVFile>(
+            createGCOVFile(InputGCNO[i], InputGCDA[i])));
+    }
+
+    // When running on a whole program, there are too many files for the
+    // command line; these are passed in a list file instead.
+    size_t NFiles = InputGCNO.size();
+    if (!InputGCOVList.empty()) {
+        NFiles += addGCOVList(GFS.get(), InputGCOVList);
+    }
+
+    if (NFiles == 0) {
+        report_fatal_error("Need to specify --gcno and --gcda, or --gcov-list!");
+    }
+
+    return GFS.release();
+}
+
+size_t SanityCheckCostPass::addGCOVList(sanitychecks::GCOVFileSet *GFS,
+                                        StringRef ListName) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> ListBuff =
+        MemoryBuffer::getFileOrSTDIN(ListName);
+    if (std::error_code EC = ListBuff.getError()) {
+        report_fatal_error(ListName + ":" + EC.message());
+    }
+    size_t NFiles = 0;
+    SmallVector<StringRef, 64> Lines;
+    ListBuff.get()->getBuffer().split(Lines, "\n", -1, false);
+    for (StringRef Line : Lines) {
+        Line = Line.trim();
+        if (Line.empty()) {
+            continue;
+        }
+        std::pair<StringRef, StringRef> Names = Line.split(' ');
+        if (Names.second.empty()) {
+            report_fatal_error(ListName + ": Invalid line: " + Line);
+        }
+        GFS->addFile(std::unique_ptr<sanitychecks::GCOVFile>(
+            createGCOVFile(Names.first, Names.second.trim())));
+        NFiles += 1;
+    }
+    return NFiles;
+}
+
+namespace {
+    // Prints the costs of sanity checks, for tools that cannot use
+    // opt -analyze.
+    struct SanityCheckCostPrinter : public ModulePass {
+        static char ID;
+        raw_ostream &OS;
+        bool Binary;
+
+        SanityCheckCostPrinter(raw_ostream &OS, bool Binary)
+            : ModulePass(ID), OS(OS), Binary(Binary) {}
+
+        virtual bool runOnModule(Module &M) {
+            if (Binary) {
+                getAnalysis<SanityCheckCostPass>().printBinary(OS);
+            } else {
+                getAnalysis<SanityCheckCostPass>().print(OS, &M);
+            }
+            return false;
+        }
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+            AU.addRequired<SanityCheckCostPass>();
+            AU.setPreservesAll();
+        }
+    };
+}  // anonymous namespace
+
+char SanityCheckCostPrinter::ID = 0;
+
 char SanityCheckCostPass::ID = 0;
 static RegisterPass<SanityCheckCostPass> X("sanity-check-cost",
         "Finds costs of sanity checks", false, false);
+
+ModulePass *llvm::createSanityCheckCostPass(StringRef GCNOName,
+                                            StringRef GCDAName) {
+    return new SanityCheckCostPass(GCNOName, GCDAName);
+}
+
+ModulePass *llvm::createSanityCheckCostPrinterPass(raw_ostream &OS,
+                                                   bool Binary) {
+    return new SanityCheckCostPrinter(OS, Binary);
+}
@@ -1,31 +1,50 @@
 // This file is part of ASAP.
 // Please see LICENSE.txt for copyright and licensing information.
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Pass.h"
 
+#include <string>
 #include <utility>
 #include <vector>
 
 namespace sanitychecks {
+    class CostTable;
     class GCOVFile;
+    class GCOVFileSet;
+    class MissProfile;
+    class ProfileSource;
 }
 
 namespace llvm {
     class BranchInst;
+    class Instruction;
     class raw_ostream;
 }
 
+struct SanityCheckInstructionsPass;
+
 struct SanityCheckCostPass : public llvm::ModulePass {
     static char ID;
 
     SanityCheckCostPass() : ModulePass(ID) {}
 
+    // Uses the given coverage files, rather than the profile options on the
+    // command line. This allows a single process to handle many objects.
+    SanityCheckCostPass(llvm::StringRef GCNOName, llvm::StringRef GCDAName)
+        : ModulePass(ID), GCNOName(GCNOName), GCDAName(GCDAName) {}
+
     virtual bool runOnModule(llvm::Module &M);
 
     virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
     
     virtual void print(llvm::raw_ostream &O, const llvm::Module *M) const;
 
+    // Writes the costs in the binary costs format (see SanityChecks.h).
+    void printBinary(llvm::raw_ostream &O) const;
+
     // A pair that stores a sanity check and its cost.
     typedef std::pair<llvm::BranchInst *, uint64_t> CheckCost;
     
@@ -33,9 +52,62 @@ struct SanityCheckCostPass : public llvm::ModulePass {
         return CheckCosts;
     };
 
+    // Returns the cost of a single instruction that belongs to a sanity
+    // check, i.e., its execution count times its cost per execution.
+    uint64_t getInstructionCost(llvm::Instruction *Inst) const {
+        return InstructionCosts.lookup(Inst);
+    }
+
+    // Returns how often an instruction that belongs to a sanity check is
+    // executed.
+    uint64_t getInstructionCount(llvm::Instruction *Inst) const {
+        return InstructionCounts.lookup(Inst);
+    }
+
 private:
 
+    std::string GCNOName;
+    std::string GCDAName;
+
     std::vector<CheckCost> CheckCosts;
+
+    // The cost of every instruction that belongs to some sanity check. If an
+    // instruction is used by multiple checks, its cost is part of the cost of
+    // each of them.
+    llvm::DenseMap<llvm::Instruction *, uint64_t> InstructionCosts;
+    llvm::DenseMap<llvm::Instruction *, uint64_t> InstructionCounts;
     
-    sanitychecks::GCOVFile *createGCOVFile();
+    // Reads the table given with -asap-cost-table, if any.
+    sanitychecks::CostTable *createCostTable(llvm::Module &M);
+
+    // Reads the profile given with -asap-miss-profile, if any.
+    sanitychecks::MissProfile *createMissProfile(
+        llvm::Module &M, SanityCheckInstructionsPass *SCI);
+
+    // Scales the estimated costs of a check's instructions, so that they add
+    // up to the measured cost per execution times MaxCount. If the table does
+    // not know the check, converts the estimates to cycles instead. With
+    // Cached, uses the cost of the check when its accesses hit the cache.
+    typedef std::pair<llvm::Instruction *, uint64_t> InstructionCost;
+    void scaleToMeasuredCost(llvm::BranchInst *BI,
+        const sanitychecks::CostTable &CT, SanityCheckInstructionsPass &SCI,
+        uint64_t MaxCount, bool Cached,
+        llvm::SmallVectorImpl<InstructionCost> &Costs);
+
+    sanitychecks::GCOVFile *createGCOVFile(llvm::StringRef GCNOName,
+                                           llvm::StringRef GCDAName);
+    sanitychecks::GCOVFileSet *createGCOVFileSet();
+    size_t addGCOVList(sanitychecks::GCOVFileSet *GFS,
+                       llvm::StringRef ListName);
+
+    // Creates the profile given on the command line.
+    sanitychecks::ProfileSource *createProfileSource(
+        llvm::Module &M, SanityCheckInstructionsPass *SCI);
+    // Creates a profile of the given kind (checks, sample or gcov-list)
+    // from a file.
+    sanitychecks::ProfileSource *createProfileSource(
+        llvm::StringRef Kind, llvm::StringRef FileName, llvm::Module &M,
+        SanityCheckInstructionsPass *SCI);
+    sanitychecks::ProfileSource *createMergedProfile(
+        llvm::Module &M, SanityCheckInstructionsPass *SCI);
 };
@@ -2,136 +2,374 @@
 // Please see LICENSE.txt for copyright and licensing information.
 
 #include "SanityCheckInstructionsPass.h"
+#include "CheckElimination.h"
 #include "utils.h"
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Pass.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <algorithm>
+#include <vector>
+
 #define DEBUG_TYPE "sanity-check-instructions"
 
 using namespace llvm;
 
+static cl::opt<bool>
+RemoveSafeChecks("asap-remove-safe-checks",
+        cl::desc("Remove checks that provably never fail, before their "
+                 "costs are computed"),
+        cl::init(false));
+
+SanityCheckInstructionsPass::SanityCheckInstructionsPass() : ModulePass(ID) {
+    // Needed for -asap-remove-safe-checks
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeLazyValueInfoPass(Registry);
+    initializeScalarEvolutionPass(Registry);
+    initializeTargetLibraryInfoWrapperPassPass(Registry);
+}
+
+void SanityCheckInstructionsPass::getAnalysisUsage(AnalysisUsage &AU) const {
+    if (RemoveSafeChecks) {
+        AU.addRequired<LazyValueInfo>();
+        AU.addRequired<ScalarEvolution>();
+        AU.addRequired<TargetLibraryInfoWrapperPass>();
+    }
+    AU.setPreservesAll();
+}
+
 bool SanityCheckInstructionsPass::runOnModule(Module &M) {
+    // Functions are analyzed in parallel, each into its own buffer. The
+    // results are merged in order, because safe checks are removed and
+    // metadata is attached through the (single-threaded) LLVMContext.
+    std::vector<Function*> Functions;
     for (Function &F: M) {
-        DEBUG(dbgs() << "SanityCheckInstructionsPass on " << F.getName() << "\n");
-        SanityCheckBlocks[&F] = BlockSet();
-        SanityCheckInstructions[&F] = InstructionSet();
-        SanityCheckBranches[&F] = InstructionSet();
-        findInstructions(&F);
-
-        MDNode *MD = MDNode::get(M.getContext(), {});
-        for (Instruction *Inst: SanityCheckInstructions[&F]) {
+        Functions.push_back(&F);
+    }
+    std::vector<FunctionChecks> Results(Functions.size());
+    parallelFor(Functions.size(), [&](size_t i) {
+        findInstructions(Functions[i], Results[i]);
+    });
+
+    size_t NSafeChecks = 0;
+    GlobalSet DynInitGlobals;
+    if (RemoveSafeChecks) {
+        getDynamicallyInitializedGlobals(M, DynInitGlobals);
+    }
+    MDNode *MD = MDNode::get(M.getContext(), {});
+    for (size_t i = 0, e = Functions.size(); i != e; ++i) {
+        Function &F = *Functions[i];
+        FunctionChecks &Checks = Results[i];
+        DEBUG(dbgs() << "SanityCheckInstructionsPass on " << F.getName()
+                     << ": " << Checks.Branches.size() << " checks\n");
+        size_t FirstCheckInstruction = CheckInstructions.size();
+        addChecks(&F, Checks);
+
+        // Removed checks are no longer checks, and their conditions are
+        // gone; the remaining checks are found anew.
+        if (RemoveSafeChecks && !Checks.Branches.empty()) {
+            size_t N = removeSafeChecks(F, DynInitGlobals);
+            if (N > 0) {
+                for (Instruction *BI: Checks.Branches) {
+                    InstructionsBySanityCheck.erase(BI);
+                }
+                CheckInstructions.resize(FirstCheckInstruction);
+                Checks = FunctionChecks();
+                findInstructions(&F, Checks);
+                addChecks(&F, Checks);
+                NSafeChecks += N;
+            }
+        }
+
+        for (Instruction *Inst: Checks.SanityCheckInstructions) {
             Inst->setMetadata("sanitycheck", MD);
         }
+        Checks = FunctionChecks();
     }
     
+    if (RemoveSafeChecks) {
+        dbgs() << "Removed " << NSafeChecks << " provably safe checks\n";
+    }
     return false;
 }
 
-void SanityCheckInstructionsPass::findInstructions(Function *F) {
+void SanityCheckInstructionsPass::addChecks(Function *F,
+                                            const FunctionChecks &Checks) {
+    BlockSet &Blocks = SanityCheckBlocks[F];
+    Blocks.clear();
+    Blocks.insert(Checks.Blocks.begin(), Checks.Blocks.end());
 
-    // A list of instructions that are used by sanity checks. They become sanity
-    // check instructions if it turns out they're not used by anything else.
-    SmallPtrSet<Instruction*, 128> Worklist;
-    
-    // A list of basic blocks that contain sanity check instructions. They
-    // become sanity check blocks if it turns out they don't contain anything
-    // else.
-    SmallPtrSet<BasicBlock*, 64>   BlockWorklist;
-    
-    // A map from instructions to the checks that use them.
-    std::map<Instruction*, SmallPtrSet<Instruction*, 4> > ChecksByInstruction;
+    InstructionSet &Branches = SanityCheckBranches[F];
+    Branches.clear();
+    Branches.insert(Checks.Branches.begin(), Checks.Branches.end());
+
+    unsigned Offset = CheckInstructions.size();
+    for (size_t c = 0, e = Checks.Branches.size(); c != e; ++c) {
+        InstructionsBySanityCheck[Checks.Branches[c]] =
+            std::make_pair(Offset + Checks.Begin[c],
+                           Checks.Begin[c + 1] - Checks.Begin[c]);
+    }
+    CheckInstructions.insert(CheckInstructions.end(),
+                             Checks.Instructions.begin(),
+                             Checks.Instructions.end());
+}
+
+void SanityCheckInstructionsPass::print(raw_ostream &O, const Module *M) const {
+    for (const Function &F: *M) {
+        auto Branches = SanityCheckBranches.find(const_cast<Function*>(&F));
+        if (Branches == SanityCheckBranches.end() ||
+                Branches->second.empty()) {
+            continue;
+        }
+        DenseMap<const Instruction*, unsigned> Position;
+        unsigned N = 0;
+        for (const BasicBlock &BB: F) {
+            for (const Instruction &I: BB) {
+                Position[&I] = N++;
+            }
+        }
+
+        O << "Function " << F.getName() << ": " << Branches->second.size()
+          << " sanity checks\n";
+        for (const BasicBlock &BB: F) {
+            Instruction *BI =
+                const_cast<TerminatorInst*>(BB.getTerminator());
+            if (!BI || !Branches->second.count(BI)) {
+                continue;
+            }
+            O << "  Check " << Position.lookup(BI) << ":";
+            for (Instruction *I: getInstructionsBySanityCheck(BI)) {
+                O << ' ' << Position.lookup(I);
+            }
+            O << '\n';
+        }
+    }
+}
+
+// Makes the checks that cannot fail always take their regular branch. The CFG
+// stays the same, so that it still matches the profiling data.
+size_t SanityCheckInstructionsPass::removeSafeChecks(
+        Function &F, const GlobalSet &DynInitGlobals) {
+    sanitychecks::CheckElimination CE(
+        *this, F.getParent()->getDataLayout(),
+        &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(),
+        getAnalysis<ScalarEvolution>(F), getAnalysis<LazyValueInfo>(F),
+        DynInitGlobals);
+
+    SmallVector<BranchInst *, 16> SafeChecks;
+    for (Instruction *Inst: SanityCheckBranches[&F]) {
+        BranchInst *BI = cast<BranchInst>(Inst);
+        if (CE.isSafe(BI)) {
+            SafeChecks.push_back(BI);
+        }
+    }
+
+    for (BranchInst *BI: SafeChecks) {
+        DEBUG(dbgs() << "Removing safe check: " << *BI << "\n");
+        unsigned int RegularBranch = getRegularBranch(BI, this);
+        Value *Cond = BI->getCondition();
+        BI->setCondition(ConstantInt::get(Type::getInt1Ty(F.getContext()),
+                                          RegularBranch == 0));
+        RecursivelyDeleteTriviallyDeadInstructions(Cond);
+    }
+    return SafeChecks.size();
+}
+
+// Returns true if BI has a constant condition that never leads to Succ. This
+// is how removed checks look; TSan's guards, in contrast, always lead to their
+// callback.
+static bool neverTakes(BranchInst *BI, BasicBlock *Succ) {
+    ConstantInt *C = dyn_cast<ConstantInt>(BI->getCondition());
+    return C && BI->getSuccessor(C->isZero() ? 1 : 0) != Succ;
+}
+
+// An instruction belongs to sanity checks if it is used by sanity checks and
+// by nothing else. Instructions are numbered densely, and each one counts its
+// users that are not (yet) known to belong to sanity checks; each block
+// counts such instructions. An instruction is added once it has been reached
+// from a check and its count drops to zero, so that every use and every
+// block is visited a constant number of times.
+void SanityCheckInstructionsPass::findInstructions(Function *F,
+        FunctionChecks &Result) const {
+    // Number blocks and instructions
+    DenseMap<Instruction*, unsigned> InstIndex;
+    std::vector<Instruction*> Insts;
+    std::vector<unsigned> BlockOf;
+    std::vector<unsigned> BlockRemaining;
+    for (BasicBlock &BB: *F) {
+        unsigned B = BlockRemaining.size();
+        BlockRemaining.push_back(0);
+        for (Instruction &I: BB) {
+            InstIndex[&I] = Insts.size();
+            Insts.push_back(&I);
+            BlockOf.push_back(B);
+            ++BlockRemaining[B];
+        }
+    }
+
+    // Users not known to belong to sanity checks. Users that are not
+    // instructions are never decremented.
+    std::vector<unsigned> RemainingUses(Insts.size());
+    for (unsigned i = 0, e = Insts.size(); i != e; ++i) {
+        RemainingUses[i] = Insts[i]->getNumUses();
+    }
+
+    // Instructions that are used by sanity checks. They become sanity check
+    // instructions once they're not used by anything else.
+    BitVector IsCandidate(Insts.size());
+    BitVector IsCheckInstruction(Insts.size());
+    SmallVector<unsigned, 128> Worklist;
+    auto AddCandidate = [&](Instruction *Inst) {
+        unsigned i = InstIndex.lookup(Inst);
+        if (!IsCandidate[i]) {
+            IsCandidate.set(i);
+            if (RemainingUses[i] == 0) {
+                Worklist.push_back(i);
+            }
+        }
+    };
+
+    // The blocks of guarded TSan callbacks, whose instructions count towards
+    // their checks, by the number of the check in Result.Branches
+    DenseMap<BranchInst*, unsigned> CheckIndex;
+    SmallVector<std::pair<unsigned, BasicBlock*>, 16> GuardedBlocks;
 
     for (BasicBlock &BB: *F) {
-        if (findSanityCheckCall(&BB)) {
-            SanityCheckBlocks[F].insert(&BB);
+        if (const CallInst *SanityCheckCall = findSanityCheckCall(&BB)) {
+            Result.Blocks.push_back(&BB);
 
             // All instructions inside sanity check blocks are sanity check instructions
             for (Instruction &I: BB) {
-                Worklist.insert(&I);
+                AddCandidate(&I);
             }
 
-            // All branches to sanity check blocks are sanity check branches
+            // All branches to sanity check blocks are sanity check branches,
+            // except those that have been removed because they cannot fail
             for (User *U: BB.users()) {
                 if (Instruction *Inst = dyn_cast<Instruction>(U)) {
-                    Worklist.insert(Inst);
+                    AddCandidate(Inst);
                 }
                 BranchInst *BI = dyn_cast<BranchInst>(U);
-                if (BI && BI->isConditional()) {
-                    SanityCheckBranches[F].insert(BI);
-                    ChecksByInstruction[BI].insert(BI);
+                if (BI && BI->isConditional() && !neverTakes(BI, &BB)) {
+                    if (CheckIndex.insert(std::make_pair(
+                            BI, Result.Branches.size())).second) {
+                        Result.Branches.push_back(BI);
+                    }
+
+                    // Unlike error reports, guarded TSan callbacks run
+                    // whenever the check does, and count towards its cost.
+                    if (isGuardedTsanCall(SanityCheckCall)) {
+                        GuardedBlocks.push_back(
+                            std::make_pair(CheckIndex[BI], &BB));
+                    }
                 }
             }
         }
     }
 
     while (!Worklist.empty()) {
-        // Alternate between emptying the worklist...
-        while (!Worklist.empty()) {
-            Instruction *Inst = *Worklist.begin();
-            Worklist.erase(Inst);
-            if (onlyUsedInSanityChecks(Inst)) {
-                if (SanityCheckInstructions[F].insert(Inst).second) {
-                    for (Use &U: Inst->operands()) {
-                        if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
-                            Worklist.insert(Op);
-                            
-                            // Copy ChecksByInstruction from Inst to Op
-                            auto CBI = ChecksByInstruction.find(Inst);
-                            if (CBI != ChecksByInstruction.end()) {
-                                ChecksByInstruction[Op].insert(CBI->second.begin(), CBI->second.end());
-                            }
-                        }
-                    }
+        unsigned i = Worklist.pop_back_val();
+        Instruction *Inst = Insts[i];
+        IsCheckInstruction.set(i);
 
-                    BlockWorklist.insert(Inst->getParent());
-
-                    // Fill InstructionsBySanityCheck from the inverse ChecksByInstruction
-                    auto CBI = ChecksByInstruction.find(Inst);
-                    if (CBI != ChecksByInstruction.end()) {
-                        for (Instruction *CI : CBI->second) {
-                            InstructionsBySanityCheck[CI].insert(Inst);
-                        }
-                    }
+        for (Use &U: Inst->operands()) {
+            if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+                unsigned j = InstIndex.lookup(Op);
+                IsCandidate.set(j);
+                if (--RemainingUses[j] == 0) {
+                    Worklist.push_back(j);
                 }
             }
         }
 
-        // ... and checking whether this causes basic blocks to contain only
-        // sanity checks. This would in turn cause terminators to be added to
-        // the worklist.
-        while (!BlockWorklist.empty()) {
-            BasicBlock *BB = *BlockWorklist.begin();
-            BlockWorklist.erase(BB);
-            
-            bool allInstructionsAreSanityChecks = true;
-            for (Instruction &I: *BB) {
-                if (!SanityCheckInstructions.at(BB->getParent()).count(&I)) {
-                    allInstructionsAreSanityChecks = false;
-                    break;
+        // Blocks that contain only sanity checks cause their terminators
+        // to be added to the worklist.
+        if (--BlockRemaining[BlockOf[i]] == 0) {
+            for (User *U: Inst->getParent()->users()) {
+                if (Instruction *UI = dyn_cast<Instruction>(U)) {
+                    AddCandidate(UI);
                 }
             }
-            
-            if (allInstructionsAreSanityChecks) {
-                for (User *U: BB->users()) {
-                    if (Instruction *Inst = dyn_cast<Instruction>(U)) {
-                        Worklist.insert(Inst);
-                    }
+        }
+    }
+
+    for (int i = IsCheckInstruction.find_first(); i != -1;
+            i = IsCheckInstruction.find_next(i)) {
+        Result.SanityCheckInstructions.push_back(Insts[i]);
+    }
+
+    // The instructions of a check are the sanity check instructions that it
+    // reaches through operands of sanity check instructions. Visited is
+    // stamped with the number of the current check, so that it never needs
+    // to be cleared.
+    std::vector<unsigned> Visited(Insts.size(), 0);
+    SmallVector<unsigned, 64> Stack;
+    SmallVector<unsigned, 64> Found;
+    auto Visit = [&](Instruction *Inst, unsigned Stamp) {
+        unsigned i = InstIndex.lookup(Inst);
+        if (IsCheckInstruction[i] && Visited[i] != Stamp) {
+            Visited[i] = Stamp;
+            Stack.push_back(i);
+            Found.push_back(i);
+        }
+    };
+
+    std::stable_sort(GuardedBlocks.begin(), GuardedBlocks.end(),
+            [](const std::pair<unsigned, BasicBlock*> &a,
+               const std::pair<unsigned, BasicBlock*> &b) {
+                return a.first < b.first;
+            });
+    auto Guarded = GuardedBlocks.begin();
+    for (unsigned c = 0, e = Result.Branches.size(); c != e; ++c) {
+        Instruction *BI = Result.Branches[c];
+        unsigned Stamp = c + 1;
+        Found.clear();
+        Visit(BI, Stamp);
+        for (; Guarded != GuardedBlocks.end() && Guarded->first == c;
+                ++Guarded) {
+            for (Instruction &I: *Guarded->second) {
+                Visit(&I, Stamp);
+            }
+        }
+        while (!Stack.empty()) {
+            Instruction *Inst = Insts[Stack.pop_back_val()];
+            for (Use &U: Inst->operands()) {
+                if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+                    Visit(Op, Stamp);
                 }
             }
         }
+
+        std::sort(Found.begin(), Found.end());
+        Result.Begin.push_back(Result.Instructions.size());
+        for (unsigned i: Found) {
+            Result.Instructions.push_back(Insts[i]);
+        }
     }
+    Result.Begin.push_back(Result.Instructions.size());
 }
 
 const CallInst *SanityCheckInstructionsPass::findSanityCheckCall(BasicBlock* BB) const {
     for (const Instruction &I: *BB) {
         if (const CallInst *CI = dyn_cast<CallInst>(&I)) {
-            if (isAbortingCall(CI)) {
+            if (isSanityCheckCall(CI)) {
                 return CI;
             }
         }
@@ -139,19 +377,6 @@ const CallInst *SanityCheckInstructionsPass::findSanityCheckCall(BasicBlock* BB)
     return 0;
 }
 
-bool SanityCheckInstructionsPass::onlyUsedInSanityChecks(Value* V) {
-    for (User *U: V->users()) {
-        Instruction *Inst = dyn_cast<Instruction>(U);
-        if (!Inst) return false;
-        
-        Function *F = Inst->getParent()->getParent();
-        if (!(SanityCheckInstructions[F].count(Inst))) {
-            return false;
-        }
-    }
-    return true;
-}
-
 char SanityCheckInstructionsPass::ID = 0;
 
 static RegisterPass<SanityCheckInstructionsPass> X("sanity-check-instructions",
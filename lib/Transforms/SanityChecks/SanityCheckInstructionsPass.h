@@ -1,10 +1,17 @@
 // This file is part of ASAP.
 // Please see LICENSE.txt for copyright and licensing information.
 
+#include "utils.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Pass.h"
 
 #include <map>
+#include <utility>
+#include <vector>
 
 namespace llvm {
     class AnalysisUsage;
@@ -13,18 +20,20 @@ namespace llvm {
     class Function;
     class Instruction;
     class Value;
+    class raw_ostream;
 }
 
 struct SanityCheckInstructionsPass : public llvm::ModulePass {
     static char ID;
 
-    SanityCheckInstructionsPass() : ModulePass(ID) {}
+    SanityCheckInstructionsPass();
 
     virtual bool runOnModule(llvm::Module &M);
 
-    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const {
-        AU.setPreservesAll();
-    }
+    virtual void getAnalysisUsage(llvm::AnalysisUsage& AU) const;
+
+    // Lists the instructions of each check by their position in the function.
+    virtual void print(llvm::raw_ostream &O, const llvm::Module *M) const;
 
     // Types used to store sanity check blocks / instructions
     typedef llvm::SmallPtrSet<llvm::BasicBlock*, 64> BlockSet;
@@ -38,8 +47,13 @@ struct SanityCheckInstructionsPass : public llvm::ModulePass {
         return SanityCheckBlocks.at(F);
     }
     
-    const InstructionSet &getInstructionsBySanityCheck(llvm::Instruction *Inst) const {
-        return InstructionsBySanityCheck.at(Inst);
+    // Returns the instructions required by the given sanity check branch, in
+    // program order.
+    llvm::ArrayRef<llvm::Instruction*> getInstructionsBySanityCheck(llvm::Instruction *Inst) const {
+        auto I = InstructionsBySanityCheck.find(Inst);
+        assert(I != InstructionsBySanityCheck.end() && "Not a sanity check");
+        return llvm::makeArrayRef(CheckInstructions).slice(I->second.first,
+                                                           I->second.second);
     }
 
     // Searches the given basic block for a call instruction that corresponds to
@@ -51,16 +65,38 @@ private:
     // All blocks that abort due to sanity checks
     std::map<llvm::Function*, BlockSet> SanityCheckBlocks;
 
-    // All instructions that belong to sanity checks
-    std::map<llvm::Function*, InstructionSet> SanityCheckInstructions;
-    
     // All sanity checks themselves (branch instructions that could lead to an abort)
     std::map<llvm::Function*, InstructionSet> SanityCheckBranches;
     
-    // A map of all instructions required by a given sanity check branch.
-    // Note that instructions can belong to multiple sanity check branches.
-    std::map<llvm::Instruction*, InstructionSet> InstructionsBySanityCheck;
+    // The instructions required by each sanity check branch, stored as a
+    // slice (offset, length) of CheckInstructions. Note that instructions can
+    // belong to multiple sanity check branches.
+    llvm::DenseMap<llvm::Instruction*, std::pair<unsigned, unsigned> > InstructionsBySanityCheck;
+    std::vector<llvm::Instruction*> CheckInstructions;
+
+    // The sanity checks of one function, as found by findInstructions
+    struct FunctionChecks {
+        llvm::SmallVector<llvm::BasicBlock*, 8> Blocks;
+        llvm::SmallVector<llvm::Instruction*, 8> Branches;
+
+        // The instructions of Branches[i] are Instructions[Begin[i]] up to
+        // Instructions[Begin[i + 1]], in program order.
+        std::vector<llvm::Instruction*> Instructions;
+        llvm::SmallVector<unsigned, 9> Begin;
+
+        // All instructions that belong to sanity checks, in program order
+        std::vector<llvm::Instruction*> SanityCheckInstructions;
+    };
+
+    // Finds the sanity checks in F and the instructions that belong to them.
+    // This only reads the IR, so functions can be processed in parallel.
+    void findInstructions(llvm::Function *F, FunctionChecks &Result) const;
+
+    // Makes the checks of F available through the getters above.
+    void addChecks(llvm::Function *F, const FunctionChecks &Checks);
 
-    void findInstructions(llvm::Function *F);
-    bool onlyUsedInSanityChecks(llvm::Value *V);
+    // Removes the checks in F that can never fail, as found by
+    // -asap-remove-safe-checks. Returns the number of removed checks.
+    size_t removeSafeChecks(llvm::Function &F,
+                            const GlobalSet &DynInitGlobals);
 };
@@ -3,7 +3,9 @@
 # This file is part of ASAP.
 # Please see LICENSE.txt for copyright and licensing information.
 
+require 'etc'
 require 'shellwords'
+require 'thread'
 
 SCRIPT_DIR = File.dirname($0)
 
@@ -21,6 +23,28 @@ def run!(*args)
   end
 end
 
+# Runs a list of commands (each one a list of arguments for run!), as many at a
+# time as there are processors. Returns the commands that failed.
+def run_parallel(commands)
+  queue = Queue.new
+  commands.each { |command| queue << command }
+  failed = Queue.new
+  workers = Array.new([Etc.nprocessors, commands.size].min) do
+    Thread.new do
+      until queue.empty?
+        command = queue.pop(true) rescue break
+        begin
+          run!(*command)
+        rescue RunExternalCommandError
+          failed << command
+        end
+      end
+    end
+  end
+  workers.each(&:join)
+  Array.new(failed.size) { failed.pop }
+end
+
 # Finding stuff in the path
 # =========================
 
@@ -58,16 +82,37 @@ def find_llc()
   llc
 end
 
+# The in-process backend; optional
+def find_asap_backend()
+  backend = File.join(SCRIPT_DIR, 'asap-backend')
+  File.executable?(backend) ? backend : nil
+end
+
+def find_asap_cost_threshold()
+  tool = File.join(SCRIPT_DIR, 'asap-cost-threshold')
+  File.executable?(tool) ? tool : nil
+end
+
 def find_ar()
   which('ar')
 end
 
+def find_llvm_ar()
+  llvm_ar = $0.sub(/asap-(?:clang(?:\+\+)?|ar|ranlib)$/, 'llvm-ar')
+  raise "cannot find llvm-ar" if $0 == llvm_ar
+  llvm_ar
+end
+
 def find_asap_lib()
   ["#{SCRIPT_DIR}/../lib/SanityChecks.dylib",
    "#{SCRIPT_DIR}/../lib/SanityChecks.so"].find { |f| File.file?(f) }
 end
 
 
+def find_runtime_source(name)
+  File.join(File.dirname(File.realpath(__FILE__)), 'runtime', "#{name}.c")
+end
+
 # Transforming file names
 # =======================
 
@@ -11,17 +11,64 @@
 #   Prepares the compilation with coverage instrumentation. After this step,
 #   the software should be compiled again, and the resulting binary will be
 #   instrumented for coverage.
+#   With -asap-coverage -asap-check-profile, the binary counts executions of
+#   each sanity check instead, and writes them to a single indexed profile
+#   in the state folder. This is more robust than GCOV's block-order matching.
+#   With -asap-coverage -asap-sample-profile=<file>, no instrumented build is
+#   needed. Costs are estimated from a sample profile (e.g., converted from
+#   perf data) of the optimized, instrumented program; continue with
+#   -asap-optimize directly.
+#   With -asap-coverage -asap-workloads=<file>, costs are computed from the
+#   profiles of several workloads, listed as "<weight> <kind> <profile>" lines
+#   (kind is checks, sample or gcov-list). Add
+#   -asap-workload-merge=max or -asap-workload-merge=percentile (with
+#   -asap-workload-percentile=<p>) to count each check as often as in its
+#   hottest workload (or percentile) rather than the weighted average. The
+#   budget then applies to this synthetic worst case, not to each workload.
+#   Before the third step, -asap-calibrate can measure the cost of common
+#   kinds of checks on this machine. Costs are then computed from these
+#   measurements instead of static estimates, and the static estimates of
+#   other checks are converted to cycles.
+#   Any of these can be combined with -asap-miss-profile=<file>, a sample
+#   profile of cache misses (e.g., from perf), to make checks whose loads miss
+#   the cache more expensive. -asap-miss-cost=<n> sets the cycles per sample.
+#   The miss profile requires -asap-calibrate.
+#   Add -asap-remove-safe-checks to remove checks that provably never fail
+#   (e.g., accesses within fixed-size arrays) before costs are computed.
 # - Third step: -asap-compute-costs
 #   Collects sanity checks and computes their costs
 # - Fourth step: -asap-optimize
 #   Prepares for optimized compilation. Running make/ninja again after this
 #   should result in an optimized binary.
+#   -asap-optimize can be repeated with a different level. With asap-backend,
+#   objects are cached in the state folder, so that rebuilding only compiles
+#   objects whose set of removed checks has changed. The cache holds up to
+#   1 GB; the least recently used objects are removed beyond that.
+#   With -asap-optimize -asap-lto, the third step is skipped. Object files
+#   are kept as bitcode, and ASAP runs once on the whole program inside the
+#   gold linker plugin, with a single global budget. In this mode,
+#   -asap-kind-budget=<family>=<cost level> (may be repeated) gives a family
+#   of checks its own budget, e.g., -asap-kind-budget=asan-write=0.97 or
+#   -asap-kind-budget=assertion=unlimited.
+#   With -asap-optimize -asap-toggleable-checks, checks are kept but can be
+#   enabled and disabled while the program runs; the ones above the threshold
+#   start disabled. See runtime/asap-toggle.h for the interface.
+#   Next to each object's log, a YAML report (*.asap.yaml) lists every check
+#   with its location, cost and what ASAP did with it; with -asap-lto, the
+#   report for the whole program is asap_report.yaml in the state folder.
+#
+# If the asap-backend tool is installed next to this script, it performs the
+# per-object work in one process per object (or, for computing costs, one
+# process with a thread pool). Otherwise, asap-clang falls back to running opt
+# and llc. With asap-backend, -asap-coverage and -asap-optimize also build the
+# objects for the next rebuild right away, on all processors; the rebuild then
+# only copies them.
 
 # This file is part of ASAP.
 # Please see LICENSE.txt for copyright and licensing information.
 
+require 'etc'
 require 'fileutils'
-require 'parallel'
 require 'pathname'
 
 require_relative 'asap-clang-utils.rb'
@@ -67,6 +114,13 @@ class AsapState
     end
   end
 
+  # Given the .orig.o file of an object, returns the path of another file for
+  # the same object in one of the state subfolders
+  def related_path(orig_name, dir, ext)
+    orig_rel = Pathname.new(orig_name).relative_path_from(Pathname.new(objects_directory))
+    mangle(File.join(state_path, dir.to_s, orig_rel.to_s), '.orig.o', ext)
+  end
+
   # Given two paths, returns the first path with all shared folders removed.
   # For example, /foo/bar/baz, /foo/quu => bar/baz
   #              /foo/bar/baz, /quu => foo/bar/baz
@@ -94,6 +148,8 @@ class AsapState
       AsapProfilingCompiler.new(self)
     elsif current_state == :optimize
       AsapOptimizingCompiler.new(self)
+    elsif current_state == :optimize_lto
+      AsapLTOCompiler.new(self)
     else
       raise "Unknown ASAP state: #{current_state}"
     end
@@ -108,6 +164,122 @@ class AsapState
     IO.write(File.join(state_path, "current_state"), "#{state}\n")
   end
 
+  # The kind of profiling data: :gcov or :checks (see -asap-check-profile)
+  def profile_kind()
+    profile_kind_file = File.join(state_path, "profile_kind")
+    @profile_kind ||= if File.file?(profile_kind_file)
+                        IO.read(profile_kind_file).chomp.to_sym
+                      else
+                        :gcov
+                      end
+  end
+
+  def profile_kind=(kind)
+    @profile_kind = kind
+    IO.write(File.join(state_path, "profile_kind"), "#{kind}\n")
+  end
+
+  def check_profile_path()
+    File.join(state_path, "checks.profile")
+  end
+
+  def cache_directory()
+    File.join(state_path, "cache")
+  end
+
+  def sample_profile_path()
+    File.join(state_path, "sample.profile")
+  end
+
+  # Measured check costs, written by -asap-calibrate
+  def cost_table_path()
+    File.join(state_path, "cost_table")
+  end
+
+  # Cache misses, given with -asap-miss-profile
+  def miss_profile_path()
+    File.join(state_path, "miss.profile")
+  end
+
+  def miss_options()
+    miss_options_file = File.join(state_path, "miss_options")
+    File.file?(miss_options_file) ? IO.readlines(miss_options_file).map(&:chomp) : []
+  end
+
+  def miss_options=(options)
+    IO.write(File.join(state_path, "miss_options"), options.map { |o| "#{o}\n" }.join)
+  end
+
+  # Whether checks that provably never fail are removed, as requested with
+  # -asap-coverage -asap-remove-safe-checks
+  def remove_safe_checks()
+    File.file?(File.join(state_path, "remove_safe_checks"))
+  end
+
+  def remove_safe_checks=(enabled)
+    remove_safe_checks_file = File.join(state_path, "remove_safe_checks")
+    if enabled
+      FileUtils.touch(remove_safe_checks_file)
+    else
+      FileUtils.rm_f(remove_safe_checks_file)
+    end
+  end
+
+  # The arguments that determine which checks SanityCheckInstructionsPass
+  # finds. All stages that look at checks must agree on them.
+  def check_args()
+    remove_safe_checks ? ['-asap-remove-safe-checks'] : []
+  end
+
+  # The arguments that make SanityCheckCostPass see the same checks as the
+  # other stages, and use the cost table and the miss profile, if any
+  def cost_model_args()
+    args = check_args
+    args << "-asap-cost-table=#{cost_table_path}" if File.file?(cost_table_path)
+    if File.file?(miss_profile_path)
+      raise "-asap-miss-profile requires -asap-calibrate" unless File.file?(cost_table_path)
+      args += ["-asap-miss-profile=#{miss_profile_path}"] + miss_options
+    end
+    args
+  end
+
+  def workloads_path()
+    File.join(state_path, "workloads")
+  end
+
+  def workload_options()
+    IO.readlines(File.join(state_path, "workload_options")).map(&:chomp)
+  end
+
+  def workload_options=(options)
+    IO.write(File.join(state_path, "workload_options"), options.map { |o| "#{o}\n" }.join)
+  end
+
+  # Whether the optimized program can enable and disable checks at runtime
+  def toggleable_checks()
+    File.file?(File.join(state_path, "toggleable_checks"))
+  end
+
+  def toggleable_checks=(enabled)
+    toggleable_checks_file = File.join(state_path, "toggleable_checks")
+    if enabled
+      FileUtils.touch(toggleable_checks_file)
+    else
+      FileUtils.rm_f(toggleable_checks_file)
+    end
+  end
+
+  # For profiles that cover the whole program, returns the profile file and
+  # the arguments that pass it to SanityCheckCostPass. Returns nil for GCOV,
+  # which has separate data for each object.
+  def whole_program_profile()
+    case profile_kind
+    when :checks then [check_profile_path, ["-asap-profile=#{check_profile_path}"]]
+    when :sample then [sample_profile_path, ["-asap-sample-profile=#{sample_profile_path}"]]
+    when :workloads then [workloads_path, ["-asap-workloads=#{workloads_path}"] + workload_options]
+    end
+  end
+
   def transition(from, to)
     raise "Expected ASAP state to be '#{from}', but it is '#{current_state}'" unless current_state == from
     yield
@@ -170,6 +342,64 @@ class BaseCompiler
     cmd = [find_ar(), '-s'] + cmd[1..-1]
     run!(*cmd)
   end
+
+  # Compiles one of ASAP's runtimes, once per state folder. Parallel links
+  # wait for the first one to finish, and never see a partial object.
+  def runtime(name)
+    rt_name = File.join(state.state_path, "#{name}.o")
+    return rt_name if File.file?(rt_name)
+
+    File.open("#{rt_name}.lock", File::RDWR | File::CREAT) do |lock|
+      lock.flock(File::LOCK_EX)
+      unless File.file?(rt_name)
+        tmp_name = "#{rt_name}.#{Process.pid}.tmp"
+        run!(find_clang().sub(/\+\+$/, ''), '-O2', '-fPIC', '-c',
+             '-o', tmp_name, find_runtime_source(name))
+        File.rename(tmp_name, rt_name)
+      end
+    end
+    rt_name
+  end
+
+  # Builds the objects of the current stage ahead of the rebuild, running one
+  # asap-backend per object on all processors. The block returns the command
+  # that builds a given .orig.o file at a given optimization level into a
+  # given output file, or nil to skip the object.
+  def prebuild(ext)
+    return unless find_asap_backend()
+    orig_names = Dir.chdir(state.objects_directory) do
+      Dir.glob('**/*.orig.o').collect { |b| File.join(state.objects_directory, b) }
+    end
+    jobs = []
+    orig_names.each do |orig_name|
+      prebuilt_name = mangle(orig_name, '.orig.o', ext)
+      FileUtils.rm_f(prebuilt_name)
+      level_name = mangle(orig_name, '.orig.o', '.opt_level')
+      next unless File.file?(level_name)
+      command = yield(orig_name, IO.read(level_name), prebuilt_name)
+      jobs << [command, prebuilt_name] if command
+    end
+
+    # Objects that fail here are built again by do_compile, which reports the
+    # error as part of the build.
+    failed = run_parallel(jobs.collect(&:first))
+    jobs.each do |command, prebuilt_name|
+      FileUtils.rm_f(prebuilt_name) if failed.include?(command)
+    end
+  end
+
+  # Copies the object that prebuild made for orig_name to target_name. Returns
+  # false if there is no such object for the current orig_name and the given
+  # optimization level.
+  def copy_prebuilt(orig_name, ext, opt_level, target_name)
+    prebuilt_name = mangle(orig_name, '.orig.o', ext)
+    level_name = mangle(orig_name, '.orig.o', '.opt_level')
+    return false unless [prebuilt_name, level_name].all? { |f| File.file?(f) }
+    return false unless IO.read(level_name) == opt_level
+    return false if File.mtime(prebuilt_name) < File.mtime(orig_name)
+    FileUtils.cp(prebuilt_name, target_name)
+    true
+  end
 end
 
 # This is the compiler for ASAP's first stage. It ensures that crucial
@@ -199,12 +429,13 @@ class AsapInitialCompiler < BaseCompiler
         gcno_name = mangle(state.coverage_path(target_name), '.o', '.gcno')
         gcda_name = mangle(state.coverage_path(target_name), '.o', '.gcda')
         orig_name = mangle(state.objects_path(target_name), '.o', '.orig.o')
+        level_name = mangle(orig_name, '.orig.o', '.opt_level')
         FileUtils.mkdir_p(File.dirname(gcno_name))
         FileUtils.mkdir_p(File.dirname(orig_name))
 
         # Ensure that no target files exist. We had problems in the past with
         # stale gcda files, that were then updated incorrectly.
-        FileUtils.rm_f([gcno_name, gcda_name, orig_name])
+        FileUtils.rm_f([gcno_name, gcda_name, orig_name, level_name])
 
         clang_args = cmd[1..-1]
         clang_args = insert_arg(clang_args, '-gline-tables-only')
@@ -212,6 +443,12 @@ class AsapInitialCompiler < BaseCompiler
         clang_args = ['-Xclang', '-femit-coverage-notes',
                       '-Xclang', "-coverage-file=#{gcno_name}"] + clang_args
 
+        # TSan's memory access callbacks are not branches that ASAP could
+        # remove. Guard each one with a branch of its own.
+        if get_arg(clang_args, /^-fsanitize=(.*,)?thread(,.*)?$/, :last)
+          clang_args = ['-mllvm', '-tsan-guard-accesses'] + clang_args
+        end
+
         run!(clang, *clang_args)
 
         # If this lead to an instrumented bitcode file, copy it.
@@ -224,6 +461,8 @@ class AsapInitialCompiler < BaseCompiler
           opt_level = get_optlevel_for_llc(clang_args)
           run!(find_llc(), opt_level, '-filetype=obj', '-relocation-model=pic',
                '-o', target_name, orig_name)
+          # Later stages prebuild objects at the same level.
+          IO.write(level_name, opt_level)
 
           # If everthing so far worked, return happily
           return
@@ -242,6 +481,7 @@ end
 
 # Compiler for ASAP's second stage. Adds profiling information to the program.
 class AsapProfilingCompiler < BaseCompiler
+  PREBUILT_EXT = '.gcov.prebuilt.o'
 
   def do_compile(cmd)
     target_name = get_arg(cmd, '-o')
@@ -255,16 +495,49 @@ class AsapProfilingCompiler < BaseCompiler
     # Original file exists; create the target from there
     gcov_name = mangle(state.objects_path(target_name), '.o', '.gcov.o')
     opt_level = get_optlevel_for_llc(cmd)
-    run!(find_opt(), '-insert-gcov-profiling',
-              '-o', gcov_name,
-              orig_name)
+    return if copy_prebuilt(orig_name, PREBUILT_EXT, opt_level, target_name)
+    if find_asap_backend()
+      run!(*backend_command(orig_name, opt_level, target_name))
+      return
+    end
+    if state.profile_kind == :checks
+      run!(find_opt(), '-load', find_asap_lib(), '-asap-profiling',
+           "-asap-profile-file=#{state.check_profile_path}",
+           *state.check_args,
+           '-o', gcov_name,
+           orig_name)
+    else
+      run!(find_opt(), '-insert-gcov-profiling',
+                '-o', gcov_name,
+                orig_name)
+    end
     run!(find_llc(), opt_level, '-filetype=obj', '-relocation-model=pic',
          '-o', target_name, gcov_name)
   end
 
+  def prebuild_objects()
+    prebuild(PREBUILT_EXT) do |orig_name, opt_level, prebuilt_name|
+      backend_command(orig_name, opt_level, prebuilt_name)
+    end
+  end
+
+  # The asap-backend command that instruments an object and generates code
+  def backend_command(orig_name, opt_level, output_name)
+    stage = state.profile_kind == :checks ? 'check-profiling' : 'coverage'
+    [find_asap_backend(), "-stage=#{stage}", opt_level,
+     '-relocation-model=pic',
+     "-asap-profile-file=#{state.check_profile_path}",
+     *state.check_args,
+     '-o', output_name, orig_name]
+  end
+
   def do_link(cmd)
     linker_args = cmd[1..-1]
-    linker_args = insert_arg(linker_args, '-coverage')
+    if state.profile_kind == :checks
+      linker_args += [runtime('asap-profile-rt')]
+    else
+      linker_args = insert_arg(linker_args, '-coverage')
+    end
 
     super([cmd[0]] + linker_args)
   end
@@ -273,36 +546,47 @@ end
 
 # Compiler for ASAP's fourth stage. Compiles an optimized program.
 class AsapOptimizingCompiler < BaseCompiler
+  PREBUILT_EXT = '.asap.prebuilt.o'
+
   def initialize(state)
     super
     threshold_file = IO.read(File.join(state.state_path, 'threshold'))
     raise "Threshold not defined" unless threshold_file =~ /^Cost threshold is (\d+)$/
     @cost_threshold = $1.to_i
+    @toggle_args = state.toggleable_checks ? ['-asap-toggleable-checks'] : []
   end
 
   def do_compile(cmd)
     target_name = get_arg(cmd, '-o')
     return super unless target_name and target_name.end_with?('.o')
 
-    # Check whether we have both an .orig.o file and coverage data. Otherwise,
+    # Check whether we have both an .orig.o file and profile data. Otherwise,
     # ASAP should not touch the current target.
     orig_name = mangle(state.objects_path(target_name), '.o', '.orig.o')
-    gcda_name = mangle(state.coverage_path(target_name), '.o', '.gcda')
-    gcno_name = mangle(state.coverage_path(target_name), '.o', '.gcno')
-    return super unless [orig_name, gcda_name, gcno_name].all? { |f| File.file?(f) }
+    profile_args = profile_args(orig_name)
+    return super unless profile_args
 
     # Original file exists; create the target from there
     asap_name = mangle(state.objects_path(target_name), '.o', '.asap.o')
     opt_name = mangle(state.objects_path(target_name), '.o', '.asap.opt.o')
-    log_name  = mangle(state.log_path(target_name), '.o', '.asap.log')
+    log_name = state.related_path(orig_name, :log, '.asap.log')
+    report_name = state.related_path(orig_name, :log, '.asap.yaml')
     opt_level = get_optlevel_for_llc(cmd)
+    return if copy_prebuilt(orig_name, PREBUILT_EXT, opt_level, target_name)
+    if find_asap_backend()
+      run!(*backend_command(orig_name, opt_level, target_name))
+      return
+    end
     FileUtils.mkdir_p(File.dirname(log_name))
     run!(find_opt(),
          '-load', find_asap_lib(),
          '-asap',
          '-print-removed-checks',
+         "-asap-report=#{report_name}",
          "-asap-cost-threshold=#{@cost_threshold}",
-         "-gcda=#{gcda_name}", "-gcno=#{gcno_name}",
+         *@toggle_args,
+         *state.cost_model_args,
+         *profile_args,
          '-o', asap_name, orig_name,
          :out => log_name,
          :err => [:child, :out])
@@ -311,29 +595,337 @@ class AsapOptimizingCompiler < BaseCompiler
     run!(find_llc(), opt_level, '-filetype=obj', '-relocation-model=pic',
          '-o', target_name, opt_name)
   end
+
+  def prebuild_objects()
+    prebuild(PREBUILT_EXT) do |orig_name, opt_level, prebuilt_name|
+      backend_command(orig_name, opt_level, prebuilt_name) if profile_args(orig_name)
+    end
+  end
+
+  # The arguments that pass the profile for an object to ASAP, or nil if
+  # there is no profile for it
+  def profile_args(orig_name)
+    if state.whole_program_profile
+      profile_name, profile_args = state.whole_program_profile
+      return nil unless [orig_name, profile_name].all? { |f| File.file?(f) }
+      profile_args
+    else
+      gcda_name = state.related_path(orig_name, :coverage, '.gcda')
+      gcno_name = state.related_path(orig_name, :coverage, '.gcno')
+      return nil unless [orig_name, gcda_name, gcno_name].all? { |f| File.file?(f) }
+      ["-gcda=#{gcda_name}", "-gcno=#{gcno_name}"]
+    end
+  end
+
+  # The asap-backend command that optimizes an object and generates code. Its
+  # output goes to the object's log.
+  def backend_command(orig_name, opt_level, output_name)
+    log_name = state.related_path(orig_name, :log, '.asap.log')
+    report_name = state.related_path(orig_name, :log, '.asap.yaml')
+    FileUtils.mkdir_p(File.dirname(log_name))
+    FileUtils.mkdir_p(state.cache_directory)
+    [find_asap_backend(), '-stage=optimize', opt_level,
+     '-relocation-model=pic',
+     "-cache-dir=#{state.cache_directory}",
+     '-print-removed-checks',
+     "-asap-report=#{report_name}",
+     "-asap-cost-threshold=#{@cost_threshold}",
+     *@toggle_args,
+     *state.cost_model_args,
+     *profile_args(orig_name),
+     '-o', output_name, orig_name,
+     {:out => log_name, :err => [:child, :out]}]
+  end
+
+  def do_link(cmd)
+    linker_args = cmd[1..-1]
+    linker_args += [runtime('asap-toggle-rt'), '-pthread'] if state.toggleable_checks
+
+    super([cmd[0]] + linker_args)
+  end
+end
+
+
+# Compiler for ASAP's fourth stage in LTO mode. Objects stay bitcode files,
+# and the linker plugin runs ASAP on the merged program.
+class AsapLTOCompiler < BaseCompiler
+  def initialize(state)
+    super
+    @lto_options = IO.readlines(File.join(state.state_path, 'lto_options')).map(&:chomp)
+  end
+
+  def do_compile(cmd)
+    target_name = get_arg(cmd, '-o')
+    return super unless target_name and target_name.end_with?('.o')
+
+    # Check whether an .orig.o file exists. Otherwise, ASAP should not touch
+    # the current target.
+    orig_name = mangle(state.objects_path(target_name), '.o', '.orig.o')
+    return super unless File.file?(orig_name)
+
+    FileUtils.cp(orig_name, target_name)
+  end
+
+  def do_link(cmd)
+    linker_args = cmd[1..-1]
+    linker_args = insert_arg(linker_args, '-flto')
+    linker_args = insert_arg(linker_args, '-fuse-ld=gold')
+    linker_args += @lto_options.collect { |o| "-Wl,-plugin-opt=#{o}" }
+    if @lto_options.include?('-asap-toggleable-checks')
+      linker_args += [runtime('asap-toggle-rt'), '-pthread']
+    end
+
+    super([cmd[0]] + linker_args)
+  end
+
+  # Archives contain bitcode files now, so they need an LLVM-aware symbol table
+  def do_ar(cmd)
+    run!(find_llvm_ar(), *cmd[1..-1])
+  end
+  def do_ranlib(cmd)
+    run!(find_llvm_ar(), 's', *cmd[1..-1])
+  end
 end
 
 
+# Prepares the options that make the linker plugin run ASAP on the whole
+# program: the budget, and the list of all coverage files.
+def prepare_lto(state, args)
+  sanity_level = get_arg(args, '-asap-sanity-level=')
+  cost_level = get_arg(args, '-asap-cost-level=')
+  raise "specify -asap-cost-level or -asap-sanity-level" unless sanity_level or cost_level
+  raise "specify -asap-cost-level or -asap-sanity-level" if sanity_level and cost_level
+
+  if state.whole_program_profile
+    lto_options = ['-asap-lto'] + state.whole_program_profile[1]
+  else
+    gcov_list_name = File.join(state.state_path, 'gcov_list')
+    open(gcov_list_name, 'w') do |gcov_list|
+      Dir.glob(File.join(state.coverage_directory, '**', '*.gcda')) do |gcda_name|
+        gcno_name = mangle(gcda_name, '.gcda', '.gcno')
+        gcov_list.puts "#{gcno_name} #{gcda_name}" if File.file?(gcno_name)
+      end
+    end
+
+    lto_options = ['-asap-lto', "-gcov-list=#{gcov_list_name}"]
+  end
+  lto_options += state.cost_model_args
+  # The linker analyzes the whole program as one module.
+  lto_options << "-asap-threads=#{Etc.nprocessors}"
+  lto_options << "-asap-report=#{File.join(state.state_path, 'asap_report.yaml')}"
+  lto_options << "-sanity-level=#{sanity_level}" if sanity_level
+  lto_options << "-cost-level=#{cost_level}" if cost_level
+  if get_arg(args, '-asap-sample-checks')
+    raise "-asap-sample-checks requires -asap-cost-level" unless cost_level
+    lto_options << '-asap-sample-checks'
+  end
+  lto_options << '-asap-toggleable-checks' if get_arg(args, '-asap-toggleable-checks')
+  lto_options << '-asap-clone-hot-functions' if get_arg(args, '-asap-clone-hot-functions')
+  lto_options += args.grep(/^-asap-kind-budget=/)
+  IO.write(File.join(state.state_path, 'lto_options'), lto_options.join("\n") + "\n")
+end
+
 # Finds all sanity checks and computes their cost
 def compute_costs(state)
-  gcda_files = []
-  Dir.chdir(state.coverage_directory) do |coverage_dir|
-    gcda_files = Dir.glob('**/*.gcda')
+  jobs = find_cost_jobs(state)
+  jobs.each do |job|
+    FileUtils.mkdir_p(File.dirname(job[1]))
+    FileUtils.rm_f(binary_costs_path(job[1]))
+  end
+  profile_args = state.whole_program_profile ? state.whole_program_profile[1] : []
+  profile_args += state.cost_model_args
+
+  if find_asap_backend()
+    jobs_name = File.join(state.state_path, 'cost_jobs')
+    open(jobs_name, 'w') do |jobs_file|
+      jobs.each do |job|
+        [:input, :output, :gcno, :gcda].zip(job) do |key, value|
+          jobs_file.puts "#{key}=#{value}" if value
+        end
+        # asap-cost-threshold reads binary costs files much faster than text.
+        # The text file stays, since it lists the location of each check.
+        jobs_file.puts "binary-output=#{binary_costs_path(job[1])}" if find_asap_cost_threshold()
+        jobs_file.puts
+      end
+    end
+    # Cores that are left over when there are few objects analyze the
+    # functions of each object in parallel.
+    threads = [Etc.nprocessors / [jobs.size, 1].max, 1].max
+    run!(find_asap_backend(), '-stage=costs', "-j#{Etc.nprocessors}",
+         "-jobs=#{jobs_name}", "-asap-threads=#{threads}", *profile_args)
+    return
   end
 
-  Parallel.each(gcda_files) do |gcda_basename|
-    gcda_name = File.join(state.coverage_directory, gcda_basename)
-    gcno_name = mangle(File.join(state.coverage_directory, gcda_basename), '.gcda', '.gcno')
-    orig_name = mangle(File.join(state.objects_directory, gcda_basename), '.gcda', '.orig.o')
-    costs_name = mangle(File.join(state.costs_directory, gcda_basename), '.gcda', '.costs')
+  commands = jobs.collect do |orig_name, costs_name, gcno_name, gcda_name|
+    job_profile_args = gcno_name ? ["-gcda=#{gcda_name}", "-gcno=#{gcno_name}"] + state.cost_model_args : profile_args
+    [find_opt(),
+     '-load', find_asap_lib(),
+     '-analyze', '-sanity-check-cost',
+     *job_profile_args, orig_name,
+     {:out => costs_name}]
+  end
+  failed = run_parallel(commands)
+  raise RunExternalCommandError, "Computing costs failed for #{failed.size} objects" unless failed.empty?
+end
 
-    FileUtils.mkdir_p(File.dirname(costs_name))
+# The costs of an object in the binary costs format, next to its text costs
+def binary_costs_path(costs_name)
+  mangle(costs_name, '.costs', '.costs.bin')
+end
 
-    run!(find_opt(),
-         '-load', find_asap_lib(),
-         '-analyze', '-sanity-check-cost',
-         "-gcda=#{gcda_name}", "-gcno=#{gcno_name}", orig_name,
-         :out => costs_name)
+# Lists the objects for which costs need to be computed, as
+# [orig_name, costs_name] pairs, followed by gcno and gcda files for GCOV.
+def find_cost_jobs(state)
+  jobs = []
+  if state.whole_program_profile
+    Dir.chdir(state.objects_directory) do
+      Dir.glob('**/*.orig.o') do |orig_basename|
+        jobs << [File.join(state.objects_directory, orig_basename),
+                 mangle(File.join(state.costs_directory, orig_basename), '.orig.o', '.costs')]
+      end
+    end
+  else
+    Dir.chdir(state.coverage_directory) do
+      Dir.glob('**/*.gcda') do |gcda_basename|
+        jobs << [mangle(File.join(state.objects_directory, gcda_basename), '.gcda', '.orig.o'),
+                 mangle(File.join(state.costs_directory, gcda_basename), '.gcda', '.costs'),
+                 mangle(File.join(state.coverage_directory, gcda_basename), '.gcda', '.gcno'),
+                 File.join(state.coverage_directory, gcda_basename)]
+      end
+    end
+  end
+  jobs
+end
+
+# Copies a list of workloads, making the profile paths absolute
+def copy_workloads(source, target)
+  base_dir = File.dirname(File.expand_path(source))
+  open(target, 'w') do |out|
+    IO.readlines(source).each do |line|
+      weight, kind, profile = line.strip.split(/\s+/, 3)
+      next if weight.nil? or weight.start_with?('#')
+      raise "invalid workload line: #{line}" if profile.nil?
+      out.puts "#{weight} #{kind} #{File.expand_path(profile, base_dir)}"
+    end
+  end
+end
+
+# Loads and stores are measured within a cached buffer, and with strided and
+# random accesses to a buffer larger than the last-level cache. Their cost is
+# the mean over these access patterns.
+def access_kernels(kernel)
+  ['', '_strided', '_random'].map { |pattern| "#{kernel}#{pattern}" }
+end
+
+# The kernels in runtime/asap-calibrate.c, the sanitizer flags that add their
+# checks, and the functions that report the errors of these checks
+CALIBRATION_KERNELS = [
+  [access_kernels('load1'), :asan, '__asan_report_load1'],
+  [access_kernels('load2'), :asan, '__asan_report_load2'],
+  [access_kernels('load4'), :asan, '__asan_report_load4'],
+  [access_kernels('load8'), :asan, '__asan_report_load8'],
+  [access_kernels('load16'), :asan, '__asan_report_load16'],
+  [access_kernels('store1'), :asan, '__asan_report_store1'],
+  [access_kernels('store2'), :asan, '__asan_report_store2'],
+  [access_kernels('store4'), :asan, '__asan_report_store4'],
+  [access_kernels('store8'), :asan, '__asan_report_store8'],
+  [access_kernels('store16'), :asan, '__asan_report_store16'],
+  [['add_overflow'], :overflow, '__ubsan_handle_add_overflow_abort'],
+  [['sub_overflow'], :overflow, '__ubsan_handle_sub_overflow_abort'],
+  [['mul_overflow'], :overflow, '__ubsan_handle_mul_overflow_abort'],
+  [['out_of_bounds'], :bounds, '__ubsan_handle_out_of_bounds_abort'],
+  [access_kernels('load1'), :tsan, '__tsan_read1'],
+  [access_kernels('load2'), :tsan, '__tsan_read2'],
+  [access_kernels('load4'), :tsan, '__tsan_read4'],
+  [access_kernels('load8'), :tsan, '__tsan_read8'],
+  [access_kernels('load16'), :tsan, '__tsan_read16'],
+  [access_kernels('store1'), :tsan, '__tsan_write1'],
+  [access_kernels('store2'), :tsan, '__tsan_write2'],
+  [access_kernels('store4'), :tsan, '__tsan_write4'],
+  [access_kernels('store8'), :tsan, '__tsan_write8'],
+  [access_kernels('store16'), :tsan, '__tsan_write16'],
+]
+
+CALIBRATION_FLAGS = {
+  :plain => [],
+  :asan => ['-fsanitize=address'],
+  :overflow => ['-fsanitize=signed-integer-overflow',
+                '-fno-sanitize-recover=signed-integer-overflow'],
+  :bounds => ['-fsanitize=array-bounds',
+              '-fno-sanitize-recover=array-bounds'],
+  :tsan => ['-fsanitize=thread'],
+}
+
+CALIBRATION_ITERATIONS = 10000000
+# Kernels over the large buffer take longer per iteration
+LARGE_CALIBRATION_ITERATIONS = 1000000
+# The number of additions in the unit kernel
+CALIBRATION_UNIT_OPS = 16
+
+# Measures the cost of each kind of check as the difference in cycles per
+# iteration between a kernel with and without the check, and writes the
+# results to the cost table (see CostTable.h). The table also holds the
+# cycles per unit of the static cost estimate, which makes the estimates of
+# the remaining checks comparable to the measured costs.
+def calibrate(state)
+  clang = find_clang().sub(/\+\+$/, '')
+  calibration_dir = File.join(state.state_path, 'calibration')
+  FileUtils.mkdir_p(calibration_dir)
+
+  binaries = {}
+  CALIBRATION_FLAGS.each do |variant, flags|
+    binary = File.join(calibration_dir, "asap-calibrate-#{variant}")
+    begin
+      run!(clang, '-O2', '-fno-vectorize', '-fno-slp-vectorize', *flags,
+           '-o', binary, find_runtime_source('asap-calibrate'))
+      binaries[variant] = binary
+    rescue RunExternalCommandError
+      # Not every sanitizer is available on every target
+      raise if variant == :plain
+      puts "#{flags.join(' ')} is not supported, skipping its checks"
+    end
+  end
+
+  measurements = {}
+  measure = lambda do |variant, kernel|
+    measurements[[variant, kernel]] ||= begin
+      output_name = File.join(calibration_dir, "#{kernel}.#{variant}.out")
+      iterations = kernel =~ /_(strided|random)$/ ?
+        LARGE_CALIBRATION_ITERATIONS : CALIBRATION_ITERATIONS
+      run!(binaries[variant], kernel, iterations.to_s, :out => output_name)
+      IO.read(output_name).to_f
+    end
+  end
+
+  unit_cost = (measure.call(:plain, 'unit') -
+               measure.call(:plain, 'unit_base')) / CALIBRATION_UNIT_OPS
+  raise "Cannot measure the cycles per cost unit" if unit_cost < 0.005
+
+  target = `#{Shellwords.escape(clang)} -dumpmachine`.strip.split('-')[0]
+  open(state.cost_table_path, 'w') do |table|
+    table.puts "# Measured by asap-clang -asap-calibrate; cycles per check"
+    table.puts "target #{target}" if target and not target.empty?
+    table.puts "unit #{'%.4f' % unit_cost}"
+    puts "static cost unit: #{'%.4f' % unit_cost} cycles"
+    CALIBRATION_KERNELS.each do |kernels, variant, function|
+      next unless binaries[variant]
+      cost = kernels.map do |kernel|
+        measure.call(variant, kernel) - measure.call(:plain, kernel)
+      end.reduce(:+) / kernels.size
+      # Differences within the noise would make checks look free; these keep
+      # their static estimate.
+      if cost < 0.005
+        puts "#{function}: no measurable cost, keeping the static estimate"
+        next
+      end
+      table.puts "#{function} #{'%.2f' % cost}"
+      puts "#{function}: #{'%.2f' % cost} cycles"
+      # The first kernel hits the cache. -asap-miss-profile adds the cost of
+      # misses to this one, rather than to the average.
+      cached_cost = measure.call(variant, kernels.first) -
+                    measure.call(:plain, kernels.first)
+      table.puts "cached #{function} #{'%.2f' % cached_cost}" if cached_cost >= 0.005
+    end
   end
 end
 
@@ -344,6 +936,10 @@ def compute_cost_threshold(state, args)
   raise "specify -asap-cost-level or -asap-sanity-level" unless sanity_level or cost_level
   raise "specify -asap-cost-level or -asap-sanity-level" if sanity_level and cost_level
 
+  if find_asap_cost_threshold()
+    return compute_cost_threshold_streaming(state, sanity_level, cost_level)
+  end
+
   # Read costs
   costs = []
   Dir.glob(File.join(state.costs_directory, '**', '*.costs')) do |cost_file|
@@ -412,6 +1008,27 @@ def compute_cost_threshold(state, args)
   cost_threshold
 end
 
+# Computes the cost threshold with asap-cost-threshold, which merges the sorted
+# costs files instead of loading all costs into memory.
+def compute_cost_threshold_streaming(state, sanity_level, cost_level)
+  list_name = File.join(state.state_path, 'costs_list')
+  open(list_name, 'w') do |list|
+    Dir.glob(File.join(state.costs_directory, '**', '*.costs')) do |costs_name|
+      binary_name = binary_costs_path(costs_name)
+      list.puts(File.file?(binary_name) ? binary_name : costs_name)
+    end
+  end
+
+  threshold_name = File.join(state.state_path, 'threshold')
+  level_arg = sanity_level ? "-sanity-level=#{sanity_level}" : "-cost-level=#{cost_level}"
+  run!(find_asap_cost_threshold(), "-costs-list=#{list_name}", level_arg,
+       :out => threshold_name)
+
+  summary = IO.read(threshold_name)
+  $stdout.puts summary
+  summary[/^Cost threshold is (\d+)$/, 1].to_i
+end
+
 # Some makefiles compile and link with a single command. We need to handle this
 # specially and convert it into multiple commands.
 def handle_compile_and_link(argv)
@@ -487,9 +1104,42 @@ def main(argv)
   elsif command == '-asap-coverage'
     state = AsapState.new
     state.transition(:initial, :coverage) do
-      puts "Will build coverage-instrumented version on next rebuild; please run:"
-      puts "make clean && make"
+      sample_profile = get_arg(argv, '-asap-sample-profile=')
+      workloads = get_arg(argv, '-asap-workloads=')
+      FileUtils.rm_f([state.check_profile_path, state.sample_profile_path, state.workloads_path,
+                      state.miss_profile_path])
+      state.remove_safe_checks = get_arg(argv, '-asap-remove-safe-checks')
+      miss_profile = get_arg(argv, '-asap-miss-profile=')
+      if miss_profile
+        FileUtils.cp(miss_profile, state.miss_profile_path)
+        state.miss_options = argv.grep(/^-asap-miss-cost=/)
+      end
+      if workloads
+        state.profile_kind = :workloads
+        copy_workloads(workloads, state.workloads_path)
+        state.workload_options = argv.grep(/^-asap-workload-(?:merge|percentile)=/)
+        puts "Will use the workload profiles; no rebuild is needed. Please run:"
+        puts "asap-clang -asap-optimize ..."
+      elsif sample_profile
+        state.profile_kind = :sample
+        FileUtils.cp(sample_profile, state.sample_profile_path)
+        puts "Will use the sample profile; no rebuild is needed. Please run:"
+        puts "asap-clang -asap-optimize ..."
+      else
+        state.profile_kind = get_arg(argv, '-asap-check-profile') ? :checks : :gcov
+        AsapProfilingCompiler.new(state).prebuild_objects
+        puts "Will build coverage-instrumented version on next rebuild; please run:"
+        puts "make clean && make"
+      end
+    end
+  elsif command == '-asap-calibrate'
+    state = AsapState.new
+    unless [:initial, :coverage].include?(state.current_state)
+      raise "Please calibrate before computing costs"
     end
+    puts "Measuring check costs..."
+    calibrate(state)
+    puts "Done."
   elsif command == '-asap-compute-costs'
     state = AsapState.new
     state.transition(:coverage, :costs) do
@@ -502,9 +1152,22 @@ def main(argv)
     state.transition(:costs, :threshold) do
       compute_cost_threshold(state, argv)
     end
+  elsif command == '-asap-optimize' and get_arg(argv, '-asap-lto')
+    state = AsapState.new
+    state.transition(:coverage, :optimize_lto) do
+      prepare_lto(state, argv)
+      puts "Will build optimized version at link time on next rebuild; please run:"
+      puts "make clean && make"
+    end
   elsif command == '-asap-optimize'
+    raise "-asap-kind-budget requires -asap-lto" unless argv.grep(/^-asap-kind-budget=/).empty?
     state = AsapState.new
 
+    # Allow to choose a different level for an optimized build
+    if state.current_state == :optimize
+      state.transition(:optimize, :costs) {}
+    end
+
     # Allow to fast-forward the state for convenience
     if state.current_state == :coverage
       state.transition(:coverage, :costs) { compute_costs(state) }
@@ -514,6 +1177,8 @@ def main(argv)
     end
 
     state.transition(:threshold, :optimize) do
+      state.toggleable_checks = get_arg(argv, '-asap-toggleable-checks')
+      AsapOptimizingCompiler.new(state).prebuild_objects
       puts "Will build optimized version on next rebuild; please run:"
       puts "make clean && make"
     end
@@ -0,0 +1,301 @@
+// Synthetic kernels for measuring the cost of sanity checks, used by
+// asap-clang -asap-calibrate. Each kernel is a loop whose body contains one
+// check of a given shape. asap-clang compiles this file once without and
+// once with the corresponding sanitizer, runs the kernel in both binaries,
+// and takes the difference as the cost of one check execution.
+//
+// Usage: asap-calibrate <kernel> <iterations>
+// Prints the number of cycles per iteration, the best of several runs. On
+// x86, cycles are read with rdtsc; elsewhere, nanoseconds are used instead.
+//
+// The plain load and store kernels stay within a small buffer, so that the
+// checks and their shadow memory hit the cache. Their _strided and _random
+// variants walk a buffer larger than the last-level cache, where the checks'
+// shadow accesses miss as well. The unit kernels measure the cycles of one
+// simple instruction, which converts static cost estimates into cycles.
+
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define NOINLINE __attribute__((noinline))
+#define BUFFER_SIZE 4096
+#define STRIDE 24
+// The large buffer is a power of two of at least this size, and at least
+// twice the size of the last-level cache
+#define MIN_LARGE_BUFFER_SIZE (64ULL << 20)
+// A page and a cache line, so that consecutive accesses touch different
+// lines and pages, both in the buffer and in the shadow memory
+#define LARGE_STRIDE 4160
+#define UNIT_OPS 16
+#define NUM_RUNS 7
+
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+
+static unsigned char buffer[BUFFER_SIZE] __attribute__((aligned(64)));
+static unsigned char *large_buffer;
+static uint64_t large_buffer_size;
+static int values[64];
+static int table[64];
+
+static uint64_t now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Returns the next number of a xorshift sequence
+static inline uint64_t next_random(uint64_t x) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+// Loads and stores at varying, aligned addresses within the buffer, and at
+// strided or random addresses within the large buffer
+#define ACCESS_KERNELS(type, size)                                          \
+    static NOINLINE uint64_t load##size(uint64_t iterations) {              \
+        uint64_t sum = 0;                                                   \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (i * STRIDE) & (BUFFER_SIZE - 1) & ~(size - 1); \
+            sum += (uint64_t)*(type *)(buffer + offset);                    \
+        }                                                                   \
+        return sum;                                                         \
+    }                                                                       \
+    static NOINLINE uint64_t store##size(uint64_t iterations) {             \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (i * STRIDE) & (BUFFER_SIZE - 1) & ~(size - 1); \
+            *(type *)(buffer + offset) = (type)i;                           \
+        }                                                                   \
+        return buffer[iterations & (BUFFER_SIZE - 1)];                      \
+    }                                                                       \
+    LARGE_ACCESS_KERNELS(type, size, strided,                               \
+                         i * LARGE_STRIDE)                                  \
+    LARGE_ACCESS_KERNELS(type, size, random,                                \
+                         (x = next_random(x)) >> 16)
+
+#define LARGE_ACCESS_KERNELS(type, size, pattern, next_offset)              \
+    static NOINLINE uint64_t load##size##_##pattern(uint64_t iterations) {  \
+        uint64_t sum = 0, x = 88172645463325252ULL;                         \
+        uint64_t mask = large_buffer_size - 1;                              \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (next_offset) & mask & ~(size - 1);           \
+            sum += (uint64_t)*(type *)(large_buffer + offset);              \
+        }                                                                   \
+        return sum + x;                                                     \
+    }                                                                       \
+    static NOINLINE uint64_t store##size##_##pattern(uint64_t iterations) { \
+        uint64_t x = 88172645463325252ULL;                                  \
+        uint64_t mask = large_buffer_size - 1;                              \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (next_offset) & mask & ~(size - 1);           \
+            *(type *)(large_buffer + offset) = (type)i;                     \
+        }                                                                   \
+        return large_buffer[x & mask];                                      \
+    }
+
+ACCESS_KERNELS(uint8_t, 1)
+ACCESS_KERNELS(uint16_t, 2)
+ACCESS_KERNELS(uint32_t, 4)
+ACCESS_KERNELS(uint64_t, 8)
+
+static NOINLINE uint64_t load16(uint64_t iterations) {
+    v2u64 sum = {0, 0};
+    for (uint64_t i = 0; i < iterations; ++i) {
+        uint64_t offset = (i * STRIDE) & (BUFFER_SIZE - 1) & ~15;
+        sum += *(v2u64 *)(buffer + offset);
+    }
+    return sum[0] + sum[1];
+}
+
+static NOINLINE uint64_t store16(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; ++i) {
+        uint64_t offset = (i * STRIDE) & (BUFFER_SIZE - 1) & ~15;
+        v2u64 value = {i, i};
+        *(v2u64 *)(buffer + offset) = value;
+    }
+    return buffer[iterations & (BUFFER_SIZE - 1)];
+}
+
+#define LARGE_VECTOR_KERNELS(pattern, next_offset)                          \
+    static NOINLINE uint64_t load16_##pattern(uint64_t iterations) {        \
+        v2u64 sum = {0, 0};                                                 \
+        uint64_t x = 88172645463325252ULL;                                  \
+        uint64_t mask = large_buffer_size - 1;                              \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (next_offset) & mask & ~15;                   \
+            sum += *(v2u64 *)(large_buffer + offset);                       \
+        }                                                                   \
+        return sum[0] + sum[1] + x;                                         \
+    }                                                                       \
+    static NOINLINE uint64_t store16_##pattern(uint64_t iterations) {       \
+        uint64_t x = 88172645463325252ULL;                                  \
+        uint64_t mask = large_buffer_size - 1;                              \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            uint64_t offset = (next_offset) & mask & ~15;                   \
+            v2u64 value = {i, i};                                           \
+            *(v2u64 *)(large_buffer + offset) = value;                      \
+        }                                                                   \
+        return large_buffer[x & mask];                                      \
+    }
+
+LARGE_VECTOR_KERNELS(strided, i * LARGE_STRIDE)
+LARGE_VECTOR_KERNELS(random, (x = next_random(x)) >> 16)
+
+// Signed arithmetic on values that the compiler cannot see. The values are
+// zero or one, so that nothing overflows.
+#define ARITHMETIC_KERNEL(name, op)                                         \
+    static NOINLINE uint64_t name(uint64_t iterations) {                    \
+        int acc = 1;                                                        \
+        for (uint64_t i = 0; i < iterations; ++i) {                         \
+            acc = (acc op values[i & 63]) & 0xffff;                         \
+        }                                                                   \
+        return acc;                                                         \
+    }
+
+ARITHMETIC_KERNEL(add_overflow, +)
+ARITHMETIC_KERNEL(sub_overflow, -)
+ARITHMETIC_KERNEL(mul_overflow, *)
+
+// Indexes an array of known size with an index the compiler cannot see
+static NOINLINE uint64_t out_of_bounds(uint64_t iterations) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; ++i) {
+        sum += table[values[i & 63] + (i & 31)];
+    }
+    return sum;
+}
+
+// A chain of UNIT_OPS dependent additions, and the same loop without them.
+// The empty asm statements keep the compiler from combining the additions.
+static NOINLINE uint64_t unit(uint64_t iterations) {
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < iterations; ++i) {
+        for (int op = 0; op < UNIT_OPS; ++op) {
+            acc += i;
+            __asm__ volatile("" : "+r"(acc));
+        }
+    }
+    return acc;
+}
+
+static NOINLINE uint64_t unit_base(uint64_t iterations) {
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < iterations; ++i) {
+        __asm__ volatile("" : "+r"(acc));
+    }
+    return acc;
+}
+
+// Allocates the large buffer, and touches it so that page faults do not
+// count towards the first run
+static void allocate_large_buffer(void) {
+    uint64_t cache_size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size > 0) {
+        cache_size = size;
+    }
+#endif
+    large_buffer_size = MIN_LARGE_BUFFER_SIZE;
+    while (large_buffer_size < 2 * cache_size) {
+        large_buffer_size *= 2;
+    }
+    large_buffer = malloc(large_buffer_size);
+    if (!large_buffer) {
+        fprintf(stderr, "cannot allocate %llu bytes\n",
+                (unsigned long long)large_buffer_size);
+        exit(2);
+    }
+    memset(large_buffer, 0, large_buffer_size);
+}
+
+struct kernel {
+    const char *name;
+    uint64_t (*run)(uint64_t iterations);
+};
+
+static const struct kernel kernels[] = {
+    {"load1", load1}, {"load2", load2}, {"load4", load4},
+    {"load8", load8}, {"load16", load16},
+    {"store1", store1}, {"store2", store2}, {"store4", store4},
+    {"store8", store8}, {"store16", store16},
+#define LARGE_KERNEL_ENTRIES(pattern)                                       \
+    {"load1_" #pattern, load1_##pattern},                                   \
+    {"load2_" #pattern, load2_##pattern},                                   \
+    {"load4_" #pattern, load4_##pattern},                                   \
+    {"load8_" #pattern, load8_##pattern},                                   \
+    {"load16_" #pattern, load16_##pattern},                                 \
+    {"store1_" #pattern, store1_##pattern},                                 \
+    {"store2_" #pattern, store2_##pattern},                                 \
+    {"store4_" #pattern, store4_##pattern},                                 \
+    {"store8_" #pattern, store8_##pattern},                                 \
+    {"store16_" #pattern, store16_##pattern},
+    LARGE_KERNEL_ENTRIES(strided)
+    LARGE_KERNEL_ENTRIES(random)
+    {"add_overflow", add_overflow}, {"sub_overflow", sub_overflow},
+    {"mul_overflow", mul_overflow}, {"out_of_bounds", out_of_bounds},
+    {"unit", unit}, {"unit_base", unit_base},
+};
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <kernel> <iterations>\n", argv[0]);
+        return 2;
+    }
+
+    const struct kernel *k = 0;
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (strcmp(kernels[i].name, argv[1]) == 0) {
+            k = &kernels[i];
+        }
+    }
+    if (!k) {
+        fprintf(stderr, "unknown kernel: %s\n", argv[1]);
+        return 2;
+    }
+    uint64_t iterations = strtoull(argv[2], 0, 10);
+    if (iterations == 0) {
+        fprintf(stderr, "invalid number of iterations: %s\n", argv[2]);
+        return 2;
+    }
+
+    if (strstr(k->name, "_strided") || strstr(k->name, "_random")) {
+        allocate_large_buffer();
+    }
+
+    // argc is 3, but the compiler does not know that
+    for (int i = 0; i < 64; ++i) {
+        values[i] = (argc - 3 + i) & 1;
+        table[i] = i;
+    }
+
+    uint64_t best = UINT64_MAX;
+    uint64_t result = 0;
+    for (int run = 0; run < NUM_RUNS; ++run) {
+        uint64_t start = now();
+        result += k->run(iterations);
+        uint64_t elapsed = now() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("%.4f\n", (double)best / iterations);
+    return result == 42 ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+// Runtime support for programs instrumented with -asap-profiling. Each
+// instrumented module registers its check IDs and counters at startup; at
+// exit, all counters are merged into an indexed check profile, which is read
+// by SanityCheckCostPass with -asap-profile.
+//
+// The profile format is described in CheckProfile.h. Counts from earlier runs
+// that are already in the profile file are added to the new counts.
+
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ASAP_PROFILE_MAGIC 0x464f525050415341ULL  // "ASAPPROF"
+#define ASAP_PROFILE_VERSION 2
+
+struct asap_module {
+    const uint64_t *ids;
+    uint64_t *counters;
+    uint64_t num_checks;
+    struct asap_module *next;
+};
+
+static struct asap_module *asap_modules = 0;
+static const char *asap_profile_file = 0;
+
+// Adds a count to an open-addressing table of (id, count) pairs.
+static void asap_table_add(uint64_t *buckets, uint64_t num_buckets,
+                           uint64_t id, uint64_t count) {
+    uint64_t mask = num_buckets - 1;
+    uint64_t i = id & mask;
+    while (buckets[2 * i] != 0 && buckets[2 * i] != id) {
+        i = (i + 1) & mask;
+    }
+    buckets[2 * i] = id;
+    buckets[2 * i + 1] += count;
+}
+
+static int asap_read_all(int fd, void *buf, size_t size) {
+    char *p = buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int asap_write_all(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Returns nonzero if the header of the profile in fd describes a table that
+// the rest of the file holds exactly. The header comes from a file, so the
+// bucket count must be checked before it is used in any size computation.
+static int asap_valid_table(int fd, uint64_t num_buckets,
+                            uint64_t num_entries) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(4 * sizeof(uint64_t))) {
+        return 0;
+    }
+    uint64_t table_size = (uint64_t)st.st_size - 4 * sizeof(uint64_t);
+    if (num_buckets == 0 || (num_buckets & (num_buckets - 1)) != 0 ||
+            num_buckets > table_size / (2 * sizeof(uint64_t)) ||
+            num_entries > num_buckets) {
+        return 0;
+    }
+    return table_size == 2 * num_buckets * sizeof(uint64_t);
+}
+
+static void asap_write_profile(void) {
+    const char *file_name = getenv("ASAP_PROFILE_FILE");
+    if (!file_name) file_name = asap_profile_file;
+
+    int fd = open(file_name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "asap: cannot open profile %s\n", file_name);
+        return;
+    }
+    // Several instrumented processes may exit at the same time.
+    flock(fd, LOCK_EX);
+
+    // Read the existing profile, if any
+    uint64_t header[4] = {0, 0, 0, 0};
+    uint64_t *old_buckets = 0;
+    uint64_t old_num_buckets = 0;
+    uint64_t old_num_entries = 0;
+    if (asap_read_all(fd, header, sizeof(header)) == 0 &&
+            header[0] == ASAP_PROFILE_MAGIC &&
+            header[1] == ASAP_PROFILE_VERSION) {
+        old_num_buckets = header[2];
+        old_num_entries = header[3];
+        if (!asap_valid_table(fd, old_num_buckets, old_num_entries)) {
+            fprintf(stderr, "asap: ignoring invalid profile %s\n", file_name);
+            old_num_buckets = 0;
+            old_num_entries = 0;
+        }
+    }
+    if (old_num_buckets != 0) {
+        old_buckets = calloc(2 * old_num_buckets, sizeof(uint64_t));
+        if (!old_buckets ||
+                asap_read_all(fd, old_buckets,
+                              2 * old_num_buckets * sizeof(uint64_t)) != 0) {
+            free(old_buckets);
+            old_buckets = 0;
+            old_num_buckets = 0;
+            old_num_entries = 0;
+        }
+    }
+
+    // Size the new table for at most 50% load
+    uint64_t num_entries = old_num_entries;
+    for (struct asap_module *m = asap_modules; m; m = m->next) {
+        num_entries += m->num_checks;
+    }
+    uint64_t num_buckets = 16;
+    while (num_buckets < 2 * num_entries) {
+        num_buckets *= 2;
+    }
+
+    uint64_t *buckets = calloc(2 * num_buckets, sizeof(uint64_t));
+    if (!buckets) {
+        fprintf(stderr, "asap: out of memory writing profile %s\n", file_name);
+        free(old_buckets);
+        close(fd);
+        return;
+    }
+    for (uint64_t i = 0; i < old_num_buckets; ++i) {
+        if (old_buckets[2 * i] != 0) {
+            asap_table_add(buckets, num_buckets,
+                           old_buckets[2 * i], old_buckets[2 * i + 1]);
+        }
+    }
+    for (struct asap_module *m = asap_modules; m; m = m->next) {
+        for (uint64_t i = 0; i < m->num_checks; ++i) {
+            asap_table_add(buckets, num_buckets, m->ids[i], m->counters[i]);
+        }
+    }
+
+    num_entries = 0;
+    for (uint64_t i = 0; i < num_buckets; ++i) {
+        if (buckets[2 * i] != 0) num_entries += 1;
+    }
+
+    header[0] = ASAP_PROFILE_MAGIC;
+    header[1] = ASAP_PROFILE_VERSION;
+    header[2] = num_buckets;
+    header[3] = num_entries;
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+            asap_write_all(fd, header, sizeof(header)) != 0 ||
+            asap_write_all(fd, buckets,
+                           2 * num_buckets * sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "asap: cannot write profile %s\n", file_name);
+    }
+
+    free(buckets);
+    free(old_buckets);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+void __asap_register_checks(const uint64_t *ids, uint64_t *counters,
+                            uint64_t num_checks, const char *file_name) {
+    struct asap_module *m = malloc(sizeof(struct asap_module));
+    if (!m) return;
+    m->ids = ids;
+    m->counters = counters;
+    m->num_checks = num_checks;
+    m->next = asap_modules;
+
+    if (!asap_modules) {
+        asap_profile_file = file_name;
+        atexit(asap_write_profile);
+    }
+    asap_modules = m;
+}
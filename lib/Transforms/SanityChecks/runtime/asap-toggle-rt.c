@@ -0,0 +1,121 @@
+// Runtime support for programs built with -asap-toggleable-checks. Each
+// module registers the IDs, costs and enable bytes of its checks at startup,
+// and unregisters them when it is unloaded; the functions in asap-toggle.h
+// then change the enable bytes, which the checks read before they run.
+
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#include "asap-toggle.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct asap_toggle_module {
+    const uint64_t *ids;
+    const uint64_t *costs;
+    uint8_t *enabled;
+    uint64_t num_checks;
+    struct asap_toggle_module *next;
+};
+
+static struct asap_toggle_module *asap_toggle_modules = 0;
+static pthread_mutex_t asap_toggle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void asap_set_enabled(uint8_t *flag, int enabled) {
+    __atomic_store_n(flag, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static uint64_t asap_apply_threshold(struct asap_toggle_module *m,
+                                     uint64_t threshold) {
+    uint64_t num_enabled = 0;
+    for (uint64_t i = 0; i < m->num_checks; ++i) {
+        int enabled = m->costs[i] < threshold;
+        asap_set_enabled(&m->enabled[i], enabled);
+        num_enabled += enabled;
+    }
+    return num_enabled;
+}
+
+void __asap_register_toggles(const uint64_t *ids, const uint64_t *costs,
+                             uint8_t *enabled, uint64_t num_checks) {
+    struct asap_toggle_module *m = malloc(sizeof(struct asap_toggle_module));
+    if (!m) return;
+    m->ids = ids;
+    m->costs = costs;
+    m->enabled = enabled;
+    m->num_checks = num_checks;
+
+    const char *threshold = getenv("ASAP_COST_THRESHOLD");
+    if (threshold && *threshold) {
+        asap_apply_threshold(m, strtoull(threshold, 0, 10));
+    }
+
+    pthread_mutex_lock(&asap_toggle_lock);
+    m->next = asap_toggle_modules;
+    asap_toggle_modules = m;
+    pthread_mutex_unlock(&asap_toggle_lock);
+}
+
+void __asap_unregister_toggles(uint8_t *enabled) {
+    pthread_mutex_lock(&asap_toggle_lock);
+    for (struct asap_toggle_module **m = &asap_toggle_modules; *m;
+         m = &(*m)->next) {
+        if ((*m)->enabled == enabled) {
+            struct asap_toggle_module *dead = *m;
+            *m = dead->next;
+            free(dead);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&asap_toggle_lock);
+}
+
+uint64_t asap_set_check_enabled(uint64_t id, int enabled) {
+    uint64_t num_sites = 0;
+    pthread_mutex_lock(&asap_toggle_lock);
+    for (struct asap_toggle_module *m = asap_toggle_modules; m; m = m->next) {
+        for (uint64_t i = 0; i < m->num_checks; ++i) {
+            if (m->ids[i] == id) {
+                asap_set_enabled(&m->enabled[i], enabled);
+                num_sites += 1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&asap_toggle_lock);
+    return num_sites;
+}
+
+uint64_t asap_set_cost_threshold(uint64_t threshold) {
+    uint64_t num_enabled = 0;
+    pthread_mutex_lock(&asap_toggle_lock);
+    for (struct asap_toggle_module *m = asap_toggle_modules; m; m = m->next) {
+        num_enabled += asap_apply_threshold(m, threshold);
+    }
+    pthread_mutex_unlock(&asap_toggle_lock);
+    return num_enabled;
+}
+
+uint64_t asap_set_all_checks_enabled(int enabled) {
+    uint64_t num_sites = 0;
+    pthread_mutex_lock(&asap_toggle_lock);
+    for (struct asap_toggle_module *m = asap_toggle_modules; m; m = m->next) {
+        for (uint64_t i = 0; i < m->num_checks; ++i) {
+            asap_set_enabled(&m->enabled[i], enabled);
+        }
+        num_sites += m->num_checks;
+    }
+    pthread_mutex_unlock(&asap_toggle_lock);
+    return num_sites;
+}
+
+void asap_for_each_check(asap_check_visitor visit, void *arg) {
+    pthread_mutex_lock(&asap_toggle_lock);
+    for (struct asap_toggle_module *m = asap_toggle_modules; m; m = m->next) {
+        for (uint64_t i = 0; i < m->num_checks; ++i) {
+            visit(m->ids[i], m->costs[i],
+                  __atomic_load_n(&m->enabled[i], __ATOMIC_RELAXED), arg);
+        }
+    }
+    pthread_mutex_unlock(&asap_toggle_lock);
+}
@@ -0,0 +1,43 @@
+// Interface of the ASAP toggle runtime, for programs built with
+// -asap-toggleable-checks. Each toggleable check has a stable ID and the cost
+// that ASAP computed for it. Checks can be enabled and disabled at any time,
+// from any thread; a change takes effect the next time the check is reached.
+//
+// At startup, the runtime applies the cost threshold in the
+// ASAP_COST_THRESHOLD environment variable, if it is set. Otherwise, checks
+// start in the state chosen when the program was built.
+
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+
+#ifndef ASAP_TOGGLE_H
+#define ASAP_TOGGLE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Enables or disables the check with the given ID. Returns the number of
+// check sites with that ID; inlining can create several.
+uint64_t asap_set_check_enabled(uint64_t id, int enabled);
+
+// Enables all checks that cost less than the given threshold, and disables
+// the others, like -asap-cost-threshold does at build time. Returns the
+// number of enabled check sites.
+uint64_t asap_set_cost_threshold(uint64_t threshold);
+
+// Enables or disables all checks. Returns the number of check sites.
+uint64_t asap_set_all_checks_enabled(int enabled);
+
+// Calls the given function for every check site.
+typedef void (*asap_check_visitor)(uint64_t id, uint64_t cost, int enabled,
+                                   void *arg);
+void asap_for_each_check(asap_check_visitor visit, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ASAP_TOGGLE_H
@@ -6,11 +6,29 @@
 #include "utils.h"
 #include "SanityCheckInstructionsPass.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <vector>
 using namespace llvm;
 
 static cl::opt<bool>
@@ -23,6 +41,12 @@ OptimizeAssertions("asap-optimize-assertions",
         cl::desc("Should ASAP affect programmer-written assertions?"),
         cl::init(true));
 
+static cl::opt<unsigned>
+NumThreads("asap-threads",
+        cl::desc("Number of threads that analyze functions in parallel; 0 "
+                 "uses all cores"),
+        cl::init(1));
+
 // Returns true if a given instruction is a call to an aborting, error reporting
 // function
 bool isAbortingCall(const CallInst *CI) {
@@ -37,6 +61,10 @@ bool isAbortingCall(const CallInst *CI) {
         if (name.startswith("__asan_report_")) {
             return OptimizeSanityChecks;
         }
+        // Also matches the _with_origin variant of newer runtimes
+        if (name.startswith("__msan_warning") && name.endswith("_noreturn")) {
+            return OptimizeSanityChecks;
+        }
         if (name == "__assert_fail" || name == "__assert_rtn") {
             return OptimizeAssertions;
         }
@@ -44,6 +72,190 @@ bool isAbortingCall(const CallInst *CI) {
     return false;
 }
 
+// TSan's memory access callbacks do not abort, and usually sit in the middle
+// of regular code. With -tsan-guard-accesses, however, each callback gets a
+// block of its own, entered through a branch on true. ASAP treats such a
+// block like the error block of a check, and removes the callback by
+// redirecting the branch. Returns true for callbacks in such blocks.
+bool isGuardedTsanCall(const CallInst *CI) {
+    if (!CI->getCalledFunction()) {
+        return false;
+    }
+    StringRef name = CI->getCalledFunction()->getName();
+    if (!name.startswith("__tsan_read") && !name.startswith("__tsan_write") &&
+            !name.startswith("__tsan_unaligned_")) {
+        return false;
+    }
+
+    const BasicBlock *BB = CI->getParent();
+    const BasicBlock *Pred = BB->getSinglePredecessor();
+    if (!Pred) {
+        return false;
+    }
+    const BranchInst *Guard = dyn_cast<BranchInst>(Pred->getTerminator());
+    if (!Guard || !Guard->isConditional()) {
+        return false;
+    }
+
+    // The block may only contain the callback, the cast of its argument, and
+    // the branch back to regular code.
+    for (const Instruction &I : *BB) {
+        if (&I == CI || &I == BB->getTerminator()) {
+            continue;
+        }
+        if (!isa<CastInst>(I) || !I.hasOneUse() || *I.user_begin() != CI) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// With -msan-keep-going, MSan reports errors and continues. Such reports do
+// not abort, so -asap-exit-instead-of-abort must leave them alone.
+static bool isRecoverableMsanCall(const CallInst *CI) {
+    if (!CI->getCalledFunction()) {
+        return false;
+    }
+    StringRef name = CI->getCalledFunction()->getName();
+    return name == "__msan_warning" || name == "__msan_warning_with_origin";
+}
+
+bool isSanityCheckCall(const CallInst *CI) {
+    if (isAbortingCall(CI)) {
+        return true;
+    }
+    return (isRecoverableMsanCall(CI) || isGuardedTsanCall(CI)) &&
+        OptimizeSanityChecks;
+}
+
+// ASan reports have the form __asan_report_[exp_](load|store)(<size>|_n),
+// possibly followed by _noabort. Their first argument is the address as an
+// integer; the _n variants take the size as second argument.
+Value *getAsanReportedAccess(const CallInst *CI, uint64_t *Size,
+        bool *IsWrite) {
+    if (!CI->getCalledFunction() || CI->getNumArgOperands() == 0) {
+        return nullptr;
+    }
+    StringRef Kind = CI->getCalledFunction()->getName();
+    if (!Kind.startswith("__asan_report_")) {
+        return nullptr;
+    }
+    Kind = Kind.substr(strlen("__asan_report_"));
+    if (Kind.startswith("exp_")) {
+        Kind = Kind.substr(strlen("exp_"));
+    }
+    *IsWrite = Kind.startswith("store");
+    StringRef SizeStr =
+        Kind.drop_front(strlen(*IsWrite ? "store" : "load")).split('_').first;
+
+    *Size = 0;
+    if (SizeStr.empty() && CI->getNumArgOperands() > 1) {
+        if (ConstantInt *C = dyn_cast<ConstantInt>(CI->getArgOperand(1))) {
+            *Size = C->getZExtValue();
+        }
+    } else if (SizeStr.getAsInteger(10, *Size)) {
+        *Size = 0;
+    }
+
+    Value *Addr = CI->getArgOperand(0);
+    if (PtrToIntOperator *P = dyn_cast<PtrToIntOperator>(Addr)) {
+        Addr = P->getOperand(0);
+    }
+    return Addr;
+}
+
+StringRef getSanityCheckKind(const CallInst *CI) {
+    if (!CI->getCalledFunction()) {
+        return "other";
+    }
+    StringRef Name = CI->getCalledFunction()->getName();
+    uint64_t Size;
+    bool IsWrite;
+    if (getAsanReportedAccess(CI, &Size, &IsWrite)) {
+        return IsWrite ? "asan-write" : "asan-read";
+    }
+    if (Name.startswith("__ubsan_handle_")) {
+        return "ubsan";
+    }
+    if (Name == "__assert_fail" || Name == "__assert_rtn") {
+        return "assertion";
+    }
+    if (Name.startswith("__tsan_")) {
+        return "tsan";
+    }
+    if (Name.startswith("__msan_warning")) {
+        return "msan";
+    }
+    return "other";
+}
+
+void getDynamicallyInitializedGlobals(const Module &M, GlobalSet &Globals) {
+    const NamedMDNode *AsanGlobals = M.getNamedMetadata("llvm.asan.globals");
+    if (!AsanGlobals) {
+        return;
+    }
+    // Each entry holds the global, its source location, its name, whether
+    // it is dynamically initialized, and whether it is blacklisted.
+    for (const MDNode *MDN : AsanGlobals->operands()) {
+        if (MDN->getNumOperands() != 5) {
+            continue;
+        }
+        auto *GV =
+            mdconst::extract_or_null<GlobalVariable>(MDN->getOperand(0));
+        auto *IsDynInit =
+            mdconst::extract_or_null<ConstantInt>(MDN->getOperand(3));
+        if (GV && IsDynInit && IsDynInit->isOne()) {
+            Globals.insert(GV);
+        }
+    }
+}
+
+// ASan poisons the memory of an alloca outside of its lifetime markers, so
+// that accesses through stale pointers fail even if they are in bounds.
+static bool hasLifetimeMarkers(const AllocaInst *AI) {
+    SmallVector<const Value*, 8> Worklist(1, AI);
+    while (!Worklist.empty()) {
+        const Value *V = Worklist.pop_back_val();
+        for (const User *U : V->users()) {
+            if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(U)) {
+                if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+                        II->getIntrinsicID() == Intrinsic::lifetime_end) {
+                    return true;
+                }
+            } else if (isa<BitCastInst>(U)) {
+                Worklist.push_back(U);
+            }
+        }
+    }
+    return false;
+}
+
+bool isSafeObject(const Value *Object, const GlobalSet &DynInitGlobals) {
+    if (const AllocaInst *AI = dyn_cast<AllocaInst>(Object)) {
+        return !hasLifetimeMarkers(AI);
+    }
+    if (const GlobalVariable *GV = dyn_cast<GlobalVariable>(Object)) {
+        return GV->hasDefinitiveInitializer() && !DynInitGlobals.count(GV);
+    }
+    return false;
+}
+
+bool isAccessInBounds(Value *Addr, uint64_t Size, const DataLayout &DL,
+        const TargetLibraryInfo *TLI, const GlobalSet &DynInitGlobals) {
+    if (!isSafeObject(GetUnderlyingObject(Addr, DL), DynInitGlobals)) {
+        return false;
+    }
+    ObjectSizeOffsetVisitor Visitor(DL, TLI, Addr->getContext());
+    SizeOffsetType SizeOffset = Visitor.compute(Addr);
+    if (!Visitor.bothKnown(SizeOffset)) {
+        return false;
+    }
+    const APInt &ObjectSize = SizeOffset.first;
+    const APInt &Offset = SizeOffset.second;
+    return !Offset.isNegative() && Offset.ule(ObjectSize) &&
+        (ObjectSize - Offset).uge(Size);
+}
+
 unsigned int getRegularBranch(BranchInst *BI, SanityCheckInstructionsPass *SCI) {
     unsigned int RegularBranch = (unsigned)(-1);
     Function *F = BI->getParent()->getParent();
@@ -92,3 +304,204 @@ void printDebugLoc(const DebugLoc& DbgLoc,
         Outs << ':' << DL->getColumn();
     }
 }
+
+void getSanityCheckIds(Function *F, SanityCheckInstructionsPass *SCI,
+        DenseMap<BranchInst *, uint64_t> &Ids) {
+    // Use the name that the function has in the source code; the IR name can
+    // change when modules are linked. The file tells apart local functions
+    // of the same name in different translation units.
+    StringRef FunctionName = F->getName();
+    StringRef FileName;
+    if (DISubprogram *SP = getDISubprogram(F)) {
+        FunctionName = SP->getLinkageName().empty() ? SP->getName()
+                                                    : SP->getLinkageName();
+        FileName = SP->getFilename();
+    }
+
+    const auto &Checks = SCI->getSanityCheckBranches(F);
+    StringMap<unsigned> Occurrences;
+    for (Instruction &I : inst_range(F)) {
+        BranchInst *BI = dyn_cast<BranchInst>(&I);
+        if (!BI || !Checks.count(BI)) {
+            continue;
+        }
+
+        std::string Key;
+        raw_string_ostream KeyStream(Key);
+        KeyStream << FileName << ':' << FunctionName;
+
+        unsigned int RegularBranch = getRegularBranch(BI, SCI);
+        DILocation *DL = dyn_cast_or_null<DILocation>(
+            getSanityCheckDebugLoc(BI, RegularBranch).getAsMDNode());
+        for (; DL; DL = DL->getInlinedAt()) {
+            KeyStream << ':' << DL->getLine() << ':' << DL->getColumn();
+        }
+
+        BasicBlock *Succ = BI->getSuccessor(RegularBranch == 0 ? 1 : 0);
+        if (const CallInst *CI = SCI->findSanityCheckCall(Succ)) {
+            KeyStream << ':' << CI->getCalledFunction()->getName();
+        }
+        KeyStream << ':' << Occurrences[KeyStream.str()]++;
+
+        MD5 Hash;
+        MD5::MD5Result Result;
+        Hash.update(KeyStream.str());
+        Hash.final(Result);
+
+        uint64_t Id = 0;
+        for (int i = 7; i >= 0; --i) {
+            Id = (Id << 8) | Result[i];
+        }
+        // Zero marks empty slots in check profiles
+        Ids[BI] = Id != 0 ? Id : 1;
+    }
+}
+
+static bool isCheckInstruction(const Instruction *I) {
+    return I->getMetadata("sanitycheck") != nullptr;
+}
+
+static bool containsOnlyChecks(const BasicBlock *BB) {
+    for (const Instruction &I : *BB) {
+        if (!isCheckInstruction(&I)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the first instruction of the code that computes a sanity check, if
+// that code forms a region that can be skipped as a whole, or null otherwise.
+// The region consists of the sanity check instructions at the end of a basic
+// block, and possibly of blocks below it that only contain sanity checks, such
+// as the slow path of ASan's checks for small accesses. All paths through the
+// region lead to the check's regular successor or to sanity check blocks, and
+// its values are not used elsewhere.
+Instruction *findCheckRegion(BranchInst *BI,
+                             SanityCheckInstructionsPass *SCI) {
+    unsigned int RegularBranch = getRegularBranch(BI, SCI);
+    if (RegularBranch == (unsigned)(-1)) {
+        return nullptr;
+    }
+
+    // Skipping the check adds an edge to the regular successor, which would
+    // need new incoming values for its PHI nodes.
+    BasicBlock *Cont = BI->getSuccessor(RegularBranch);
+    if (isa<PHINode>(Cont->begin())) {
+        return nullptr;
+    }
+
+    // Walk up through blocks that only contain sanity checks, to find the
+    // block where the check's code starts. This stops at other checks.
+    const SanityCheckInstructionsPass::InstructionSet &Checks =
+        SCI->getSanityCheckBranches(BI->getParent()->getParent());
+    SmallPtrSet<BasicBlock *, 4> Region;
+    BasicBlock *Head = BI->getParent();
+    Region.insert(Head);
+    while (containsOnlyChecks(Head)) {
+        BasicBlock *Pred = Head->getSinglePredecessor();
+        if (!Pred || Region.count(Pred) ||
+                !isCheckInstruction(Pred->getTerminator()) ||
+                Checks.count(Pred->getTerminator())) {
+            break;
+        }
+        Head = Pred;
+        Region.insert(Head);
+    }
+    if (Region.count(Cont)) {
+        return nullptr;
+    }
+
+    // The region starts with the sanity check instructions at the end of
+    // Head.
+    BasicBlock::iterator Entry = Head->getTerminator();
+    if (!isCheckInstruction(Entry)) {
+        return nullptr;
+    }
+    while (Entry != Head->begin()) {
+        BasicBlock::iterator Prev = std::prev(Entry);
+        if (isa<PHINode>(Prev) || !isCheckInstruction(Prev)) {
+            break;
+        }
+        Entry = Prev;
+    }
+
+    SmallPtrSet<Instruction *, 16> HeadInstructions;
+    for (BasicBlock::iterator I = Entry, E = Head->end(); I != E; ++I) {
+        HeadInstructions.insert(I);
+    }
+    auto InRegion = [&](Instruction *I) {
+        BasicBlock *BB = I->getParent();
+        return BB == Head ? HeadInstructions.count(I) != 0
+                          : Region.count(BB) != 0;
+    };
+
+    // The region must contain everything the check computes...
+    for (Instruction *I : SCI->getInstructionsBySanityCheck(BI)) {
+        if (!InRegion(I)) {
+            return nullptr;
+        }
+    }
+
+    // ... and only lead to the regular successor or to sanity check blocks
+    // that cannot be entered from elsewhere. Its values must not be used
+    // outside of these blocks.
+    const SanityCheckInstructionsPass::BlockSet &CheckBlocks =
+        SCI->getSanityCheckBlocks(Head->getParent());
+    auto IsRegionExit = [&](BasicBlock *BB) {
+        if (!CheckBlocks.count(BB)) {
+            return false;
+        }
+        for (BasicBlock *Pred : predecessors(BB)) {
+            if (!Region.count(Pred)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for (BasicBlock *BB : Region) {
+        for (BasicBlock *Succ : successors(BB)) {
+            if (Succ == Head ||
+                    !(Succ == Cont || Region.count(Succ) ||
+                      IsRegionExit(Succ))) {
+                return nullptr;
+            }
+        }
+        BasicBlock::iterator Begin = BB == Head ? Entry : BB->begin();
+        for (BasicBlock::iterator I = Begin, E = BB->end(); I != E; ++I) {
+            for (User *U : I->users()) {
+                Instruction *UI = cast<Instruction>(U);
+                if (!InRegion(UI) && !IsRegionExit(UI->getParent())) {
+                    return nullptr;
+                }
+            }
+        }
+    }
+
+    return Entry;
+}
+
+void parallelFor(size_t N, const std::function<void(size_t)> &Body) {
+    unsigned Threads = NumThreads;
+    if (Threads == 0) {
+        Threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Each thread takes the next index until none are left; the calling
+    // thread works as well.
+    std::atomic<size_t> Next(0);
+    auto Worker = [&]() {
+        for (size_t I = Next++; I < N; I = Next++) {
+            Body(I);
+        }
+    };
+
+    std::vector<std::thread> Workers;
+    for (unsigned I = 1; I < Threads && I < N; ++I) {
+        Workers.emplace_back(Worker);
+    }
+    Worker();
+    for (std::thread &T : Workers) {
+        T.join();
+    }
+}
@@ -4,12 +4,26 @@
 #ifndef SANITYCHECKS_UTILS_H
 #define	SANITYCHECKS_UTILS_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/DebugLoc.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
 namespace llvm {
     class BranchInst;
     class CallInst;
+    class DataLayout;
+    class Function;
+    class GlobalVariable;
+    class Instruction;
     class LLVMContext;
+    class Module;
+    class TargetLibraryInfo;
+    class Value;
     class raw_ostream;
 }
 
@@ -19,6 +33,46 @@ struct SanityCheckInstructionsPass;
 // function
 bool isAbortingCall(const llvm::CallInst *CI);
 
+// Returns true if a given instruction is a call that marks a sanity check
+// block. These are the aborting calls above, MSan's recoverable reports, and
+// TSan memory access callbacks that have been guarded with
+// -tsan-guard-accesses.
+bool isSanityCheckCall(const llvm::CallInst *CI);
+
+// Returns true if a given instruction is a TSan memory access callback in a
+// block of its own, as inserted with -tsan-guard-accesses
+bool isGuardedTsanCall(const llvm::CallInst *CI);
+
+// If CI reports an ASan error, returns the address of the faulting access,
+// and stores its size in Size (0 if unknown) and whether it is a write in
+// IsWrite. Returns null for other calls.
+llvm::Value *getAsanReportedAccess(const llvm::CallInst *CI, uint64_t *Size,
+        bool *IsWrite);
+
+// Returns the kind of sanity check whose failure CI reports: "asan-read",
+// "asan-write", "ubsan", "assertion", "tsan", "msan" or "other".
+llvm::StringRef getSanityCheckKind(const llvm::CallInst *CI);
+
+// Globals that ASan initializes dynamically, according to the
+// llvm.asan.globals metadata
+typedef llvm::SmallPtrSet<const llvm::GlobalVariable*, 8> GlobalSet;
+void getDynamicallyInitializedGlobals(const llvm::Module &M,
+        GlobalSet &Globals);
+
+// Returns true if in-bounds accesses to Object can never fail an ASan check,
+// mirroring AddressSanitizer::isSafeAccess. This holds for allocas that no
+// llvm.lifetime intrinsic refers to, and for globals whose initializer is
+// final at link time. Heap objects are never safe: they may have been freed.
+bool isSafeObject(const llvm::Value *Object,
+        const GlobalSet &DynInitGlobals);
+
+// Returns true if Size bytes at Addr are known to lie within the object that
+// Addr points to, based on the object's allocation, and that object is safe
+// (see isSafeObject).
+bool isAccessInBounds(llvm::Value *Addr, uint64_t Size,
+        const llvm::DataLayout &DL, const llvm::TargetLibraryInfo *TLI,
+        const GlobalSet &DynInitGlobals);
+
 // Returns the index of the regular branch of a sanity check, i.e., the branch
 // that continues program execution. Returns (unsigned) -1 if such a branch does
 // not exist.
@@ -32,5 +86,29 @@ llvm::DebugLoc getSanityCheckDebugLoc(llvm::BranchInst *BI,
 void printDebugLoc(const llvm::DebugLoc& DbgLoc, llvm::LLVMContext &Ctx,
         llvm::raw_ostream &Outs);
 
+// Computes stable identifiers for all sanity checks in a function. An
+// identifier is a hash of the function's name and file, the check's debug
+// location including its inlined-at chain, and the name of the function that
+// reports the error. It does not depend on the order of basic blocks. Checks
+// that would get the same hash are numbered in instruction order.
+void getSanityCheckIds(llvm::Function *F, SanityCheckInstructionsPass *SCI,
+        llvm::DenseMap<llvm::BranchInst *, uint64_t> &Ids);
+
+// Returns the first instruction of the code that computes a sanity check, if
+// that code forms a region that can be skipped as a whole, or null otherwise.
+// The region consists of the sanity check instructions at the end of a basic
+// block, and possibly of blocks below it that only contain sanity checks, such
+// as the slow path of ASan's checks for small accesses. All paths through the
+// region lead to the check's regular successor or to sanity check blocks, and
+// its values are not used elsewhere.
+llvm::Instruction *findCheckRegion(llvm::BranchInst *BI,
+        SanityCheckInstructionsPass *SCI);
+
+// Calls Body(0) ... Body(N - 1) on the number of threads given by
+// -asap-threads, and returns when all calls are done. Bodies must only read
+// the IR: the LLVMContext, which owns metadata and constants, is not
+// thread-safe.
+void parallelFor(size_t N, const std::function<void(size_t)> &Body);
+
 #endif	/* SANITYCHECKS_UTILS_H */
 
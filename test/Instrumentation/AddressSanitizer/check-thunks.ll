@@ -0,0 +1,105 @@
+; Test asan internal compiler flags:
+;   -asan-check-thunks
+;   -asan-check-thunks-hot-count
+
+; RUN: opt < %s -asan -asan-module -asan-check-thunks -S | FileCheck %s --check-prefix=CHECK-THUNK
+; RUN: opt < %s -asan -asan-module -asan-check-thunks -asan-check-thunks-hot-count=10000 -S | FileCheck %s --check-prefix=CHECK-COLD-PROFILE
+; RUN: opt < %s -asan -asan-module -asan-check-thunks -mtriple=aarch64-unknown-linux-gnu -S | FileCheck %s --check-prefix=CHECK-CCONV
+; RUN: opt < %s -asan -asan-module -S | FileCheck %s --check-prefix=CHECK-INLINE
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Accesses outside of loops are cold, and call the thunks.
+define i32 @test_cold(i32* %a, i64* %b) sanitize_address {
+entry:
+; CHECK-THUNK-LABEL: @test_cold
+; CHECK-THUNK: call preserve_mostcc void @__asan_check_load4(i64 %{{.*}})
+; CHECK-THUNK-NEXT: load i32
+; CHECK-THUNK: call preserve_mostcc void @__asan_check_store8(i64 %{{.*}})
+; CHECK-THUNK-NEXT: store i64
+; CHECK-THUNK: ret i32
+; CHECK-CCONV-LABEL: @test_cold
+; CHECK-CCONV: call void @__asan_check_load4(i64 %{{.*}})
+; CHECK-CCONV: call void @__asan_check_store8(i64 %{{.*}})
+; CHECK-INLINE-LABEL: @test_cold
+; CHECK-INLINE: call void @__asan_report_load4
+; CHECK-INLINE-NOT: __asan_check_
+  %tmp1 = load i32, i32* %a, align 4
+  store i64 0, i64* %b, align 8
+  ret i32 %tmp1
+}
+
+; Accesses in loops are hot, and keep inline checks.
+define i32 @test_loop(i16* %a, i64 %n) sanitize_address {
+entry:
+  br label %loop
+; CHECK-THUNK-LABEL: @test_loop
+; CHECK-THUNK-NOT: call preserve_mostcc void @__asan_check_
+; CHECK-THUNK: call void @__asan_report_load2
+; CHECK-THUNK: ret i32
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %loop ]
+  %p = getelementptr i16, i16* %a, i64 %i
+  %v = load i16, i16* %p, align 2
+  %v.ext = sext i16 %v to i32
+  %sum.next = add i32 %sum, %v.ext
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %sum.next
+}
+
+; With a profile, accesses are hot if they ran more often than
+; -asan-check-thunks-hot-count.
+define void @test_profile(i32* %a) sanitize_address !prof !0 {
+entry:
+; CHECK-THUNK-LABEL: @test_profile
+; CHECK-THUNK-NOT: call preserve_mostcc void @__asan_check_
+; CHECK-THUNK: call void @__asan_report_store4
+; CHECK-THUNK: ret void
+; CHECK-COLD-PROFILE-LABEL: @test_profile
+; CHECK-COLD-PROFILE: call preserve_mostcc void @__asan_check_store4(i64 %{{.*}})
+; CHECK-COLD-PROFILE-NEXT: store i32
+  store i32 0, i32* %a, align 4
+  ret void
+}
+
+; The thunks are internal, so that ASAP can remove their checks in one module
+; without affecting others. Each thunk only tests the shadow byte, and calls
+; its _slow part for the rest of the check. Unused thunks are removed.
+; CHECK-THUNK-NOT: @__asan_check_load1
+; CHECK-THUNK-LABEL: define internal preserve_mostcc void @__asan_check_load4_slow(i64 %addr)
+; CHECK-THUNK: and i64 %addr, 7
+; CHECK-THUNK: icmp sge i8
+; CHECK-THUNK: call void @__asan_report_load4(i64 %addr)
+; CHECK-THUNK: unreachable
+; CHECK-THUNK: ret void
+
+; CHECK-THUNK-LABEL: define internal preserve_mostcc void @__asan_check_load4(i64 %addr)
+; CHECK-THUNK: lshr i64 %addr, 3
+; CHECK-THUNK: [[CMP:%[0-9]+]] = icmp ne i8
+; CHECK-THUNK: br i1 [[CMP]], label %[[SLOW:[0-9]+]], label %[[RET:[0-9]+]], !prof
+; CHECK-THUNK: ; <label>:[[SLOW]]
+; CHECK-THUNK-NEXT: call preserve_mostcc void @__asan_check_load4_slow(i64 %addr)
+; CHECK-THUNK-NEXT: br label %[[RET]]
+; CHECK-THUNK: ; <label>:[[RET]]
+; CHECK-THUNK-NEXT: ret void
+
+; Accesses of a whole shadow granule need no partial check.
+; CHECK-THUNK-LABEL: define internal preserve_mostcc void @__asan_check_store8_slow(i64 %addr)
+; CHECK-THUNK-NOT: icmp
+; CHECK-THUNK: call void @__asan_report_store8(i64 %addr)
+; CHECK-THUNK-LABEL: define internal preserve_mostcc void @__asan_check_store8(i64 %addr)
+; CHECK-THUNK: call preserve_mostcc void @__asan_check_store8_slow(i64 %addr)
+; CHECK-THUNK-NOT: @__asan_check_load16
+
+; preserve_most is only implemented for x86-64.
+; CHECK-CCONV: define internal void @__asan_check_load4_slow(i64 %addr)
+; CHECK-CCONV: define internal void @__asan_check_load4(i64 %addr)
+; CHECK-CCONV: call void @__asan_check_load4_slow(i64 %addr)
+
+!0 = !{!"function_entry_count", i64 1000}
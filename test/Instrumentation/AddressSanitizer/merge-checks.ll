@@ -0,0 +1,126 @@
+; Test -asan-opt-merge-checks: accesses to adjacent memory from the same base
+; pointer share one check, but only if the first access always leads to the
+; others without a call or a cycle in between.
+
+; RUN: opt < %s -asan -asan-module -asan-opt-merge-checks -S | FileCheck %s
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Two adjacent 4-byte loads are checked as one 8-byte load.
+define i32 @same_block(i32* %p) sanitize_address {
+; CHECK-LABEL: @same_block
+; CHECK: call void @__asan_report_load8
+; CHECK-NOT: __asan_report
+; CHECK: ret i32
+entry:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %a = load i32, i32* %p, align 8
+  %b = load i32, i32* %q, align 4
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; Both paths from the first load lead to the second one.
+define i32 @diamond(i32* %p, i1 %c) sanitize_address {
+; CHECK-LABEL: @diamond
+; CHECK: call void @__asan_report_load8
+; CHECK-NOT: __asan_report
+; CHECK: ret i32
+entry:
+  %a = load i32, i32* %p, align 8
+  br i1 %c, label %then, label %else
+
+then:
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %b = load i32, i32* %q, align 4
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; The second load does not always run.
+define i32 @one_arm(i32* %p, i1 %c) sanitize_address {
+; CHECK-LABEL: @one_arm
+; CHECK: call void @__asan_report_load4
+; CHECK: call void @__asan_report_load4
+; CHECK: ret i32
+entry:
+  %a = load i32, i32* %p, align 8
+  br i1 %c, label %then, label %join
+
+then:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %b = load i32, i32* %q, align 4
+  br label %join
+
+join:
+  %r = phi i32 [ %a, %entry ], [ %b, %then ]
+  ret i32 %r
+}
+
+; A loop between both loads might never terminate.
+define i32 @loop_between(i32* %p, i32 %n) sanitize_address {
+; CHECK-LABEL: @loop_between
+; CHECK: call void @__asan_report_load4
+; CHECK: call void @__asan_report_load4
+; CHECK: ret i32
+entry:
+  %a = load i32, i32* %p, align 8
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %b = load i32, i32* %q, align 4
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; The first load runs in every iteration, the second one only once.
+define i32 @leader_in_loop(i32* %p, i32 %n) sanitize_address {
+; CHECK-LABEL: @leader_in_loop
+; CHECK: call void @__asan_report_load4
+; CHECK: call void @__asan_report_load4
+; CHECK: ret i32
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %a = load i32, i32* %p, align 8
+  %i.next = add i32 %i, %a
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %b = load i32, i32* %q, align 4
+  ret i32 %b
+}
+
+; A call between both loads could free the memory.
+declare void @f()
+define i32 @call_between(i32* %p) sanitize_address {
+; CHECK-LABEL: @call_between
+; CHECK: call void @__asan_report_load4
+; CHECK: call void @f()
+; CHECK: call void @__asan_report_load4
+; CHECK: ret i32
+entry:
+  %q = getelementptr inbounds i32, i32* %p, i64 1
+  %a = load i32, i32* %p, align 8
+  call void @f()
+  %b = load i32, i32* %q, align 4
+  %s = add i32 %a, %b
+  ret i32 %s
+}
@@ -0,0 +1,41 @@
+; RUN: opt < %s -tsan -tsan-guard-accesses -S | FileCheck %s
+; Check that -tsan-guard-accesses puts each memory access callback in a block
+; of its own, behind a branch on true.
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64-S128"
+
+define i32 @read_4_bytes(i32* %a) sanitize_thread {
+entry:
+  %tmp1 = load i32, i32* %a, align 4
+  ret i32 %tmp1
+}
+
+; CHECK-LABEL: define i32 @read_4_bytes(
+; CHECK: br i1 true, label %[[READ:[0-9]+]], label %[[CONT:[0-9]+]]
+; CHECK: <label>:[[READ]]
+; CHECK-NEXT: %[[CAST:[0-9]+]] = bitcast i32* %a to i8*
+; CHECK-NEXT: call void @__tsan_read4(i8* %[[CAST]])
+; CHECK-NEXT: br label %[[CONT]]
+; CHECK: <label>:[[CONT]]
+; CHECK-NEXT: %tmp1 = load i32, i32* %a, align 4
+
+define void @write_then_read(i64* %a, i64 %v) sanitize_thread {
+entry:
+  store i64 %v, i64* %a, align 8
+  %tmp1 = load i64, i64* %a, align 8
+  ret void
+}
+
+; CHECK-LABEL: define void @write_then_read(
+; CHECK: br i1 true, label %[[WRITE:[0-9]+]], label %[[CONT:[0-9]+]]
+; CHECK: <label>:[[WRITE]]
+; CHECK: call void @__tsan_write8(
+; CHECK-NEXT: br label %[[CONT]]
+; CHECK: <label>:[[CONT]]
+; CHECK-NEXT: store i64 %v, i64* %a, align 8
+; CHECK-NEXT: br i1 true, label %[[READ:[0-9]+]], label %[[CONT2:[0-9]+]]
+; CHECK: <label>:[[READ]]
+; CHECK: call void @__tsan_read8(
+; CHECK-NEXT: br label %[[CONT2]]
+; CHECK: <label>:[[CONT2]]
+; CHECK-NEXT: %tmp1 = load i64, i64* %a, align 8
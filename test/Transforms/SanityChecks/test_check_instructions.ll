@@ -0,0 +1,77 @@
+; Tests which instructions SanityCheckInstructionsPass assigns to each check.
+; Instructions are numbered in function order, starting at 0.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-instructions -analyze %s | FileCheck %s
+
+; Both checks use %sum, which belongs to both of them.
+; CHECK-LABEL: Function shared: 2 sanity checks
+; CHECK-NEXT: Check 2: 0 1 2
+; CHECK-NEXT: Check 6: 0 5 6
+
+define i32 @shared(i32 %a, i32 %b) {
+entry:
+  %sum = add i32 %a, %b
+  %bad1 = icmp slt i32 %sum, 0
+  br i1 %bad1, label %fail1, label %cont1
+
+fail1:
+  call void @__assert_fail()
+  unreachable
+
+cont1:
+  %bad2 = icmp sgt i32 %sum, 100
+  br i1 %bad2, label %fail2, label %cont2
+
+fail2:
+  call void @__assert_fail()
+  unreachable
+
+cont2:
+  ret i32 %a
+}
+
+; The instructions of a guarded TSan callback belong to its guard.
+; CHECK-LABEL: Function guarded: 1 sanity checks
+; CHECK-NEXT: Check 0: 0 1 2 3
+
+define i32 @guarded(i32* %p) {
+entry:
+  br i1 true, label %tsan, label %cont
+
+tsan:
+  %c = bitcast i32* %p to i8*
+  call void @__tsan_read4(i8* %c)
+  br label %cont
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+; Removed checks branch on a constant and are no checks anymore.
+; CHECK-LABEL: Function removed: 1 sanity checks
+; CHECK-NEXT: Check 4: 3 4
+; CHECK-NOT: Check
+
+define i32 @removed(i32 %a) {
+entry:
+  br i1 false, label %fail1, label %cont1
+
+fail1:
+  call void @__assert_fail()
+  unreachable
+
+cont1:
+  %bad = icmp slt i32 %a, 0
+  br i1 %bad, label %fail2, label %cont2
+
+fail2:
+  call void @__assert_fail()
+  unreachable
+
+cont2:
+  ret i32 %a
+}
+
+declare void @__assert_fail() noreturn
+declare void @__tsan_read4(i8*)
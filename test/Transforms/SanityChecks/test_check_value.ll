@@ -0,0 +1,80 @@
+; Tests whether the static value of ASan checks (-asap-selection=value) treats
+; in-bounds accesses to locals and globals as safe, but never heap accesses,
+; whose object may have been freed.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-selection=value -cost-level=1.0 -S %s | FileCheck %s
+
+; The budget covers all checks; only checks without value are removed.
+; CHECK-LABEL: define i32 @heap(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @stack(
+; CHECK: br i1 false, label %report, label %cont
+; CHECK-LABEL: define i32 @global(
+; CHECK: br i1 false, label %report, label %cont
+
+@g = global [4 x i32] [i32 1, i32 2, i32 3, i32 4]
+
+define i32 @heap() !prof !20 {
+entry:
+  %m = call i8* @malloc(i64 16)
+  %p = bitcast i8* %m to i32*
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @stack() !prof !20 {
+entry:
+  %p = alloca i32
+  store i32 0, i32* %p
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @global() !prof !20 {
+entry:
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* @g, i64 0, i64 2
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+declare noalias i8* @malloc(i64)
+declare void @__asan_report_load4(i64)
+
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
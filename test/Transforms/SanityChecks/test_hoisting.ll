@@ -0,0 +1,65 @@
+; Tests whether ASAP hoists a check out of its loop, instead of removing it,
+; and reports that it changed the module.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-hoist-checks -asap-cost-threshold=1 -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-hoist-checks -asap-cost-threshold=1 -debug-pass=Details -disable-output %s 2>&1 | FileCheck %s --check-prefix=MODIFIED
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-hoist-checks -asap-cost-threshold=1000000 -debug-pass=Details -disable-output %s 2>&1 | FileCheck %s --check-prefix=UNCHANGED
+
+; The check fails for some i in [0, n) if and only if it fails for the first
+; or the last iteration; both are checked in the preheader.
+; CHECK-LABEL: preheader:
+; CHECK: %bad.first = icmp sge i32 0, %k
+; CHECK: %[[LAST:[0-9]+]] = add i32 %n, -1
+; CHECK: %bad.last = icmp sge i32 %[[LAST]], %k
+; CHECK: %[[BAD:[0-9]+]] = or i1 %bad.first, %bad.last
+; CHECK: br i1 %[[BAD]], label %asap.hoisted.fail, label %loop.asap.ph
+
+; The check in the loop is gone.
+; CHECK-LABEL: loop:
+; CHECK: br i1 false, label %fail, label %cont
+
+; CHECK-LABEL: asap.hoisted.fail:
+; CHECK-NEXT: call void @__assert_fail
+
+; MODIFIED: Made Modification 'Removes too costly sanity checks'
+; UNCHANGED-NOT: Made Modification 'Removes too costly sanity checks'
+
+define void @foo(i32 %n, i32 %k) !prof !20 {
+entry:
+  %pos = icmp sgt i32 %n, 0
+  br i1 %pos, label %preheader, label %exit
+
+preheader:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %preheader ], [ %i.next, %cont ]
+  %bad = icmp sge i32 %i, %k, !dbg !10
+  br i1 %bad, label %fail, label %cont, !dbg !10, !prof !21
+
+fail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !10
+  unreachable
+
+cont:
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit, !prof !22
+
+exit:
+  ret void
+}
+
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: false, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "h.c", directory: "/tmp")
+!3 = !{!4}
+!4 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: void (i32, i32)* @foo)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 3, column: 9, scope: !4)
+!20 = !{!"function_entry_count", i64 100}
+!21 = !{!"branch_weights", i32 1, i32 100000}
+!22 = !{!"branch_weights", i32 9, i32 1}
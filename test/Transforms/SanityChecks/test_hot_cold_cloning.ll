@@ -0,0 +1,87 @@
+; Tests whether ASAP keeps removed checks in a checked clone of their
+; function, and lets only the cold call sites call that clone.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-clone-hot-functions -asap-cold-call-count=10 -asap-cost-threshold=1 -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-clone-hot-functions -asap-cost-threshold=1 -S %s | FileCheck %s --check-prefix=ALLHOT
+
+; The original loses its check.
+; CHECK-LABEL: define void @callee(
+; CHECK: br i1 false, label %fail, label %cont
+
+; The cold call site calls the clone, the hot one the original.
+; CHECK-LABEL: define void @caller(
+; CHECK-LABEL: cold.cont:
+; CHECK-NEXT: call void @callee.asap.checked(i32 %k)
+; CHECK-LABEL: hot.cont:
+; CHECK-NEXT: call void @callee(i32 %k)
+
+; The clone is internal and keeps the check.
+; CHECK-LABEL: define internal void @callee.asap.checked(
+; CHECK: %bad = icmp sge i32 %k, 10
+; CHECK-NEXT: br i1 %bad, label %fail, label %cont
+; CHECK-LABEL: fail:
+; CHECK-NEXT: call void @__assert_fail
+
+; Without cold call sites, nothing is cloned.
+; ALLHOT-NOT: asap.checked
+
+define void @callee(i32 %k) !prof !20 {
+entry:
+  %bad = icmp sge i32 %k, 10, !dbg !10
+  br i1 %bad, label %fail, label %cont, !dbg !10, !prof !21
+
+fail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !10
+  unreachable
+
+cont:
+  ret void
+}
+
+define void @caller(i32 %k, i1 %rare) !prof !22 {
+entry:
+  br i1 %rare, label %cold, label %hot, !prof !23
+
+cold:
+  %bad.cold = icmp sge i32 %k, 20, !dbg !11
+  br i1 %bad.cold, label %fail, label %cold.cont, !dbg !11, !prof !24
+
+cold.cont:
+  call void @callee(i32 %k)
+  br label %exit
+
+hot:
+  %bad.hot = icmp sge i32 %k, 30, !dbg !12
+  br i1 %bad.hot, label %fail, label %hot.cont, !dbg !12, !prof !25
+
+hot.cont:
+  call void @callee(i32 %k)
+  br label %exit
+
+fail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !11
+  unreachable
+
+exit:
+  ret void
+}
+
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: false, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "c.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "callee", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: void (i32)* @callee)
+!5 = distinct !DISubprogram(name: "caller", scope: !1, file: !1, line: 5, isLocal: false, isDefinition: true, function: void (i32, i1)* @caller)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 2, column: 3, scope: !4)
+!11 = !DILocation(line: 7, column: 3, scope: !5)
+!12 = !DILocation(line: 9, column: 3, scope: !5)
+!20 = !{!"function_entry_count", i64 100000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
+!22 = !{!"function_entry_count", i64 100000}
+!23 = !{!"branch_weights", i32 1, i32 100000}
+!24 = !{!"branch_weights", i32 1, i32 100000}
+!25 = !{!"branch_weights", i32 1, i32 100000}
@@ -0,0 +1,76 @@
+; Tests whether costs are computed from the instrprof profile that clang
+; records in the IR with -fprofile-instr-use: function entry counts and
+; branch weights.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-instr-profile -analyze %s | FileCheck %s
+
+; foo is entered 100 times, and its loop runs 10 times per entry. The check
+; in the loop runs 1000 times, the one after the loop 100 times; each costs 2.
+; CHECK: {{^ *}}2000 d.c:21:9
+; CHECK: {{^ *}}200 d.c:4:5
+
+; bar has no profile, so its check has no cost.
+; CHECK: {{^ *}}0 d.c:40:5
+
+define i32 @foo(i32 %a, i32 %n) !prof !20 {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %v, %cont ]
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %i, i32 %a), !dbg !10
+  %o = extractvalue { i32, i1 } %r, 1, !dbg !10
+  br i1 %o, label %fail, label %cont, !dbg !10, !prof !21
+
+fail:
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 0, i64 0), !dbg !10
+  unreachable
+
+cont:
+  %v = extractvalue { i32, i1 } %r, 0, !dbg !10
+  %c = icmp slt i32 %v, %n
+  br i1 %c, label %loop, label %exit, !prof !22
+
+exit:
+  %big = icmp sgt i32 %v, 100, !dbg !11
+  br i1 %big, label %afail, label %ok, !dbg !11, !prof !21
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !11
+  unreachable
+
+ok:
+  ret i32 %v
+}
+
+define i32 @bar(i32 %a) {
+entry:
+  %big = icmp sgt i32 %a, 100, !dbg !12
+  br i1 %big, label %afail, label %ok, !dbg !12
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !12
+  unreachable
+
+ok:
+  ret i32 %a
+}
+
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: false, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "d.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: i32 (i32, i32)* @foo)
+!5 = distinct !DISubprogram(name: "bar", scope: !1, file: !1, line: 39, isLocal: false, isDefinition: true, function: i32 (i32)* @bar)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 21, column: 9, scope: !4)
+!11 = !DILocation(line: 4, column: 5, scope: !4)
+!12 = !DILocation(line: 40, column: 5, scope: !5)
+!20 = !{!"function_entry_count", i64 100}
+!21 = !{!"branch_weights", i32 1, i32 100000}
+!22 = !{!"branch_weights", i32 9, i32 1}
@@ -0,0 +1,111 @@
+; Tests whether -asap-kind-budget selects families of checks within their own
+; budgets. The other checks share the budget of -cost-level, which removes
+; them all here.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=1,__asan_report_load=unlimited,asan-read=0 -S %s | FileCheck %s --check-prefix=FIRST
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=asan-read=0,__asan_report_load=unlimited -S %s | FileCheck %s --check-prefix=SECOND
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=1,__asan_report_load=unlimited,asan-read=0 -disable-output %s 2>&1 | FileCheck %s --check-prefix=SUMMARY
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=2 -disable-output %s 2>&1 | FileCheck %s --check-prefix=RANGE
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=all -disable-output %s 2>&1 | FileCheck %s --check-prefix=LEVEL
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget==0.5 -disable-output %s 2>&1 | FileCheck %s --check-prefix=FAMILY
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=1 -asap-shared-costs -disable-output %s 2>&1 | FileCheck %s --check-prefix=COMBINED
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -cost-level=0 -asap-kind-budget=ubsan=1 -asap-sample-checks -disable-output %s 2>&1 | FileCheck %s --check-prefix=COMBINED
+
+; The ubsan kind keeps all of its checks. The ASan read matches the
+; __asan_report_load prefix first, which has no limit; asan-read=0 does not
+; apply to it. The ASan write and the assertion belong to no family.
+; FIRST-LABEL: define i32 @asan_read(
+; FIRST: br i1 %bad, label %report, label %cont
+; FIRST-LABEL: define void @asan_write(
+; FIRST: br i1 false, label %report, label %cont
+; FIRST-LABEL: define i32 @ubsan(
+; FIRST: br i1 %bad, label %handler, label %cont
+; FIRST-LABEL: define i32 @assertion(
+; FIRST: br i1 false, label %afail, label %ok
+
+; Here asan-read comes first and removes the ASan read. The ubsan check no
+; longer has a family of its own.
+; SECOND-LABEL: define i32 @asan_read(
+; SECOND: br i1 false, label %report, label %cont
+; SECOND-LABEL: define void @asan_write(
+; SECOND: br i1 false, label %report, label %cont
+; SECOND-LABEL: define i32 @ubsan(
+; SECOND: br i1 false, label %handler, label %cont
+; SECOND-LABEL: define i32 @assertion(
+; SECOND: br i1 false, label %afail, label %ok
+
+; SUMMARY-DAG: Removed 0 out of 1 ubsan checks
+; SUMMARY-DAG: Removed 0 out of 1 __asan_report_load checks
+; SUMMARY-DAG: Removed 0 out of 0 asan-read checks
+
+; RANGE: Invalid -asap-kind-budget: ubsan=2
+; LEVEL: Invalid -asap-kind-budget: ubsan=all
+; FAMILY: Invalid -asap-kind-budget: =0.5
+; COMBINED: -asap-kind-budget cannot be combined with -asap-shared-costs or -asap-sample-checks
+
+define i32 @asan_read(i32* %p, i64 %s) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  %addr = ptrtoint i32* %p to i64
+  call void @__asan_report_load4(i64 %addr)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define void @asan_write(i32* %p, i64 %s) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  %addr = ptrtoint i32* %p to i64
+  call void @__asan_report_store4(i64 %addr)
+  unreachable
+
+cont:
+  store i32 0, i32* %p
+  ret void
+}
+
+define i32 @ubsan(i32 %a, i32 %b) !prof !20 {
+entry:
+  %sum = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %a, i32 %b)
+  %bad = extractvalue { i32, i1 } %sum, 1
+  br i1 %bad, label %handler, label %cont, !prof !21
+
+handler:
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 0, i64 0)
+  unreachable
+
+cont:
+  %v = extractvalue { i32, i1 } %sum, 0
+  ret i32 %v
+}
+
+define i32 @assertion(i32 %a) !prof !20 {
+entry:
+  %big = icmp sgt i32 %a, 100
+  br i1 %big, label %afail, label %ok, !prof !21
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null)
+  unreachable
+
+ok:
+  ret i32 %a
+}
+
+declare void @__asan_report_load4(i64)
+declare void @__asan_report_store4(i64)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
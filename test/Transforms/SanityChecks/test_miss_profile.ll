@@ -0,0 +1,52 @@
+; Tests how -asap-miss-profile combines with the calibrated costs of
+; -asap-cost-table. The average cost in the table includes kernels that miss
+; the cache, so the cost of misses is added to the cost of cached checks.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-instr-profile -asap-cost-table=%S/Inputs/miss-cost.table -analyze %s | FileCheck %s --check-prefix=AVERAGE
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-instr-profile -asap-cost-table=%S/Inputs/miss-cost.table -asap-miss-profile=%S/Inputs/miss.prof -analyze %s | FileCheck %s --check-prefix=MISSES
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-instr-profile -asap-miss-profile=%S/Inputs/miss.prof -analyze %s 2>&1 | FileCheck %s --check-prefix=NOTABLE
+; RUN: not opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-instr-profile -asap-cost-table=%S/Inputs/miss-cost-uncached.table -asap-miss-profile=%S/Inputs/miss.prof -analyze %s 2>&1 | FileCheck %s --check-prefix=UNCACHED
+
+; The check runs 1000 times at an average of 4 cycles.
+; AVERAGE: {{^ *}}4000 m.c:3:10
+
+; The check runs 1000 times at 2 cycles when it hits the cache. Its shadow
+; load shares 10 miss samples with the other load on its line, and each
+; sample costs 100 cycles.
+; MISSES: {{^ *}}2500 m.c:3:10
+
+; NOTABLE: -asap-miss-profile requires -asap-cost-table
+; UNCACHED: Cost table has no costs of cached checks, please calibrate again!
+
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @check(i32* %p) !prof !20 {
+entry:
+  %a = ptrtoint i32* %p to i64, !dbg !10
+  %s = lshr i64 %a, 3, !dbg !10
+  %sp = inttoptr i64 %s to i8*, !dbg !10
+  %sv = load i8, i8* %sp, !dbg !10
+  %bad = icmp ne i8 %sv, 0, !dbg !10
+  br i1 %bad, label %report, label %cont, !dbg !10, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a), !dbg !10
+  unreachable
+
+cont:
+  %v = load i32, i32* %p, !dbg !10
+  ret i32 %v
+}
+
+declare void @__asan_report_load4(i64)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: true, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "m.c", directory: "/tmp")
+!3 = !{!4}
+!4 = distinct !DISubprogram(name: "check", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: i32 (i32*)* @check)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 3, column: 10, scope: !4)
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
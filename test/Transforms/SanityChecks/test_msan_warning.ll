@@ -0,0 +1,91 @@
+; Tests whether ASAP recognizes all of MSan's warning functions, and whether
+; -exit-instead-of-abort only replaces those that do not return.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-cost-threshold=1 -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -exit-instead-of-abort -S %s | FileCheck %s --check-prefix=EXIT
+
+; CHECK-LABEL: define i32 @noreturn(
+; CHECK: br i1 false, label %warn, label %cont
+; CHECK-LABEL: define i32 @keep_going(
+; CHECK: br i1 false, label %warn, label %cont
+; CHECK-LABEL: define i32 @with_origin(
+; CHECK: br i1 false, label %warn, label %cont
+; CHECK-LABEL: define i32 @keep_going_with_origin(
+; CHECK: br i1 false, label %warn, label %cont
+
+; EXIT-LABEL: define i32 @noreturn(
+; EXIT: call void @exit(i32 27)
+; EXIT-LABEL: define i32 @keep_going(
+; EXIT: call void @__msan_warning()
+; EXIT-LABEL: define i32 @with_origin(
+; EXIT: call void @exit(i32 27)
+; EXIT-LABEL: define i32 @keep_going_with_origin(
+; EXIT: call void @__msan_warning_with_origin(i32 %o)
+
+@__msan_origin_tls = external thread_local(initialexec) global i32
+
+define i32 @noreturn(i32* %p, i64 %s) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %warn, label %cont, !prof !21
+
+warn:
+  call void @__msan_warning_noreturn()
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @keep_going(i32* %p, i64 %s) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %warn, label %cont, !prof !21
+
+warn:
+  store i32 0, i32* @__msan_origin_tls
+  call void @__msan_warning()
+  call void asm sideeffect "", ""()
+  br label %cont
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @with_origin(i32* %p, i64 %s, i32 %o) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %warn, label %cont, !prof !21
+
+warn:
+  call void @__msan_warning_with_origin_noreturn(i32 %o)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @keep_going_with_origin(i32* %p, i64 %s, i32 %o) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %warn, label %cont, !prof !21
+
+warn:
+  call void @__msan_warning_with_origin(i32 %o)
+  br label %cont
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+declare void @__msan_warning_noreturn()
+declare void @__msan_warning()
+declare void @__msan_warning_with_origin_noreturn(i32)
+declare void @__msan_warning_with_origin(i32)
+
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
@@ -0,0 +1,284 @@
+; Tests which ASan checks -asap-remove-safe-checks removes. Like ASan itself,
+; it only trusts in-bounds accesses to allocas without lifetime markers and
+; to globals that are initialized at link time. Heap objects may have been
+; freed, so their checks stay, even for accesses in bounds.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-remove-safe-checks -asap-cost-threshold=1000000000 -S %s | FileCheck %s
+
+; CHECK-LABEL: define i32 @heap(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @heap_loop(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @new(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @stack(
+; CHECK: br i1 false, label %report, label %cont
+; CHECK-LABEL: define void @stack_store(
+; CHECK: br i1 false, label %report, label %cont
+; CHECK-LABEL: define i32 @stack_lifetime(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @global_loop(
+; CHECK: br i1 false, label %report, label %cont
+; CHECK-LABEL: define i32 @dyn_init_loop(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @external(
+; CHECK: br i1 %bad, label %report, label %cont
+; CHECK-LABEL: define i32 @weak(
+; CHECK: br i1 %bad, label %report, label %cont
+
+@g = global [16 x i32] zeroinitializer
+@dyn = global [16 x i32] zeroinitializer
+@ext = external global [16 x i32]
+@wk = weak global [16 x i32] zeroinitializer
+
+define i32 @heap() !prof !20 {
+entry:
+  %m = call i8* @malloc(i64 16)
+  %b = bitcast i8* %m to i32*
+  %p = getelementptr inbounds i32, i32* %b, i64 2
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @heap_loop() !prof !20 {
+entry:
+  %m = call i8* @malloc(i64 64)
+  %b = bitcast i8* %m to i32*
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %cont ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %cont ]
+  %p = getelementptr inbounds i32, i32* %b, i64 %i
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  %sum.next = add i32 %sum, %v
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp ult i64 %i.next, 16
+  br i1 %c, label %loop, label %exit, !prof !22
+
+exit:
+  ret i32 %sum.next
+}
+
+define i32 @new() !prof !20 {
+entry:
+  %m = call i8* @_Znwm(i64 16)
+  %p = bitcast i8* %m to i32*
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @stack() !prof !20 {
+entry:
+  %arr = alloca [4 x i32]
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %arr, i64 0, i64 2
+  store i32 0, i32* %p
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define void @stack_store() !prof !20 {
+entry:
+  %arr = alloca [4 x i32]
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %arr, i64 0, i64 2
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_store4(i64 %a)
+  unreachable
+
+cont:
+  store i32 0, i32* %p
+  ret void
+}
+
+define i32 @stack_lifetime() !prof !20 {
+entry:
+  %arr = alloca [4 x i32]
+  %arr8 = bitcast [4 x i32]* %arr to i8*
+  call void @llvm.lifetime.start(i64 16, i8* %arr8)
+  %p = getelementptr inbounds [4 x i32], [4 x i32]* %arr, i64 0, i64 2
+  store i32 0, i32* %p
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  call void @llvm.lifetime.end(i64 16, i8* %arr8)
+  ret i32 %v
+}
+
+define i32 @global_loop() !prof !20 {
+entry:
+  %b = getelementptr inbounds [16 x i32], [16 x i32]* @g, i64 0, i64 0
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %cont ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %cont ]
+  %p = getelementptr inbounds i32, i32* %b, i64 %i
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  %sum.next = add i32 %sum, %v
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp ult i64 %i.next, 16
+  br i1 %c, label %loop, label %exit, !prof !22
+
+exit:
+  ret i32 %sum.next
+}
+
+define i32 @dyn_init_loop() !prof !20 {
+entry:
+  %b = getelementptr inbounds [16 x i32], [16 x i32]* @dyn, i64 0, i64 0
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %cont ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %cont ]
+  %p = getelementptr inbounds i32, i32* %b, i64 %i
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  %sum.next = add i32 %sum, %v
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp ult i64 %i.next, 16
+  br i1 %c, label %loop, label %exit, !prof !22
+
+exit:
+  ret i32 %sum.next
+}
+
+define i32 @external() !prof !20 {
+entry:
+  %p = getelementptr inbounds [16 x i32], [16 x i32]* @ext, i64 0, i64 2
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @weak() !prof !20 {
+entry:
+  %p = getelementptr inbounds [16 x i32], [16 x i32]* @wk, i64 0, i64 2
+  %a = ptrtoint i32* %p to i64
+  %s = lshr i64 %a, 3
+  %sp = inttoptr i64 %s to i8*
+  %sv = load i8, i8* %sp
+  %bad = icmp ne i8 %sv, 0
+  br i1 %bad, label %report, label %cont, !prof !21
+
+report:
+  call void @__asan_report_load4(i64 %a)
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+declare noalias i8* @malloc(i64)
+declare noalias i8* @_Znwm(i64)
+declare void @llvm.lifetime.start(i64, i8* nocapture)
+declare void @llvm.lifetime.end(i64, i8* nocapture)
+declare void @__asan_report_load4(i64)
+declare void @__asan_report_store4(i64)
+
+!llvm.asan.globals = !{!0, !1}
+!0 = !{[16 x i32]* @g, null, !"g", i1 false, i1 false}
+!1 = !{[16 x i32]* @dyn, null, !"dyn", i1 true, i1 false}
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
+!22 = !{!"branch_weights", i32 15, i32 1}
@@ -0,0 +1,101 @@
+; Tests the YAML report that -asap-report writes for a removed check and
+; kept checks.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-cost-threshold=100 -asap-report=%t -S %s -o /dev/null
+; RUN: FileCheck %s < %t
+
+; CHECK: total-checks: 3
+; CHECK-NEXT: total-cost: 2006
+; CHECK-NEXT: removed-checks: 1
+; CHECK-NEXT: removed-cost: 2000
+; CHECK-NEXT: checks:
+
+; The hot ASan check costs more than the threshold.
+; CHECK-NEXT: - id: 0x{{[0-9A-F]+}}
+; CHECK-NEXT: function: hot
+; CHECK-NEXT: kind: asan-write
+; CHECK-NEXT: access-size: 4
+; CHECK-NEXT: handler: __asan_report_store4
+; CHECK-NEXT: location: { file: r.c, line: 3, column: 5 }
+; CHECK-NEXT: count: 1000
+; CHECK-NEXT: cost: 2000
+; CHECK-NEXT: decision: removed
+
+; The cold checks stay.
+; CHECK-NEXT: - id: 0x{{[0-9A-F]+}}
+; CHECK-NEXT: function: msan
+; CHECK-NEXT: kind: msan
+; CHECK-NEXT: handler: __msan_warning_noreturn
+; CHECK-NEXT: count: 2
+; CHECK-NEXT: cost: 4
+; CHECK-NEXT: decision: kept
+
+; CHECK-NEXT: - id: 0x{{[0-9A-F]+}}
+; CHECK-NEXT: function: cold
+; CHECK-NEXT: kind: assertion
+; CHECK-NEXT: handler: __assert_fail
+; CHECK-NEXT: location: { file: r.c, line: 8, column: 3 }
+; CHECK-NEXT: count: 1
+; CHECK-NEXT: cost: 2
+; CHECK-NEXT: decision: kept
+
+define void @hot(i32* %p, i64 %s) !prof !20 {
+entry:
+  %bad = icmp ne i64 %s, 0, !dbg !10
+  br i1 %bad, label %report, label %cont, !dbg !10, !prof !21
+
+report:
+  %addr = ptrtoint i32* %p to i64
+  call void @__asan_report_store4(i64 %addr), !dbg !10
+  unreachable
+
+cont:
+  store i32 0, i32* %p, !dbg !10
+  ret void
+}
+
+define i32 @cold(i32 %a) !prof !22 {
+entry:
+  %big = icmp sgt i32 %a, 100, !dbg !11
+  br i1 %big, label %afail, label %ok, !dbg !11, !prof !21
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !11
+  unreachable
+
+ok:
+  ret i32 %a
+}
+
+define i32 @msan(i32* %p, i64 %s) !prof !23 {
+entry:
+  %bad = icmp ne i64 %s, 0
+  br i1 %bad, label %warn, label %cont, !prof !21
+
+warn:
+  call void @__msan_warning_noreturn()
+  unreachable
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+declare void @__asan_report_store4(i64)
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+declare void @__msan_warning_noreturn()
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: true, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "r.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "hot", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: void (i32*, i64)* @hot)
+!5 = distinct !DISubprogram(name: "cold", scope: !1, file: !1, line: 7, isLocal: false, isDefinition: true, function: i32 (i32)* @cold)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 3, column: 5, scope: !4)
+!11 = !DILocation(line: 8, column: 3, scope: !5)
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
+!22 = !{!"function_entry_count", i64 1}
+!23 = !{!"function_entry_count", i64 2}
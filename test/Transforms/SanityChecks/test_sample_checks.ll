@@ -0,0 +1,127 @@
+; Tests whether -asap-sample-checks replaces removed checks by checks that run
+; once every few executions, as far as the -cost-level budget allows.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-sample-checks -asap-sampling-counter-cost=1 -cost-level=0.15 -S %s | FileCheck %s
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-sample-checks -asap-sampling-counter-cost=1 -cost-level=0.15 -disable-output %s 2>&1 | FileCheck %s --check-prefix=SUMMARY
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-sample-checks -asap-sampling-counter-cost=1 -cost-level=0.15 -asap-max-sampling-period=3 -S %s | FileCheck %s --check-prefix=MAXPERIOD
+
+; All checks run 1000 times and cost 2000, except the first one of @g, which
+; costs 3000. All of them are removed, which leaves the whole budget of 1650
+; for sampling. Each candidate gets an equal share of what is left, and the
+; counter alone costs 1000, so only the last candidate can be sampled. Its
+; share of 1650 pays for the counter and a quarter of the check.
+
+; CHECK: @asap.sample.counter = private global i32 0
+
+; CHECK-LABEL: define i32 @f(
+; Removed because its share of the budget is too small.
+; CHECK: br i1 false, label %fail1, label %cont1
+; Removed because skipping it would need new incoming values for the PHI.
+; CHECK: br i1 false, label %fail2, label %cont2
+; Removed because its share of the budget is too small.
+; CHECK: br i1 false, label %fail3, label %cont3
+; CHECK-NOT: asap.sample.counter
+
+; CHECK-LABEL: define void @g(
+; Removed because the handler of the next check uses %x.
+; CHECK: br i1 false, label %fail1, label %cont1
+; CHECK: cont1:
+; CHECK-NEXT: [[COUNT:%[0-9]+]] = load atomic i32, i32* @asap.sample.counter monotonic
+; CHECK-NEXT: [[RUN:%[0-9]+]] = icmp eq i32 [[COUNT]], 0
+; CHECK-NEXT: [[DEC:%[0-9]+]] = sub i32 [[COUNT]], 1
+; CHECK-NEXT: [[NEXT:%[0-9]+]] = select i1 [[RUN]], i32 3, i32 [[DEC]]
+; CHECK-NEXT: store atomic i32 [[NEXT]], i32* @asap.sample.counter monotonic
+; CHECK-NEXT: br i1 [[RUN]], label %asap.sampled, label %cont2, {{.*}}!prof [[WEIGHTS:![0-9]+]]
+; CHECK: asap.sampled:
+; CHECK-NEXT: %c2 = icmp sgt i32 %b, 100
+; CHECK-NEXT: br i1 %c2, label %fail2, label %cont2
+; CHECK: cont2:
+; CHECK-NEXT: ret void
+
+; CHECK: [[WEIGHTS]] = !{!"branch_weights", i32 1, i32 3}
+
+; Sampled checks are not counted as removed.
+; SUMMARY: Removed 4 out of 5 static checks (80.00%)
+; SUMMARY-NEXT: Removed 9000 out of 11000 dynamic checks (81.82%)
+; SUMMARY-NEXT: Sampled 1 out of 5 static checks (20.00%), at a predicted cost of 1500
+
+; A period of 4 exceeds -asap-max-sampling-period, so all checks are removed.
+; MAXPERIOD-NOT: asap.sample.counter
+; MAXPERIOD-LABEL: define void @g(
+; MAXPERIOD: br i1 false, label %fail1, label %cont1
+; MAXPERIOD: br i1 false, label %fail2, label %cont2
+
+define i32 @f(i32 %a, i32 %b) !prof !20 {
+entry:
+  %c1 = icmp sgt i32 %a, 100, !dbg !10
+  br i1 %c1, label %fail1, label %cont1, !dbg !10, !prof !21
+
+fail1:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !10
+  unreachable
+
+cont1:
+  %c2 = icmp sgt i32 %b, 100, !dbg !11
+  br i1 %c2, label %fail2, label %cont2, !dbg !11, !prof !21
+
+fail2:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !11
+  unreachable
+
+cont2:
+  %p = phi i32 [ %b, %cont1 ]
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %a, i32 %p), !dbg !12
+  %o = extractvalue { i32, i1 } %r, 1, !dbg !12
+  br i1 %o, label %fail3, label %cont3, !dbg !12, !prof !21
+
+fail3:
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 0, i64 0), !dbg !12
+  unreachable
+
+cont3:
+  %v = extractvalue { i32, i1 } %r, 0
+  ret i32 %v
+}
+
+define void @g(i32 %a, i32 %b) !prof !20 {
+entry:
+  %x = add i32 %a, 1, !dbg !13
+  %c1 = icmp sgt i32 %x, 100, !dbg !13
+  br i1 %c1, label %fail1, label %cont1, !dbg !13, !prof !21
+
+fail1:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !13
+  unreachable
+
+cont1:
+  %c2 = icmp sgt i32 %b, 100, !dbg !14
+  br i1 %c2, label %fail2, label %cont2, !dbg !14, !prof !21
+
+fail2:
+  %xz = zext i32 %x to i64, !dbg !14
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 %xz, i64 0), !dbg !14
+  unreachable
+
+cont2:
+  ret void
+}
+
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: false, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "s.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: i32 (i32, i32)* @f)
+!5 = distinct !DISubprogram(name: "g", scope: !1, file: !1, line: 40, isLocal: false, isDefinition: true, function: void (i32, i32)* @g)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 10, column: 5, scope: !4)
+!11 = !DILocation(line: 20, column: 5, scope: !4)
+!12 = !DILocation(line: 30, column: 9, scope: !4)
+!13 = !DILocation(line: 41, column: 5, scope: !5)
+!14 = !DILocation(line: 42, column: 5, scope: !5)
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
@@ -0,0 +1,50 @@
+; Tests whether checks that were inlined get their counts from the inline
+; site in the sample profile of the function that contains them, rather
+; than from the standalone profile of the inlined function.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -sanity-check-cost -asap-sample-profile=%S/Inputs/inlined.prof -analyze %s | FileCheck %s
+
+; The check in bar itself has 10000 samples. The copy that was inlined into
+; foo at line 5 has 500 samples; each run of the check costs 2.
+; CHECK: {{^ *}}20000 d.c:40:5
+; CHECK-NEXT: {{^ *}}1000 d.c:40:5
+
+define i32 @foo(i32 %a) {
+entry:
+  %big = icmp sgt i32 %a, 100, !dbg !10
+  br i1 %big, label %afail, label %ok, !dbg !10
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !10
+  unreachable
+
+ok:
+  ret i32 %a
+}
+
+define i32 @bar(i32 %a) {
+entry:
+  %big = icmp sgt i32 %a, 100, !dbg !12
+  br i1 %big, label %afail, label %ok, !dbg !12
+
+afail:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !12
+  unreachable
+
+ok:
+  ret i32 %a
+}
+
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: true, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "d.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: i32 (i32)* @foo)
+!5 = distinct !DISubprogram(name: "bar", scope: !1, file: !1, line: 39, isLocal: false, isDefinition: true, function: i32 (i32)* @bar)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 40, column: 5, scope: !5, inlinedAt: !11)
+!11 = distinct !DILocation(line: 5, column: 10, scope: !4)
+!12 = !DILocation(line: 40, column: 5, scope: !5)
@@ -0,0 +1,117 @@
+; Tests whether -asap-toggleable-checks guards checks by enable bytes that
+; the program can change at runtime, and registers them with the runtime.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-toggleable-checks -cost-level=0.15 -S %s | FileCheck %s
+
+; All checks run 1000 times and cost 2000, except the first one of @g, which
+; costs 3000. The last check of @g is kept and starts enabled; the others are
+; removed and start disabled. Checks without a region cannot be toggled, so
+; the removed ones are removed for good.
+
+; CHECK: @__asap_check_enabled = private global [3 x i8] c"\00\00\01"
+; CHECK: @__asap_toggle_ids = private constant [3 x i64] [i64 {{-?[0-9]+}}, i64 {{-?[0-9]+}}, i64 {{-?[0-9]+}}]
+; CHECK: @__asap_toggle_costs = private constant [3 x i64] [i64 2000, i64 2000, i64 2000]
+; CHECK: @llvm.global_ctors = {{.*}} @asap.register_toggles
+; CHECK: @llvm.global_dtors = {{.*}} @asap.unregister_toggles
+
+; CHECK-LABEL: define i32 @f(
+; CHECK: entry:
+; CHECK-NEXT: [[FLAG:%[0-9]+]] = load atomic i8, i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__asap_check_enabled, i64 0, i64 0) monotonic
+; CHECK-NEXT: [[ON:%[0-9]+]] = icmp ne i8 [[FLAG]], 0
+; CHECK-NEXT: br i1 [[ON]], label %asap.toggled, label %cont1
+; CHECK: asap.toggled:
+; CHECK-NEXT: %c1 = icmp sgt i32 %a, 100
+; CHECK-NEXT: br i1 %c1, label %fail1, label %cont1
+; The PHI in cont2 leaves this check without a region.
+; CHECK: br i1 false, label %fail2, label %cont2
+; CHECK: load atomic i8, i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__asap_check_enabled, i64 0, i64 1) monotonic
+; CHECK: br i1 %o, label %fail3, label %cont3
+
+; CHECK-LABEL: define void @g(
+; The handler of the next check uses %x, so this check has no region.
+; CHECK: br i1 false, label %fail1, label %cont1
+; CHECK: load atomic i8, i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__asap_check_enabled, i64 0, i64 2) monotonic
+; CHECK: br i1 %c2, label %fail2, label %cont2
+
+; CHECK-LABEL: define internal void @asap.register_toggles()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @__asap_register_toggles(i64* getelementptr inbounds ([3 x i64], [3 x i64]* @__asap_toggle_ids, i64 0, i64 0), i64* getelementptr inbounds ([3 x i64], [3 x i64]* @__asap_toggle_costs, i64 0, i64 0), i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__asap_check_enabled, i64 0, i64 0), i64 3)
+
+; CHECK-LABEL: define internal void @asap.unregister_toggles()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @__asap_unregister_toggles(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @__asap_check_enabled, i64 0, i64 0))
+
+define i32 @f(i32 %a, i32 %b) !prof !20 {
+entry:
+  %c1 = icmp sgt i32 %a, 100, !dbg !10
+  br i1 %c1, label %fail1, label %cont1, !dbg !10, !prof !21
+
+fail1:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !10
+  unreachable
+
+cont1:
+  %c2 = icmp sgt i32 %b, 100, !dbg !11
+  br i1 %c2, label %fail2, label %cont2, !dbg !11, !prof !21
+
+fail2:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !11
+  unreachable
+
+cont2:
+  %p = phi i32 [ %b, %cont1 ]
+  %r = call { i32, i1 } @llvm.sadd.with.overflow.i32(i32 %a, i32 %p), !dbg !12
+  %o = extractvalue { i32, i1 } %r, 1, !dbg !12
+  br i1 %o, label %fail3, label %cont3, !dbg !12, !prof !21
+
+fail3:
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 0, i64 0), !dbg !12
+  unreachable
+
+cont3:
+  %v = extractvalue { i32, i1 } %r, 0
+  ret i32 %v
+}
+
+define void @g(i32 %a, i32 %b) !prof !20 {
+entry:
+  %x = add i32 %a, 1, !dbg !13
+  %c1 = icmp sgt i32 %x, 100, !dbg !13
+  br i1 %c1, label %fail1, label %cont1, !dbg !13, !prof !21
+
+fail1:
+  call void @__assert_fail(i8* null, i8* null, i32 0, i8* null), !dbg !13
+  unreachable
+
+cont1:
+  %c2 = icmp sgt i32 %b, 100, !dbg !14
+  br i1 %c2, label %fail2, label %cont2, !dbg !14, !prof !21
+
+fail2:
+  %xz = zext i32 %x to i64, !dbg !14
+  call void @__ubsan_handle_add_overflow_abort(i8* null, i64 %xz, i64 0), !dbg !14
+  unreachable
+
+cont2:
+  ret void
+}
+
+declare { i32, i1 } @llvm.sadd.with.overflow.i32(i32, i32)
+declare void @__ubsan_handle_add_overflow_abort(i8*, i64, i64)
+declare void @__assert_fail(i8*, i8*, i32, i8*)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!8}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "t", isOptimized: false, runtimeVersion: 0, emissionKind: 1, subprograms: !3)
+!1 = !DIFile(filename: "s.c", directory: "/tmp")
+!3 = !{!4, !5}
+!4 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 1, isLocal: false, isDefinition: true, function: i32 (i32, i32)* @f)
+!5 = distinct !DISubprogram(name: "g", scope: !1, file: !1, line: 40, isLocal: false, isDefinition: true, function: void (i32, i32)* @g)
+!8 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = !DILocation(line: 10, column: 5, scope: !4)
+!11 = !DILocation(line: 20, column: 5, scope: !4)
+!12 = !DILocation(line: 30, column: 9, scope: !4)
+!13 = !DILocation(line: 41, column: 5, scope: !5)
+!14 = !DILocation(line: 42, column: 5, scope: !5)
+!20 = !{!"function_entry_count", i64 1000}
+!21 = !{!"branch_weights", i32 1, i32 100000}
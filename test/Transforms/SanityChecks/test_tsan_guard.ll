@@ -0,0 +1,36 @@
+; Tests whether ASAP removes TSan memory access callbacks that have been
+; guarded with -tsan-guard-accesses, and leaves unguarded ones alone.
+
+; RUN: opt -load %llvmshlibdir/SanityChecks%shlibext -asap -asap-instr-profile -asap-cost-threshold=1 -S %s | FileCheck %s
+
+; CHECK-LABEL: define i32 @guarded(
+; CHECK: br i1 false, label %tsan, label %cont
+; CHECK-LABEL: define i32 @unguarded(
+; CHECK: call void @__tsan_read4(i8* %c)
+; CHECK-NEXT: %v = load i32, i32* %p
+
+define i32 @guarded(i32* %p) !prof !20 {
+entry:
+  br i1 true, label %tsan, label %cont
+
+tsan:
+  %c = bitcast i32* %p to i8*
+  call void @__tsan_read4(i8* %c)
+  br label %cont
+
+cont:
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @unguarded(i32* %p) !prof !20 {
+entry:
+  %c = bitcast i32* %p to i8*
+  call void @__tsan_read4(i8* %c)
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+declare void @__tsan_read4(i8*)
+
+!20 = !{!"function_entry_count", i64 1000}
@@ -0,0 +1,553 @@
+//===- asap-backend.cpp - In-process backend for asap-clang ---------------===//
+//
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+//
+//===----------------------------------------------------------------------===//
+//
+// asap-backend performs the per-object steps of asap-clang in one process. It
+// reads a bitcode file once, runs the passes for the current ASAP stage and,
+// for the optimize stage, the regular -O pipeline, and then generates an
+// object file directly. This replaces separate opt and llc invocations, with
+// a bitcode file written and read between each of them.
+//
+// With -jobs=<file>, many objects are processed by a pool of -j threads. The
+// job file has one "<key>=<value>" line per field, and a blank line after each
+// job. The keys are input, output, binary-output (see -binary-costs-o) and, for
+// GCOV data, gcno and gcda. Paths may contain any character but a newline.
+//
+// With -cache-dir=<dir>, the optimize stage keeps the generated objects in a
+// content-addressed cache. The key is a hash of the module after ASAP (i.e.,
+// the original bitcode and the set of removed checks), the target and its
+// options, and the optimization level. Changing the sanity level then only
+// recompiles objects whose set of removed checks has actually changed. Once
+// all jobs are done, the least recently used objects are removed until the
+// cache is below -cache-size.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Instrumentation.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/SanityChecks.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace llvm;
+
+namespace {
+enum Stage { CoverageStage, CheckProfilingStage, OptimizeStage, CostsStage };
+}
+
+static cl::opt<Stage> AsapStage(
+    "stage", cl::desc("The ASAP stage to run:"), cl::Required,
+    cl::values(clEnumValN(CoverageStage, "coverage",
+                          "Instrument for GCOV coverage and generate code"),
+               clEnumValN(CheckProfilingStage, "check-profiling",
+                          "Instrument sanity checks with counters (see "
+                          "-asap-profiling) and generate code"),
+               clEnumValN(OptimizeStage, "optimize",
+                          "Remove expensive checks, optimize and generate "
+                          "code"),
+               clEnumValN(CostsStage, "costs",
+                          "Print the costs of sanity checks"),
+               clEnumValEnd));
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::init("-"));
+
+static cl::opt<std::string>
+OutputFilename("o", cl::desc("Output filename"), cl::value_desc("filename"));
+
+static cl::opt<std::string>
+JobsFilename("jobs", cl::desc("File that lists the objects to process, as "
+                              "input=, output=, binary-output=, gcno= and "
+                              "gcda= lines, with a blank line after each "
+                              "object"),
+             cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+NumThreads("j", cl::desc("Number of objects to process in parallel"),
+           cl::Prefix, cl::init(1));
+
+static cl::opt<std::string>
+BinaryOutputFilename("binary-costs-o",
+                     cl::desc("For the costs stage, also write the costs in "
+                              "the binary format, without locations"),
+                     cl::value_desc("filename"));
+
+static cl::opt<std::string>
+CacheDir("cache-dir", cl::desc("Cache for objects of the optimize stage"),
+         cl::value_desc("directory"));
+
+static cl::opt<unsigned>
+CacheSize("cache-size", cl::desc("Maximum size of the cache, in megabytes"),
+          cl::init(1024));
+
+// Determine optimization level.
+static cl::opt<char>
+OptLevel("O", cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] "
+                       "(default = '-O2')"),
+         cl::Prefix, cl::ZeroOrMore, cl::init(' '));
+
+namespace {
+struct Job {
+  std::string Input;
+  std::string Output;
+  std::string BinaryOutput;
+  std::string GCNO;
+  std::string GCDA;
+};
+}
+
+static const char *ProgramName;
+
+// Errors from different threads are printed one at a time.
+static std::mutex ErrorMutex;
+
+static void reportError(const Twine &Message) {
+  std::lock_guard<std::mutex> Lock(ErrorMutex);
+  errs() << ProgramName << ": " << Message << "\n";
+}
+
+// Bump this when the generated code changes for the same input, so that
+// stale cache entries are not reused.
+static const char *const CacheVersion = "asap-backend-cache-2";
+
+// Adds the target options to a cache key. Options that setFunctionAttributes
+// stores in the module, such as -disable-fp-elim, are already part of the
+// bitcode.
+static void hashTargetOptions(MD5 &Hash, const TargetOptions &Options) {
+  const MCTargetOptions &MCOptions = Options.MCOptions;
+  uint32_t Values[] = {
+      Options.LessPreciseFPMADOption, Options.UnsafeFPMath,
+      Options.NoInfsFPMath, Options.NoNaNsFPMath,
+      Options.HonorSignDependentRoundingFPMathOption, Options.NoZerosInBSS,
+      Options.GuaranteedTailCallOpt, Options.StackAlignmentOverride,
+      Options.EnableFastISel, Options.PositionIndependentExecutable,
+      Options.UseInitArray, Options.DisableIntegratedAS,
+      Options.CompressDebugSections, Options.FunctionSections,
+      Options.DataSections, Options.UniqueSectionNames,
+      Options.TrapUnreachable, (uint32_t)Options.FloatABIType,
+      (uint32_t)Options.AllowFPOpFusion, (uint32_t)Options.JTType,
+      (uint32_t)Options.ThreadModel, MCOptions.SanitizeAddress,
+      MCOptions.MCRelaxAll, MCOptions.MCNoExecStack,
+      MCOptions.MCUseDwarfDirectory, (uint32_t)MCOptions.DwarfVersion};
+  Hash.update(ArrayRef<uint8_t>((const uint8_t *)Values, sizeof(Values)));
+  Hash.update(MCOptions.ABIName);
+  Hash.update(ArrayRef<uint8_t>((const uint8_t *)"", 1));
+
+  // TargetRecip does not expose its settings; hash the -recip flag instead.
+  for (const std::string &Op : ReciprocalOps) {
+    Hash.update(Op);
+    Hash.update(ArrayRef<uint8_t>((const uint8_t *)",", 1));
+  }
+}
+
+// Returns the cache file for the given module, which has been processed by
+// ASAP, and the options that affect code generation.
+static std::string getCacheFile(Module &M, StringRef CPU, StringRef Features,
+                                const TargetOptions &Options, unsigned Level) {
+  // Costs are attached to the remaining checks, but do not change the code.
+  unsigned CostKind = M.getContext().getMDKindID("cost");
+  for (Function &F : M)
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        I.setMetadata(CostKind, nullptr);
+
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(&M, OS);
+  OS.flush();
+
+  MD5 Hash;
+  Hash.update(CacheVersion);
+  Hash.update(StringRef(Bitcode.data(), Bitcode.size()));
+  // Separate the strings, so that e.g. the CPU cannot run into the features.
+  for (StringRef S : {StringRef(M.getTargetTriple()), CPU, Features}) {
+    Hash.update(S);
+    Hash.update(ArrayRef<uint8_t>((const uint8_t *)"", 1));
+  }
+  hashTargetOptions(Hash, Options);
+  uint8_t Codes[] = {(uint8_t)Level, (uint8_t)RelocModel.getValue(),
+                     (uint8_t)CMModel.getValue()};
+  Hash.update(Codes);
+
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Key;
+  MD5::stringifyResult(Result, Key);
+
+  SmallString<128> File(CacheDir);
+  sys::path::append(File, Twine(Key) + ".o");
+  return File.str();
+}
+
+// Adds a generated object to the cache. The object is copied to a temporary
+// file first, so that concurrent builds never see partial entries.
+static void addToCache(StringRef Object, StringRef CacheFile) {
+  SmallString<128> TempModel(CacheDir);
+  sys::path::append(TempModel, "tmp-%%%%%%%%.o");
+  int FD;
+  SmallString<128> TempFile;
+  if (sys::fs::createUniqueFile(TempModel, FD, TempFile))
+    return;
+  sys::Process::SafelyCloseFileDescriptor(FD);
+  if (sys::fs::copy_file(Object, TempFile) ||
+      sys::fs::rename(TempFile, CacheFile))
+    sys::fs::remove(TempFile);
+}
+
+// Seconds after which a temporary cache file is considered abandoned.
+static const int64_t TempFileGracePeriod = 60 * 60;
+
+// Marks a cache entry as recently used, so that pruneCache keeps it.
+static void touchCacheFile(StringRef CacheFile) {
+  int FD;
+  if (sys::fs::openFileForRead(CacheFile, FD))
+    return;
+  sys::fs::setLastModificationAndAccessTime(FD, sys::TimeValue::now());
+  sys::Process::SafelyCloseFileDescriptor(FD);
+}
+
+// Removes the least recently used entries until the cache is no larger than
+// -cache-size. Entries that other processes remove concurrently are skipped.
+// Temporary files are skipped too, unless they are older than an hour: other
+// processes may still be writing them, and only those of crashed processes
+// are left behind for good.
+static void pruneCache() {
+  struct Entry {
+    std::string Path;
+    sys::TimeValue Time;
+    uint64_t Size;
+  };
+  std::vector<Entry> Entries;
+  uint64_t TotalSize = 0;
+  sys::TimeValue StaleTime =
+      sys::TimeValue::now() - sys::TimeValue(TempFileGracePeriod);
+
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(CacheDir, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    sys::fs::file_status Status;
+    if (I->status(Status) || !sys::fs::is_regular_file(Status))
+      continue;
+    if (sys::path::filename(I->path()).startswith("tmp-") &&
+        Status.getLastModificationTime() > StaleTime)
+      continue;
+    Entries.push_back(
+        Entry{I->path(), Status.getLastModificationTime(), Status.getSize()});
+    TotalSize += Status.getSize();
+  }
+
+  uint64_t MaxSize = (uint64_t)CacheSize * 1024 * 1024;
+  if (TotalSize <= MaxSize)
+    return;
+
+  std::sort(Entries.begin(), Entries.end(),
+            [](const Entry &A, const Entry &B) { return A.Time < B.Time; });
+  for (const Entry &Old : Entries) {
+    if (TotalSize <= MaxSize)
+      break;
+    sys::fs::remove(Old.Path);
+    TotalSize -= Old.Size;
+  }
+}
+
+static void addOptimizationPasses(legacy::PassManagerBase &MPM,
+                                  legacy::FunctionPassManager &FPM,
+                                  unsigned Level) {
+  PassManagerBuilder Builder;
+  Builder.OptLevel = Level;
+  if (Level > 1)
+    Builder.Inliner = createFunctionInliningPass(Level, 0);
+  else
+    Builder.Inliner = createAlwaysInlinerPass();
+  Builder.DisableUnrollLoops = Level == 0;
+  Builder.LoopVectorize = Level > 1;
+  Builder.SLPVectorize = Level > 1;
+
+  Builder.populateFunctionPassManager(FPM);
+  Builder.populateModulePassManager(MPM);
+}
+
+static bool runJob(const Job &J, CodeGenOpt::Level OLvl, unsigned Level) {
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(J.Input, Err, Context);
+  if (!M) {
+    std::lock_guard<std::mutex> Lock(ErrorMutex);
+    Err.print(ProgramName, errs());
+    return false;
+  }
+  if (verifyModule(*M, &errs())) {
+    reportError(J.Input + ": error: input module is broken!");
+    return false;
+  }
+
+  Triple TheTriple(M->getTargetTriple());
+  if (TheTriple.getTriple().empty())
+    TheTriple.setTriple(sys::getDefaultTargetTriple());
+
+  std::string Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget(MArch, TheTriple,
+                                                         Error);
+  if (!TheTarget) {
+    reportError(Error);
+    return false;
+  }
+
+  std::string CPUStr = getCPUStr(), FeaturesStr = getFeaturesStr();
+  TargetOptions Options = InitTargetOptionsFromCodeGenFlags();
+  std::unique_ptr<TargetMachine> TM(
+      TheTarget->createTargetMachine(TheTriple.getTriple(), CPUStr, FeaturesStr,
+                                     Options, RelocModel, CMModel, OLvl));
+  assert(TM && "Could not allocate target machine!");
+  if (const DataLayout *DL = TM->getDataLayout())
+    M->setDataLayout(*DL);
+  setFunctionAttributes(CPUStr, FeaturesStr, *M);
+
+  std::error_code EC;
+  sys::fs::OpenFlags Flags =
+      AsapStage == CostsStage ? sys::fs::F_Text : sys::fs::F_None;
+  tool_output_file Out(J.Output, EC, Flags);
+  if (EC) {
+    reportError(J.Output + ": " + EC.message());
+    return false;
+  }
+
+  TargetLibraryInfoImpl TLII(TheTriple);
+  TargetIRAnalysis TIRA = TM->getTargetIRAnalysis();
+
+  // The ASAP passes run first, on the unmodified input. Their cost model
+  // relies on the CFG that the profiling data was collected for.
+  legacy::PassManager AsapPM;
+  AsapPM.add(new TargetLibraryInfoWrapperPass(TLII));
+  AsapPM.add(createTargetTransformInfoWrapperPass(TIRA));
+  if (!J.GCNO.empty() &&
+      (AsapStage == OptimizeStage || AsapStage == CostsStage))
+    AsapPM.add(createSanityCheckCostPass(J.GCNO, J.GCDA));
+
+  switch (AsapStage) {
+  case CoverageStage:
+    AsapPM.add(createGCOVProfilerPass());
+    break;
+  case CheckProfilingStage:
+    AsapPM.add(createAsapProfilingPass());
+    break;
+  case OptimizeStage:
+    AsapPM.add(createAsapPass());
+    break;
+  case CostsStage: {
+    AsapPM.add(createSanityCheckCostPrinterPass(Out.os()));
+    std::unique_ptr<tool_output_file> BinaryOut;
+    if (!J.BinaryOutput.empty()) {
+      BinaryOut.reset(
+          new tool_output_file(J.BinaryOutput, EC, sys::fs::F_None));
+      if (EC) {
+        reportError(J.BinaryOutput + ": " + EC.message());
+        return false;
+      }
+      AsapPM.add(createSanityCheckCostPrinterPass(BinaryOut->os(), true));
+    }
+    AsapPM.run(*M);
+    Out.keep();
+    if (BinaryOut)
+      BinaryOut->keep();
+    return true;
+  }
+  }
+  AsapPM.run(*M);
+
+  std::string CacheFile;
+  if (AsapStage == OptimizeStage && !CacheDir.empty()) {
+    CacheFile = getCacheFile(*M, CPUStr, FeaturesStr, Options, Level);
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Cached =
+        MemoryBuffer::getFile(CacheFile);
+    if (Cached) {
+      Out.os() << Cached.get()->getBuffer();
+      Out.keep();
+      touchCacheFile(CacheFile);
+      return true;
+    }
+  }
+
+  legacy::PassManager PM;
+  PM.add(new TargetLibraryInfoWrapperPass(TLII));
+  PM.add(createTargetTransformInfoWrapperPass(TIRA));
+
+  if (AsapStage == OptimizeStage) {
+    legacy::FunctionPassManager FPM(M.get());
+    FPM.add(createTargetTransformInfoWrapperPass(TIRA));
+    addOptimizationPasses(PM, FPM, Level);
+    FPM.doInitialization();
+    for (Function &F : *M)
+      FPM.run(F);
+    FPM.doFinalization();
+  }
+
+  if (TM->addPassesToEmitFile(PM, Out.os(), TargetMachine::CGFT_ObjectFile)) {
+    reportError("target does not support generation of object files");
+    return false;
+  }
+  PM.run(*M);
+  Out.keep();
+
+  if (!CacheFile.empty()) {
+    Out.os().close();
+    addToCache(J.Output, CacheFile);
+  }
+  return true;
+}
+
+static bool readJobs(std::vector<Job> &Jobs) {
+  if (JobsFilename.empty()) {
+    if (OutputFilename.empty()) {
+      reportError("no output filename given (-o)");
+      return false;
+    }
+    Jobs.push_back(
+        Job{InputFilename, OutputFilename, BinaryOutputFilename, "", ""});
+    return true;
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFileOrSTDIN(JobsFilename);
+  if (std::error_code EC = Buffer.getError()) {
+    reportError(JobsFilename + ": " + EC.message());
+    return false;
+  }
+  SmallVector<StringRef, 64> Lines;
+  Buffer.get()->getBuffer().split(Lines, "\n");
+  // The end of the file also ends the last job.
+  Lines.push_back("");
+
+  Job J;
+  for (StringRef Line : Lines) {
+    if (Line.empty()) {
+      if (J.Input.empty() && J.Output.empty() && J.BinaryOutput.empty() &&
+          J.GCNO.empty() && J.GCDA.empty())
+        continue;
+      if (J.Input.empty() || J.Output.empty() ||
+          J.GCNO.empty() != J.GCDA.empty()) {
+        reportError(JobsFilename + ": incomplete job for " +
+                    (J.Input.empty() ? J.Output : J.Input));
+        return false;
+      }
+      Jobs.push_back(J);
+      J = Job();
+      continue;
+    }
+
+    std::pair<StringRef, StringRef> Field = Line.split('=');
+    std::string *Value = StringSwitch<std::string *>(Field.first)
+                             .Case("input", &J.Input)
+                             .Case("output", &J.Output)
+                             .Case("binary-output", &J.BinaryOutput)
+                             .Case("gcno", &J.GCNO)
+                             .Case("gcda", &J.GCDA)
+                             .Default(nullptr);
+    if (!Value || Field.second.empty()) {
+      reportError(JobsFilename + ": invalid line: " + Line);
+      return false;
+    }
+    *Value = Field.second;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+  ProgramName = argv[0];
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeScalarOpts(Registry);
+  initializeVectorization(Registry);
+  initializeIPO(Registry);
+  initializeAnalysis(Registry);
+  initializeIPA(Registry);
+  initializeTransformUtils(Registry);
+  initializeInstCombine(Registry);
+  initializeInstrumentation(Registry);
+  initializeTarget(Registry);
+  initializeCodeGen(Registry);
+
+  cl::ParseCommandLineOptions(argc, argv, "ASAP backend\n");
+
+  CodeGenOpt::Level OLvl = CodeGenOpt::Default;
+  unsigned Level = 2;
+  switch (OptLevel) {
+  default:
+    reportError("invalid optimization level.");
+    return 1;
+  case ' ': break;
+  case '0': OLvl = CodeGenOpt::None; Level = 0; break;
+  case '1': OLvl = CodeGenOpt::Less; Level = 1; break;
+  case '2': OLvl = CodeGenOpt::Default; Level = 2; break;
+  case '3': OLvl = CodeGenOpt::Aggressive; Level = 3; break;
+  }
+
+  std::vector<Job> Jobs;
+  if (!readJobs(Jobs))
+    return 1;
+
+  std::atomic<size_t> NextJob(0);
+  std::atomic<bool> Failed(false);
+  auto Worker = [&]() {
+    for (size_t I = NextJob++; I < Jobs.size(); I = NextJob++)
+      if (!runJob(Jobs[I], OLvl, Level))
+        Failed = true;
+  };
+
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < NumThreads && I < Jobs.size(); ++I)
+    Threads.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+
+  if (AsapStage == OptimizeStage && !CacheDir.empty())
+    pruneCache();
+
+  return Failed ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+//===- asap-cost-threshold.cpp - Computes ASAP cost thresholds ------------===//
+//
+// This file is part of ASAP.
+// Please see LICENSE.txt for copyright and licensing information.
+//
+//===----------------------------------------------------------------------===//
+//
+// asap-cost-threshold reads the costs of all sanity checks in a program, and
+// computes the cost threshold for a given sanity level or cost level. Checks
+// whose cost is at least the threshold will be removed.
+//
+// Costs files are either the text output of opt -analyze -sanity-check-cost,
+// or the binary costs format. Both are sorted by decreasing cost, so the files
+// are merged in a streaming fashion rather than loaded into memory. If there
+// are more files than can be opened at once, groups of them are first merged
+// into temporary binary files.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/SanityChecks.h"
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace llvm;
+
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<costs files>"), cl::ZeroOrMore);
+
+static cl::opt<std::string>
+InputList("costs-list", cl::desc("File that lists costs files, one per line"),
+          cl::value_desc("filename"));
+
+static cl::opt<double>
+SanityLevel("sanity-level",
+            cl::desc("Fraction of static checks to keep"), cl::init(-1.0));
+
+static cl::opt<double>
+CostLevel("cost-level",
+          cl::desc("Fraction of the total cost to keep"), cl::init(-1.0));
+
+static cl::opt<unsigned>
+MaxOpenFiles("max-open-files",
+             cl::desc("Number of costs files that are merged at once"),
+             cl::init(512), cl::Hidden);
+
+static const char *ProgramName;
+
+static void reportError(const Twine &Message) {
+  errs() << ProgramName << ": " << Message << "\n";
+}
+
+namespace {
+// Reads the costs from one file, in decreasing order.
+class CostReader {
+public:
+  bool open(StringRef FileName) {
+    this->FileName = FileName;
+    ErrorOr<std::unique_ptr<MemoryBuffer>> B =
+        MemoryBuffer::getFile(FileName, -1, /*RequiresNullTerminator=*/false);
+    if (std::error_code EC = B.getError()) {
+      reportError(FileName + ": " + EC.message());
+      return false;
+    }
+    Buffer = std::move(B.get());
+    Pos = Buffer->getBufferStart();
+    End = Buffer->getBufferEnd();
+    Previous = UINT64_MAX;
+
+    const size_t HeaderSize = 3 * sizeof(uint64_t);
+    uint64_t Header[3];
+    Binary = false;
+    if ((size_t)(End - Pos) >= HeaderSize) {
+      memcpy(Header, Pos, HeaderSize);
+      Binary = Header[0] == SanityCheckCostsMagic;
+    }
+    if (!Binary)
+      return true;
+
+    if (Header[1] != SanityCheckCostsVersion ||
+        (size_t)(End - Pos - HeaderSize) / sizeof(uint64_t) != Header[2]) {
+      reportError(FileName + ": invalid binary costs file");
+      return false;
+    }
+    Pos += HeaderSize;
+    return true;
+  }
+
+  // Stores the next cost in Cost. Returns false at the end of the file, or
+  // if the file is invalid; Failed tells these apart.
+  bool next(uint64_t &Cost) {
+    if (!(Binary ? nextBinary(Cost) : nextText(Cost)))
+      return false;
+    if (Cost > Previous) {
+      reportError(FileName + ": costs are not sorted in decreasing order");
+      Failed = true;
+      return false;
+    }
+    Previous = Cost;
+    return true;
+  }
+
+  bool Failed = false;
+
+private:
+  std::string FileName;
+  std::unique_ptr<MemoryBuffer> Buffer;
+  const char *Pos;
+  const char *End;
+  bool Binary;
+  uint64_t Previous;
+
+  bool nextBinary(uint64_t &Cost) {
+    if (Pos == End)
+      return false;
+    memcpy(&Cost, Pos, sizeof(Cost));
+    Pos += sizeof(Cost);
+    return true;
+  }
+
+  // Text files contain a header, and then a line per check, which starts
+  // with its cost. Lines that do not start with a number are ignored.
+  bool nextText(uint64_t &Cost) {
+    while (Pos != End) {
+      const char *LineEnd = std::find(Pos, End, '\n');
+      StringRef Line(Pos, LineEnd - Pos);
+      Pos = LineEnd == End ? End : LineEnd + 1;
+
+      Line = Line.ltrim();
+      size_t Digits = Line.find_first_not_of("0123456789");
+      if (Digits == 0 || Digits == StringRef::npos ||
+          !isspace((unsigned char)Line[Digits]))
+        continue;
+      if (!Line.substr(0, Digits).getAsInteger(10, Cost))
+        return true;
+    }
+    return false;
+  }
+};
+
+// Merges the costs of several files, in decreasing order.
+class CostMerger {
+public:
+  bool open(ArrayRef<std::string> FileNames) {
+    for (const std::string &FileName : FileNames) {
+      Readers.emplace_back(new CostReader);
+      if (!Readers.back()->open(FileName))
+        return false;
+      advance(Readers.size() - 1);
+    }
+    return !failed();
+  }
+
+  bool next(uint64_t &Cost) {
+    if (Heads.empty())
+      return false;
+    Cost = Heads.top().first;
+    size_t Index = Heads.top().second;
+    Heads.pop();
+    advance(Index);
+    return true;
+  }
+
+  bool failed() const {
+    for (const auto &R : Readers)
+      if (R->Failed)
+        return true;
+    return false;
+  }
+
+private:
+  std::vector<std::unique_ptr<CostReader>> Readers;
+  std::priority_queue<std::pair<uint64_t, size_t>> Heads;
+
+  void advance(size_t Index) {
+    uint64_t Cost;
+    if (Readers[Index]->next(Cost))
+      Heads.push(std::make_pair(Cost, Index));
+  }
+};
+} // end anonymous namespace
+
+// Merges groups of files into temporary binary files, until the remaining
+// files can all be opened at once.
+static bool reduceFiles(std::vector<std::string> &Files,
+                        std::vector<std::string> &TempFiles) {
+  unsigned GroupSize = std::max(MaxOpenFiles.getValue(), 2u);
+  while (Files.size() > GroupSize) {
+    std::vector<std::string> Merged;
+    for (size_t Begin = 0; Begin < Files.size(); Begin += GroupSize) {
+      size_t Size = std::min<size_t>(GroupSize, Files.size() - Begin);
+      CostMerger Merger;
+      if (!Merger.open(makeArrayRef(Files).slice(Begin, Size)))
+        return false;
+
+      int FD;
+      SmallString<128> TempName;
+      if (std::error_code EC =
+              sys::fs::createTemporaryFile("asap-costs", "bin", FD,
+                                           TempName)) {
+        reportError("cannot create temporary file: " + EC.message());
+        return false;
+      }
+      TempFiles.push_back(TempName.str());
+      Merged.push_back(TempName.str());
+
+      raw_fd_ostream OS(FD, /*shouldClose=*/true);
+      uint64_t Header[] = {SanityCheckCostsMagic, SanityCheckCostsVersion, 0};
+      OS.write(reinterpret_cast<const char *>(Header), sizeof(Header));
+      uint64_t Cost;
+      while (Merger.next(Cost)) {
+        OS.write(reinterpret_cast<const char *>(&Cost), sizeof(Cost));
+        Header[2] += 1;
+      }
+      if (Merger.failed())
+        return false;
+      OS.pwrite(reinterpret_cast<const char *>(Header), sizeof(Header), 0);
+    }
+    Files.swap(Merged);
+  }
+  return true;
+}
+
+static bool readFileList(std::vector<std::string> &Files) {
+  Files.assign(InputFilenames.begin(), InputFilenames.end());
+  if (InputList.empty())
+    return true;
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFileOrSTDIN(InputList);
+  if (std::error_code EC = Buffer.getError()) {
+    reportError(InputList + ": " + EC.message());
+    return false;
+  }
+  SmallVector<StringRef, 64> Lines;
+  Buffer.get()->getBuffer().split(Lines, "\n", -1, false);
+  for (StringRef Line : Lines) {
+    Line = Line.trim();
+    if (!Line.empty())
+      Files.push_back(Line);
+  }
+  return true;
+}
+
+// Computes the threshold in a single pass over all costs, in decreasing
+// order. The threshold only ever moves to the end of a run of equal costs;
+// the removed checks are always a prefix of the sorted costs.
+static bool computeThreshold(ArrayRef<std::string> Files, uint64_t NumCosts,
+                             uint64_t TotalCost) {
+  CostMerger Merger;
+  if (!Merger.open(Files))
+    return false;
+
+  uint64_t Cost;
+  if (!Merger.next(Cost)) {
+    reportError("no costs found");
+    return false;
+  }
+
+  uint64_t Threshold = Cost + 1;
+  uint64_t NumRemoved = 0;
+  uint64_t RemovedCost = 0;
+
+  uint64_t Index = 0;
+  uint64_t PrefixCost = 0;
+  bool HasNext = true;
+  while (HasNext) {
+    uint64_t Next;
+    HasNext = Merger.next(Next);
+    PrefixCost += Cost;
+
+    if (!HasNext || Next != Cost) {
+      bool Remove;
+      if (SanityLevel >= 0) {
+        // NumCosts - Index - 1 checks are left if all checks costing Cost or
+        // more are removed.
+        Remove = NumCosts - Index - 1 >= NumCosts * SanityLevel;
+      } else {
+        // We never want to remove checks with cost zero
+        if (Cost == 0)
+          break;
+        Remove = TotalCost - PrefixCost >= TotalCost * CostLevel;
+      }
+      if (Remove) {
+        Threshold = Cost;
+        NumRemoved = Index + 1;
+        RemovedCost = PrefixCost;
+      }
+    }
+
+    Cost = Next;
+    Index += 1;
+  }
+  if (Merger.failed())
+    return false;
+
+  outs() << "Cost threshold is " << Threshold << "\n";
+  outs() << format("Removing %llu out of %llu static checks (%.2f%%)\n",
+                   (unsigned long long)NumRemoved,
+                   (unsigned long long)NumCosts,
+                   100.0 * NumRemoved / NumCosts);
+  outs() << format("Removing %llu out of %llu dynamic checks (%.2f%%)\n",
+                   (unsigned long long)RemovedCost,
+                   (unsigned long long)TotalCost,
+                   100.0 * RemovedCost / TotalCost);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+  ProgramName = argv[0];
+
+  cl::ParseCommandLineOptions(argc, argv, "ASAP cost threshold\n");
+
+  if ((SanityLevel >= 0) == (CostLevel >= 0)) {
+    reportError("specify either -sanity-level or -cost-level");
+    return 1;
+  }
+
+  std::vector<std::string> Files;
+  if (!readFileList(Files))
+    return 1;
+
+  std::vector<std::string> TempFiles;
+  bool Success = reduceFiles(Files, TempFiles);
+
+  // The first pass finds the number of checks and their total cost, which
+  // the levels are relative to.
+  uint64_t NumCosts = 0;
+  uint64_t TotalCost = 0;
+  if (Success) {
+    CostMerger Merger;
+    Success = Merger.open(Files);
+    uint64_t Cost;
+    while (Success && Merger.next(Cost)) {
+      NumCosts += 1;
+      if (TotalCost + Cost < TotalCost) {
+        reportError("total cost overflows");
+        Success = false;
+      }
+      TotalCost += Cost;
+    }
+    Success = Success && !Merger.failed();
+  }
+
+  if (Success && NumCosts != 0 && TotalCost == 0) {
+    reportError("all costs are zero");
+    Success = false;
+  }
+  if (Success)
+    Success = computeThreshold(Files, NumCosts, TotalCost);
+
+  for (const std::string &TempFile : TempFiles)
+    sys::fs::remove(TempFile);
+  return Success ? 0 : 1;
+}
@@ -39,6 +39,7 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/SanityChecks.h"
 #include "llvm/Transforms/Utils/GlobalStatus.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
@@ -730,6 +731,10 @@ static void runLTOPasses(Module &M, TargetMachine &TM) {
   PMB.LoopVectorize = true;
   PMB.SLPVectorize = true;
   PMB.OptLevel = options::OptLevel;
+#ifdef LLVM_ASAP_LTO
+  PMB.addExtension(PassManagerBuilder::EP_FullLinkTimeOptimizationEarly,
+                   addAsapLTOPasses);
+#endif
   PMB.populateLTOPassManager(passes);
   passes.run(M);
 }